@@ -0,0 +1,142 @@
+# Copyright (c) 2025 Janea Systems
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of
+# this software and associated documentation files (the "Software"), to deal in
+# the Software without restriction, including without limitation the rights to
+# use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+# the Software, and to permit persons to whom the Software is furnished to do so,
+# subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+# FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+# COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+# IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+
+"""
+This script compares a flat and an HNSW coarse quantizer for IndexIVFJecq
+at growing numbers of inverted lists.
+
+For each nlist it times training, adding and a batch search with both
+quantizers, and reports the recall of the HNSW index against the flat one.
+A last configuration with 2^18 lists, the scale of billion-vector datasets,
+runs with the HNSW quantizer only and reports the recall against exact
+search.
+"""
+
+from utils.resources import time_it
+from utils.search import search_k_default as k
+from utils.example_embeddings import get_example_embeddings
+import pandas as pd
+import numpy as np
+from utils.common import df_to_str, log_info
+import jecq
+import logging
+
+logger = logging.getLogger(__name__)
+
+logger.info(f"Starting {__file__}...")
+log_info()
+
+
+# Values are from running demos/demo_parameter_optimize.py
+pq_multiplier = 625.823
+th_high = 0.0079425
+th_mid = 8.56425e-05
+
+duplication_factor = 10
+batch_size = 256
+nlists = [256, 1024, 4096]
+nprobe_factor = 0.1
+hnsw_m = 32
+
+logger.info("Loading dataset...")
+text, data_original = get_example_embeddings()
+data = np.asarray(pd.concat([data_original] * duplication_factor, ignore_index=True))
+train_data = np.asarray(data_original)
+queries = train_data[:batch_size].copy()
+
+n, d = data.shape
+
+metrics = []
+columns = ["nlist", "quantizer", "train_sec", "add_sec", "search_sec", "recall"]
+
+for nlist in nlists:
+    labels = {}
+
+    for name in ["flat", "hnsw"]:
+        if name == "flat":
+            index = jecq.IndexIVFJecq(d, nlist, pq_multiplier, th_high, th_mid)
+        else:
+            quantizer = jecq.IndexHNSWFlat(d, hnsw_m, jecq.METRIC_INNER_PRODUCT)
+            index = jecq.IndexIVFJecq(quantizer, d, nlist, pq_multiplier, th_high, th_mid)
+        index.nprobe = max(1, int(np.ceil(nprobe_factor * nlist)))
+        index.verbose = False
+
+        logger.info(f"[nlist={nlist}, {name}] Training and adding {n} vectors...")
+        train_time = time_it(lambda: index.train(train_data))
+        add_time = time_it(lambda: index.add(data))
+        search_time = time_it(lambda: labels.update({name: index.search(queries, k)[1]}))
+
+        recall = np.mean(
+            [len(set(a) & set(b)) / k for a, b in zip(labels["flat"], labels[name])]
+        )
+        metrics.append([nlist, name, train_time, add_time, search_time, recall])
+        logger.info(
+            f"[nlist={nlist}, {name}] train={train_time}s, add={add_time}s, "
+            f"search={search_time}s, recall={recall:.3f}"
+        )
+
+df = pd.DataFrame(metrics, columns=columns)
+logger.info(f"Coarse quantizer summary:\n{df_to_str(df.round(3))}")
+
+# At 2^18 lists a flat quantizer compares every vector with every centroid,
+# in k-means and in add, so it is left out. k-means assigns the training
+# points through an HNSW index (clustering_index) as well. The example
+# embeddings are resampled with small noise to get enough distinct points.
+large_nlist = 2**18
+large_n = 2 * large_nlist
+large_nprobe = 64
+large_niter = 10
+
+logger.info(f"Sampling {large_n} noisy vectors...")
+rng = np.random.default_rng(123)
+large_data = train_data[rng.integers(0, len(train_data), large_n)]
+large_data = large_data + rng.normal(scale=0.01, size=large_data.shape)
+large_data /= np.linalg.norm(large_data, axis=1, keepdims=True)
+large_data = large_data.astype(np.float32)
+
+# exact inner product neighbors, a few queries at a time
+ground_truth = []
+for q in np.array_split(queries, 8):
+    scores = q @ large_data.T
+    top = np.argpartition(-scores, k, axis=1)[:, :k]
+    ground_truth.extend(top)
+
+quantizer = jecq.IndexHNSWFlat(d, hnsw_m, jecq.METRIC_INNER_PRODUCT)
+clustering_index = jecq.IndexHNSWFlat(d, hnsw_m, jecq.METRIC_INNER_PRODUCT)
+index = jecq.IndexIVFJecq(quantizer, d, large_nlist, pq_multiplier, th_high, th_mid)
+index.clustering_index = clustering_index
+index.cp.niter = large_niter
+index.nprobe = large_nprobe
+index.verbose = False
+
+logger.info(f"[nlist={large_nlist}, hnsw] Training and adding {large_n} vectors...")
+train_time = time_it(lambda: index.train(large_data))
+add_time = time_it(lambda: index.add(large_data))
+result = {}
+search_time = time_it(lambda: result.update(labels=index.search(queries, k)[1]))
+
+recall = np.mean(
+    [len(set(a) & set(b)) / k for a, b in zip(ground_truth, result["labels"])]
+)
+logger.info(
+    f"[nlist={large_nlist}, hnsw, nprobe={large_nprobe}] train={train_time}s, "
+    f"add={add_time}s, search={search_time}s, recall vs exact={recall:.3f}"
+)
@@ -0,0 +1,87 @@
+# Copyright (c) 2025 Janea Systems
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of
+# this software and associated documentation files (the "Software"), to deal in
+# the Software without restriction, including without limitation the rights to
+# use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+# the Software, and to permit persons to whom the Software is furnished to do so,
+# subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+# FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+# COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+# IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+"""
+This script measures how IndexJecq search scales with the number of
+OpenMP threads.
+
+It times a batch search and a sequence of single-query searches for
+1, 2, 4, ... threads up to the machine maximum and reports the speedup
+over a single thread.
+"""
+
+from utils.resources import time_it
+from utils.search import search_k_default as k
+from utils.vector_indices import get_default_indices, get_name
+from utils.example_embeddings import get_example_embeddings
+import pandas as pd
+import numpy as np
+from utils.common import df_to_str, log_info
+import jecq
+import logging
+
+logger = logging.getLogger(__name__)
+
+logger.info(f"Starting {__file__}...")
+log_info()
+
+
+duplication_factor = 50
+batch_size = 256
+single_query_count = 16
+
+logger.info("Loading dataset...")
+text, data_original = get_example_embeddings()
+data = np.asarray(pd.concat([data_original] * duplication_factor, ignore_index=True))
+queries = np.asarray(data_original)[:batch_size].copy()
+
+n, d = data.shape
+index = next(
+    index for index in get_default_indices(n=n, d=d) if get_name(index) == "IndexJecq"
+)
+index.verbose = False
+
+logger.info(f"[{get_name(index)}] Training and adding {n} vectors...")
+index.train(np.asarray(data_original))
+index.add(data)
+
+max_threads = jecq.omp_get_max_threads()
+thread_counts = sorted({1 << i for i in range(max_threads.bit_length())} | {max_threads})
+
+metrics = []
+columns = ["threads", "batch_search_sec", "batch_speedup", "single_search_sec", "single_speedup"]
+
+for threads in thread_counts:
+    jecq.omp_set_num_threads(threads)
+
+    batch_time = time_it(lambda: index.search(queries, k))
+    single_time = time_it(
+        lambda: [index.search(queries[i : i + 1], k) for i in range(single_query_count)]
+    )
+
+    metrics.append([threads, batch_time, 0.0, single_time, 0.0])
+    logger.info(f"[{threads} threads] batch={batch_time}s, single={single_time}s")
+
+jecq.omp_set_num_threads(max_threads)
+
+df = pd.DataFrame(metrics, columns=columns)
+df["batch_speedup"] = df["batch_search_sec"].iloc[0] / df["batch_search_sec"]
+df["single_speedup"] = df["single_search_sec"].iloc[0] / df["single_search_sec"]
+logger.info(f"Search scaling summary:\n{df_to_str(df.round(2))}")
@@ -0,0 +1,312 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "compressed_ids_inverted_lists.h"
+#include "index_io.h"
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/io_macros.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <typeinfo>
+
+namespace jecq {
+
+CompressedIdsInvertedLists::CompressedIdsInvertedLists(
+        size_t nlist,
+        size_t code_size,
+        size_t n_per_block)
+        : InvertedLists(nlist, code_size),
+          n_per_block(n_per_block),
+          codes(nlist),
+          id_blocks(nlist),
+          id_tails(nlist) {
+    FAISS_THROW_IF_NOT(n_per_block > 0);
+}
+
+CompressedIdsInvertedLists::IdBlock CompressedIdsInvertedLists::pack_ids(
+        const faiss::idx_t* ids) const {
+    IdBlock block;
+    block.base = *std::min_element(ids, ids + n_per_block);
+
+    // offsets are taken modulo 2^64, so any range of ids fits
+    uint64_t max_offset = 0;
+    for (size_t i = 0; i < n_per_block; ++i) {
+        max_offset = std::max(max_offset, uint64_t(ids[i]) - block.base);
+    }
+    while (block.nbits < 64 && (max_offset >> block.nbits) != 0) {
+        block.nbits++;
+    }
+
+    block.words.resize((n_per_block * block.nbits + 63) / 64);
+    for (size_t i = 0; i < n_per_block && block.nbits > 0; ++i) {
+        const uint64_t offset = uint64_t(ids[i]) - block.base;
+        const size_t bit = i * block.nbits;
+        const size_t w = bit / 64;
+        const size_t shift = bit % 64;
+
+        block.words[w] |= offset << shift;
+        if (shift + block.nbits > 64) {
+            block.words[w + 1] |= offset >> (64 - shift);
+        }
+    }
+
+    return block;
+}
+
+void CompressedIdsInvertedLists::unpack_ids(
+        const IdBlock& block,
+        faiss::idx_t* ids) const {
+    for (size_t i = 0; i < n_per_block; ++i) {
+        ids[i] = block.get(i);
+    }
+}
+
+void CompressedIdsInvertedLists::pack_tail(size_t list_no) {
+    auto& blocks = id_blocks[list_no];
+    auto& tail = id_tails[list_no];
+
+    size_t j = 0;
+    for (; j + n_per_block <= tail.size(); j += n_per_block) {
+        blocks.push_back(pack_ids(tail.data() + j));
+    }
+    tail.erase(tail.begin(), tail.begin() + j);
+}
+
+size_t CompressedIdsInvertedLists::ids_memory() const {
+    size_t bytes = 0;
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        for (const IdBlock& block : id_blocks[list_no]) {
+            bytes += sizeof(block) + block.words.size() * sizeof(uint64_t);
+        }
+        bytes += id_tails[list_no].size() * sizeof(faiss::idx_t);
+    }
+    return bytes;
+}
+
+size_t CompressedIdsInvertedLists::list_size(size_t list_no) const {
+    assert(list_no < nlist);
+    return id_blocks[list_no].size() * n_per_block + id_tails[list_no].size();
+}
+
+const uint8_t* CompressedIdsInvertedLists::get_codes(size_t list_no) const {
+    assert(list_no < nlist);
+    return codes[list_no].data();
+}
+
+const faiss::idx_t* CompressedIdsInvertedLists::get_ids(size_t list_no) const {
+    assert(list_no < nlist);
+    const auto& blocks = id_blocks[list_no];
+    const auto& tail = id_tails[list_no];
+
+    faiss::idx_t* ids = new faiss::idx_t[list_size(list_no)];
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        unpack_ids(blocks[b], ids + b * n_per_block);
+    }
+    std::copy(tail.begin(), tail.end(), ids + blocks.size() * n_per_block);
+    return ids;
+}
+
+void CompressedIdsInvertedLists::release_ids(
+        size_t /*list_no*/,
+        const faiss::idx_t* ids) const {
+    delete[] ids;
+}
+
+faiss::idx_t CompressedIdsInvertedLists::get_single_id(
+        size_t list_no,
+        size_t offset) const {
+    assert(offset < list_size(list_no));
+    return get_id(list_no, offset);
+}
+
+size_t CompressedIdsInvertedLists::add_entries(
+        size_t list_no,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    if (n_entry == 0) {
+        return 0;
+    }
+
+    assert(list_no < nlist);
+    const size_t o = list_size(list_no);
+
+    auto& tail = id_tails[list_no];
+    tail.insert(tail.end(), ids_in, ids_in + n_entry);
+    pack_tail(list_no);
+
+    codes[list_no].resize((o + n_entry) * code_size);
+    memcpy(&codes[list_no][o * code_size], code, n_entry * code_size);
+    return o;
+}
+
+void CompressedIdsInvertedLists::update_entries(
+        size_t list_no,
+        size_t offset,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    assert(list_no < nlist);
+    assert(offset + n_entry <= list_size(list_no));
+    if (n_entry == 0) {
+        return;
+    }
+
+    memcpy(&codes[list_no][offset * code_size], code, n_entry * code_size);
+
+    auto& blocks = id_blocks[list_no];
+    auto& tail = id_tails[list_no];
+    const size_t n_packed = blocks.size() * n_per_block;
+    std::vector<faiss::idx_t> block_ids(n_per_block);
+
+    // packed blocks are decoded, updated and packed again
+    size_t i = 0;
+    while (i < n_entry && offset + i < n_packed) {
+        const size_t b = (offset + i) / n_per_block;
+        const size_t end = std::min(n_entry, (b + 1) * n_per_block - offset);
+
+        unpack_ids(blocks[b], block_ids.data());
+        for (; i < end; ++i) {
+            block_ids[offset + i - b * n_per_block] = ids_in[i];
+        }
+        blocks[b] = pack_ids(block_ids.data());
+    }
+
+    for (; i < n_entry; ++i) {
+        tail[offset + i - n_packed] = ids_in[i];
+    }
+}
+
+void CompressedIdsInvertedLists::resize(size_t list_no, size_t new_size) {
+    auto& blocks = id_blocks[list_no];
+    auto& tail = id_tails[list_no];
+
+    if (new_size < blocks.size() * n_per_block) {
+        // the block that holds the new end becomes the tail
+        const size_t b = new_size / n_per_block;
+        tail.resize(n_per_block);
+        unpack_ids(blocks[b], tail.data());
+        tail.resize(new_size - b * n_per_block);
+        blocks.resize(b);
+    } else {
+        tail.resize(new_size - blocks.size() * n_per_block);
+        pack_tail(list_no);
+    }
+
+    codes[list_no].resize(new_size * code_size);
+}
+
+CompressedIdsInvertedListsIOHook::CompressedIdsInvertedListsIOHook()
+        : InvertedListsIOHook(
+                  "ilci",
+                  typeid(CompressedIdsInvertedLists).name()) {}
+
+// The blocks of a list are written as three arrays: their bases, their bit
+// widths and the concatenation of their words.
+void CompressedIdsInvertedListsIOHook::write(
+        const faiss::InvertedLists* ils,
+        faiss::IOWriter* f) const {
+    const auto* il = dynamic_cast<const CompressedIdsInvertedLists*>(ils);
+    FAISS_THROW_IF_NOT(il);
+
+    const uint32_t h = faiss::fourcc(key);
+    WRITE1(h);
+    write_io_version(f);
+    WRITE1(il->nlist);
+    WRITE1(il->code_size);
+    WRITE1(il->n_per_block);
+
+    std::vector<faiss::idx_t> bases;
+    std::vector<int> nbits;
+    std::vector<uint64_t> words;
+
+    for (size_t list_no = 0; list_no < il->nlist; ++list_no) {
+        bases.clear();
+        nbits.clear();
+        words.clear();
+        for (const auto& block : il->id_blocks[list_no]) {
+            bases.push_back(block.base);
+            nbits.push_back(block.nbits);
+            words.insert(words.end(), block.words.begin(), block.words.end());
+        }
+
+        WRITEVECTOR(il->codes[list_no]);
+        WRITEVECTOR(bases);
+        WRITEVECTOR(nbits);
+        WRITEVECTOR(words);
+        WRITEVECTOR(il->id_tails[list_no]);
+    }
+}
+
+faiss::InvertedLists* CompressedIdsInvertedListsIOHook::read(
+        faiss::IOReader* f,
+        int /*io_flags*/) const {
+    read_io_version(f);
+
+    size_t nlist, code_size, n_per_block;
+    READ1(nlist);
+    READ1(code_size);
+    READ1(n_per_block);
+
+    auto il = std::make_unique<CompressedIdsInvertedLists>(
+            nlist, code_size, n_per_block);
+
+    std::vector<faiss::idx_t> bases;
+    std::vector<int> nbits;
+    std::vector<uint64_t> words;
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        READVECTOR(il->codes[list_no]);
+        READVECTOR(bases);
+        READVECTOR(nbits);
+        READVECTOR(words);
+        READVECTOR(il->id_tails[list_no]);
+        FAISS_THROW_IF_NOT(bases.size() == nbits.size());
+
+        auto& blocks = il->id_blocks[list_no];
+        blocks.resize(bases.size());
+        size_t w = 0;
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            FAISS_THROW_IF_NOT(nbits[b] >= 0 && nbits[b] <= 64);
+            const size_t n_words = (n_per_block * nbits[b] + 63) / 64;
+            FAISS_THROW_IF_NOT(w + n_words <= words.size());
+
+            blocks[b].base = bases[b];
+            blocks[b].nbits = nbits[b];
+            blocks[b].words.assign(
+                    words.begin() + w, words.begin() + w + n_words);
+            w += n_words;
+        }
+
+        FAISS_THROW_IF_NOT_MSG(
+                w == words.size() &&
+                        il->codes[list_no].size() ==
+                                il->list_size(list_no) * code_size,
+                "inconsistent CompressedIdsInvertedLists list");
+    }
+
+    return il.release();
+}
+
+} // namespace jecq
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <faiss/MetricType.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/invlists/InvertedListsIOHook.h>
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace jecq {
+
+/** In-memory inverted lists that store the codes like ArrayInvertedLists and
+ * the ids bit-packed.
+ *
+ * The ids of a list are grouped in blocks of n_per_block entries. A full
+ * block stores its smallest id and the offsets of all its ids from it, with
+ * the number of bits of the largest offset. Ids added in increasing order,
+ * as by IndexIVF::add, are spread over the lists, so the offsets in a block
+ * need about log2(n_per_block * nlist) bits instead of 64. The ids of the
+ * last, partial block of a list stay unpacked until it fills up.
+ *
+ * get_single_id decodes one id in constant time, which lets scanners decode
+ * only the ids of the results. get_ids decodes a whole list into a buffer
+ * freed by release_ids.
+ */
+struct CompressedIdsInvertedLists : faiss::InvertedLists {
+    /// Ids of a full block, as nbits-bit offsets from base
+    struct IdBlock {
+        faiss::idx_t base = 0;
+        int nbits = 0;
+        std::vector<uint64_t> words;
+
+        faiss::idx_t get(size_t i) const {
+            if (nbits == 0) {
+                return base;
+            }
+
+            const size_t bit = i * nbits;
+            const size_t w = bit / 64;
+            const size_t shift = bit % 64;
+            uint64_t offset = words[w] >> shift;
+            if (shift + nbits > 64) {
+                offset |= words[w + 1] << (64 - shift);
+            }
+            if (nbits < 64) {
+                offset &= (uint64_t(1) << nbits) - 1;
+            }
+            return faiss::idx_t(uint64_t(base) + offset);
+        }
+    };
+
+    /// entries per block
+    size_t n_per_block;
+
+    std::vector<std::vector<uint8_t>> codes;
+    /// full blocks of ids of each list
+    std::vector<std::vector<IdBlock>> id_blocks;
+    /// ids of the last, partial block of each list
+    std::vector<std::vector<faiss::idx_t>> id_tails;
+
+    CompressedIdsInvertedLists(
+            size_t nlist,
+            size_t code_size,
+            size_t n_per_block = 256);
+
+    /// Packs n_per_block ids into a block
+    IdBlock pack_ids(const faiss::idx_t* ids) const;
+
+    /// Decodes the n_per_block ids of a block
+    void unpack_ids(const IdBlock& block, faiss::idx_t* ids) const;
+
+    /// Non-virtual get_single_id, for scan loops
+    faiss::idx_t get_id(size_t list_no, size_t offset) const {
+        assert(list_no < nlist);
+        const size_t b = offset / n_per_block;
+        const size_t i = offset % n_per_block;
+        const auto& blocks = id_blocks[list_no];
+
+        return b < blocks.size() ? blocks[b].get(i) : id_tails[list_no][i];
+    }
+
+    /// bytes used by the ids of all lists
+    size_t ids_memory() const;
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t* get_codes(size_t list_no) const override;
+
+    /// Decodes the ids of a list into a buffer freed by release_ids
+    const faiss::idx_t* get_ids(size_t list_no) const override;
+    void release_ids(size_t list_no, const faiss::idx_t* ids) const override;
+
+    faiss::idx_t get_single_id(size_t list_no, size_t offset) const override;
+
+    size_t add_entries(
+            size_t list_no,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void update_entries(
+            size_t list_no,
+            size_t offset,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void resize(size_t list_no, size_t new_size) override;
+
+   private:
+    /// Packs the full blocks at the front of the tail of a list
+    void pack_tail(size_t list_no);
+};
+
+/// Writes and reads CompressedIdsInvertedLists, tagged "ilci"
+struct CompressedIdsInvertedListsIOHook : faiss::InvertedListsIOHook {
+    CompressedIdsInvertedListsIOHook();
+
+    void write(const faiss::InvertedLists* ils, faiss::IOWriter* f)
+            const override;
+
+    faiss::InvertedLists* read(faiss::IOReader* f, int io_flags)
+            const override;
+};
+
+} // namespace jecq
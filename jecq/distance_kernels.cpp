@@ -0,0 +1,364 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "distance_kernels.h"
+#include "distance_kernels_impl.h"
+
+#include <faiss/impl/FaissAssert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+using jecq::SimdLevel;
+
+void pq_adc_distances_generic(
+        const float* table,
+        size_t M,
+        size_t n,
+        const uint8_t* codes,
+        size_t code_stride,
+        float* distances) {
+    for (size_t i = 0; i < n; ++i) {
+        distances[i] =
+                jecq::pq_adc_distance(table, M, codes + i * code_stride);
+    }
+}
+
+void pq4_accumulate_block_generic(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu) {
+    const size_t padded_M = jecq::pq4_padded_M(M);
+
+    std::fill_n(accu, jecq::pq4_block_vectors, 0);
+
+    for (size_t m = 0; m < padded_M; ++m) {
+        const uint8_t* t = qtable + m * 16;
+        const uint8_t* b = block + m * 16;
+
+        for (size_t i = 0; i < 16; ++i) {
+            accu[i] += t[b[i] & 15];
+            accu[i + 16] += t[b[i] >> 4];
+        }
+    }
+}
+
+void hamming_distances_generic(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances) {
+    for (size_t i = 0; i < n; ++i) {
+        distances[i] = jecq::hamming_distance_scalar(
+                query, codes + i * code_stride, code_size);
+    }
+}
+
+void gather_features_generic(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output) {
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = x + d * i;
+        for (size_t f = 0; f < n_features; ++f) {
+            output[f] = row[features[f]];
+        }
+        output += n_features;
+    }
+}
+
+/// Kernel implementations for one instruction set
+struct Kernels {
+    SimdLevel level;
+    decltype(&pq_adc_distances_generic) pq_adc_distances;
+    decltype(&pq4_accumulate_block_generic) pq4_accumulate_block;
+    decltype(&hamming_distances_generic) hamming_distances;
+    decltype(&gather_features_generic) gather_features;
+};
+
+const Kernels generic_kernels = {
+        SimdLevel::Generic,
+        pq_adc_distances_generic,
+        pq4_accumulate_block_generic,
+        hamming_distances_generic,
+        gather_features_generic};
+
+#ifdef JECQ_WITH_AVX2
+const Kernels avx2_kernels = {
+        SimdLevel::AVX2,
+        jecq::avx2::pq_adc_distances,
+        jecq::avx2::pq4_accumulate_block,
+        jecq::avx2::hamming_distances,
+        jecq::avx2::gather_features};
+#endif
+
+#ifdef JECQ_WITH_AVX512
+const Kernels avx512_kernels = {
+        SimdLevel::AVX512,
+        jecq::avx2::pq_adc_distances,
+        jecq::avx512::pq4_accumulate_block,
+        jecq::avx512::hamming_distances,
+        jecq::avx512::gather_features};
+#endif
+
+/// Best instruction set that is both compiled in and supported by the CPU
+SimdLevel get_supported_simd_level() {
+#ifdef JECQ_RUNTIME_DISPATCH
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vpopcntdq")) {
+        return SimdLevel::AVX512;
+    }
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+        __builtin_cpu_supports("popcnt")) {
+        return SimdLevel::AVX2;
+    }
+
+    return SimdLevel::Generic;
+#elif defined(JECQ_WITH_AVX512)
+    return SimdLevel::AVX512;
+#elif defined(JECQ_WITH_AVX2)
+    return SimdLevel::AVX2;
+#else
+    return SimdLevel::Generic;
+#endif
+}
+
+const Kernels* get_kernels_for(SimdLevel level) {
+    level = std::min(level, get_supported_simd_level());
+
+    switch (level) {
+#ifdef JECQ_WITH_AVX512
+        case SimdLevel::AVX512:
+            return &avx512_kernels;
+#endif
+#ifdef JECQ_WITH_AVX2
+        case SimdLevel::AVX2:
+            return &avx2_kernels;
+#endif
+        default:
+            return &generic_kernels;
+    }
+}
+
+/// Instruction set requested with JECQ_SIMD_LEVEL, supported one otherwise
+SimdLevel get_default_simd_level() {
+    const char* env = getenv("JECQ_SIMD_LEVEL");
+
+    if (env == nullptr) {
+        return get_supported_simd_level();
+    }
+
+    if (strcmp(env, "generic") == 0) {
+        return SimdLevel::Generic;
+    }
+    if (strcmp(env, "avx2") == 0) {
+        return SimdLevel::AVX2;
+    }
+    if (strcmp(env, "avx512") == 0) {
+        return SimdLevel::AVX512;
+    }
+
+    fprintf(stderr,
+            "WARN: ignoring unknown JECQ_SIMD_LEVEL=%s, "
+            "expected generic, avx2 or avx512\n",
+            env);
+    return get_supported_simd_level();
+}
+
+std::atomic<const Kernels*> current_kernels{nullptr};
+
+const Kernels& kernels() {
+    const Kernels* k = current_kernels.load(std::memory_order_acquire);
+
+    if (k == nullptr) {
+        const Kernels* selected = get_kernels_for(get_default_simd_level());
+        current_kernels.compare_exchange_strong(k, selected);
+        k = current_kernels.load(std::memory_order_acquire);
+    }
+
+    return *k;
+}
+
+} // namespace
+
+namespace jecq {
+
+void compute_scaled_inner_prod_table(
+        const faiss::ProductQuantizer& pq,
+        const float* x,
+        float multiplier,
+        float* table) {
+    pq.compute_inner_prod_table(x, table);
+
+    if (multiplier != 1.0f) {
+        const size_t table_size = pq.M * pq.ksub;
+        for (size_t i = 0; i < table_size; ++i) {
+            table[i] *= multiplier;
+        }
+    }
+}
+
+void pq_adc_distances(
+        const float* table,
+        size_t M,
+        size_t n,
+        const uint8_t* codes,
+        size_t code_stride,
+        float* distances) {
+    kernels().pq_adc_distances(table, M, n, codes, code_stride, distances);
+}
+
+float pq_adc_upper_bound(const float* table, size_t M, size_t ksub) {
+    float bound = 0;
+
+    for (size_t m = 0; m < M; ++m) {
+        bound += *std::max_element(table, table + ksub);
+        table += ksub;
+    }
+
+    return bound;
+}
+
+void pq4_set_code(size_t M, const uint8_t* code, size_t i, uint8_t* block) {
+    const int shift = i < 16 ? 0 : 4;
+    uint8_t* dst = block + (i & 15);
+
+    for (size_t m = 0; m < M; ++m) {
+        const uint8_t c = (code[m / 2] >> (4 * (m & 1))) & 15;
+        dst[m * 16] = (dst[m * 16] & (0xf0 >> shift)) | (c << shift);
+    }
+}
+
+void pq4_get_code(size_t M, const uint8_t* block, size_t i, uint8_t* code) {
+    const int shift = i < 16 ? 0 : 4;
+    const uint8_t* src = block + (i & 15);
+
+    std::fill_n(code, (M + 1) / 2, 0);
+
+    for (size_t m = 0; m < M; ++m) {
+        const uint8_t c = (src[m * 16] >> shift) & 15;
+        code[m / 2] |= c << (4 * (m & 1));
+    }
+}
+
+void pq4_quantize_table(
+        const float* table,
+        size_t M,
+        uint8_t* qtable,
+        float* scale,
+        float* bias) {
+    const size_t padded_M = pq4_padded_M(M);
+
+    float max_range = 0, sum_range = 0, sum_min = 0;
+    for (size_t m = 0; m < M; ++m) {
+        const auto [min_it, max_it] =
+                std::minmax_element(table + m * 16, table + m * 16 + 16);
+        max_range = std::max(max_range, *max_it - *min_it);
+        sum_range += *max_it - *min_it;
+        sum_min += *min_it;
+    }
+
+    // Each entry rounds up by at most 0.5, hence the padded_M of headroom
+    float a = max_range > 0 ? 255 / max_range : 1;
+    if (sum_range * a > 65535 - padded_M) {
+        a = (65535 - padded_M) / sum_range;
+    }
+
+    for (size_t m = 0; m < M; ++m) {
+        const float* t = table + m * 16;
+        const float t_min = *std::min_element(t, t + 16);
+
+        for (size_t c = 0; c < 16; ++c) {
+            const float q = std::floor((t[c] - t_min) * a + 0.5f);
+            qtable[m * 16 + c] = static_cast<uint8_t>(std::min(q, 255.0f));
+        }
+    }
+
+    std::fill(qtable + M * 16, qtable + padded_M * 16, 0);
+
+    *scale = 1 / a;
+    *bias = sum_min;
+}
+
+void pq4_accumulate_block(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu) {
+    kernels().pq4_accumulate_block(qtable, M, block, accu);
+}
+
+void pq4_distances_from_accu(
+        const uint16_t* accu,
+        size_t n,
+        float scale,
+        float bias,
+        float* distances) {
+    for (size_t i = 0; i < n; ++i) {
+        distances[i] = bias + accu[i] * scale;
+    }
+}
+
+void hamming_distances(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances) {
+    kernels().hamming_distances(
+            query, codes, n, code_size, code_stride, distances);
+}
+
+void gather_features(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output) {
+    kernels().gather_features(n, d, x, features, n_features, output);
+}
+
+SimdLevel get_simd_level() {
+    return kernels().level;
+}
+
+void set_simd_level(SimdLevel level) {
+    current_kernels.store(get_kernels_for(level), std::memory_order_release);
+}
+
+} // namespace jecq
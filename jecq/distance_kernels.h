@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/impl/ProductQuantizer.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace jecq {
+
+/** Instruction sets the kernels below are compiled for.
+ *
+ * The best one supported by the CPU is picked on first use, unless the
+ * JECQ_SIMD_LEVEL environment variable ("generic", "avx2" or "avx512")
+ * requests a lower one. All of them return identical results.
+ */
+enum class SimdLevel {
+    Generic,
+    /// AVX2 + FMA + POPCNT
+    AVX2,
+    /// AVX2 + AVX-512 F, BW and VPOPCNTDQ
+    AVX512,
+};
+
+/// Instruction set used by the kernels
+SimdLevel get_simd_level();
+
+/// Selects the instruction set of the kernels, capped to what the CPU
+/// supports
+void set_simd_level(SimdLevel level);
+
+/// Batch scans: number of queries that go over the database together
+constexpr size_t scan_tile_queries = 8;
+
+/// Batch scans: bytes of codes that a tile of queries scans before moving
+/// on, small enough to stay in L2 while every query of the tile reads them
+constexpr size_t scan_tile_code_bytes = 256 * 1024;
+
+/** Compute the inner-product lookup table of a query, with every entry
+ * scaled by multiplier.
+ *
+ * @param pq           trained product quantizer
+ * @param x            query vector, size pq.d
+ * @param multiplier   scale factor applied to every table entry
+ * @param table        output table, size pq.M * pq.ksub
+ */
+void compute_scaled_inner_prod_table(
+        const faiss::ProductQuantizer& pq,
+        const float* x,
+        float multiplier,
+        float* table);
+
+/// ADC distance of a single 8-bit PQ code with M sub-quantizers
+inline float pq_adc_distance(
+        const float* table,
+        size_t M,
+        const uint8_t* code) {
+    float distance = 0;
+
+    for (size_t m = 0; m < M; ++m) {
+        distance += table[code[m]];
+        table += 256;
+    }
+
+    return distance;
+}
+
+/** ADC distances of a batch of 8-bit PQ codes.
+ *
+ * Codes are scored several at a time with SIMD gathers from the table. The
+ * sub-quantizer terms of each code are accumulated in the same order as
+ * pq_adc_distance, so both give bit-identical results.
+ *
+ * @param table        lookup table, size M * 256
+ * @param M            number of sub-quantizers
+ * @param n            number of codes
+ * @param codes        first code; code i starts at codes + i * code_stride
+ * @param code_stride  distance in bytes between consecutive codes, >= M
+ * @param distances    output distances, size n
+ */
+void pq_adc_distances(
+        const float* table,
+        size_t M,
+        size_t n,
+        const uint8_t* codes,
+        size_t code_stride,
+        float* distances);
+
+/** Upper bound of the ADC distance of any code, the sum of the largest entry
+ * of each sub-quantizer table.
+ *
+ * The maxima are summed in the same order as pq_adc_distance adds the table
+ * entries, so the bound also holds for the rounded distances.
+ */
+float pq_adc_upper_bound(const float* table, size_t M, size_t ksub);
+
+/// Number of 4-bit PQ codes stored together in one block
+constexpr size_t pq4_block_vectors = 32;
+
+/// Sub-quantizers are scanned in pairs, an odd M gets a zero padding one
+inline size_t pq4_padded_M(size_t M) {
+    return (M + 1) & ~size_t(1);
+}
+
+/** Size in bytes of a block of 32 4-bit PQ codes.
+ *
+ * Sub-quantizer m of the block occupies 16 bytes: byte i holds the code of
+ * vector i in its low nibble and the code of vector i + 16 in its high
+ * nibble, so a 16-entry table lookup is a single byte shuffle.
+ */
+inline size_t pq4_block_size(size_t M) {
+    return pq4_padded_M(M) * 16;
+}
+
+/** Store the code of vector i of a block.
+ *
+ * @param M      number of sub-quantizers
+ * @param code   faiss 4-bit PQ code, size (M + 1) / 2
+ * @param i      position of the vector in the block, < 32
+ * @param block  block of size pq4_block_size(M)
+ */
+void pq4_set_code(size_t M, const uint8_t* code, size_t i, uint8_t* block);
+
+/// Inverse of pq4_set_code
+void pq4_get_code(size_t M, const uint8_t* block, size_t i, uint8_t* code);
+
+/** Quantize a 4-bit PQ lookup table to bytes.
+ *
+ * Entries are shifted per sub-quantizer and scaled so that the sum over all
+ * sub-quantizers fits in 16 bits. A distance is then approximated by
+ * bias + accu * scale, with accu the sum of the quantized entries.
+ *
+ * @param table    lookup table, size M * 16
+ * @param M        number of sub-quantizers
+ * @param qtable   output table, size pq4_padded_M(M) * 16
+ * @param scale    output scale
+ * @param bias     output bias
+ */
+void pq4_quantize_table(
+        const float* table,
+        size_t M,
+        uint8_t* qtable,
+        float* scale,
+        float* bias);
+
+/** Sum the quantized table entries of the 32 codes of a block.
+ *
+ * @param qtable   quantized table, size pq4_padded_M(M) * 16
+ * @param M        number of sub-quantizers
+ * @param block    block of size pq4_block_size(M)
+ * @param accu     output sums, size 32
+ */
+void pq4_accumulate_block(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu);
+
+/// Convert sums of quantized table entries to distances
+void pq4_distances_from_accu(
+        const uint16_t* accu,
+        size_t n,
+        float scale,
+        float bias,
+        float* distances);
+
+/** Hamming distances between a query code and a batch of codes.
+ *
+ * Short codes are compared several at a time, one 64-bit word each. Longer
+ * codes use vectorized popcounts: VPOPCNTDQ with AVX512, Harley-Seal
+ * carry-save adders with AVX2.
+ *
+ * @param query        query code, size code_size
+ * @param codes        first code; code i starts at codes + i * code_stride
+ * @param n            number of codes
+ * @param code_size    size of a code in bytes
+ * @param code_stride  distance in bytes between consecutive codes
+ * @param distances    output distances, size n
+ */
+void hamming_distances(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances);
+
+/** Gather a subset of the features of a batch of vectors.
+ *
+ * @param n            number of vectors
+ * @param d            dimensionality of the input vectors
+ * @param x            input vectors, size n * d
+ * @param features     indices of the features to keep, each < d
+ * @param n_features   number of features to keep
+ * @param output       output vectors, size n * n_features
+ */
+void gather_features(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output);
+
+} // namespace jecq
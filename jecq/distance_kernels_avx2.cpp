@@ -0,0 +1,347 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "distance_kernels.h"
+#include "distance_kernels_impl.h"
+
+#ifdef JECQ_WITH_AVX2
+
+#include <immintrin.h>
+
+namespace {
+
+/// Scores 8 codes at once, one gather from the table per sub-quantizer
+JECQ_TARGET_AVX2 inline __m256 pq_adc_distances_8(
+        const float* table,
+        size_t M,
+        const uint8_t* codes,
+        size_t code_stride) {
+    const __m256i code_offsets = _mm256_mullo_epi32(
+            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+            _mm256_set1_epi32(static_cast<int>(code_stride)));
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+
+    __m256 accu = _mm256_setzero_ps();
+    size_t m = 0;
+
+    // Load 4 code bytes per vector with a single 32-bit gather, then peel
+    // them into table indices.
+    for (; m + 4 <= M; m += 4) {
+        const __m256i words = _mm256_i32gather_epi32(
+                reinterpret_cast<const int*>(codes + m), code_offsets, 1);
+
+        for (int s = 0; s < 4; ++s) {
+            const __m256i idx = _mm256_and_si256(
+                    _mm256_srli_epi32(words, 8 * s), byte_mask);
+            accu = _mm256_add_ps(
+                    accu, _mm256_i32gather_ps(table, idx, sizeof(float)));
+            table += 256;
+        }
+    }
+
+    for (; m < M; ++m) {
+        const __m256i idx = _mm256_setr_epi32(
+                codes[m],
+                codes[code_stride + m],
+                codes[2 * code_stride + m],
+                codes[3 * code_stride + m],
+                codes[4 * code_stride + m],
+                codes[5 * code_stride + m],
+                codes[6 * code_stride + m],
+                codes[7 * code_stride + m]);
+        accu = _mm256_add_ps(
+                accu, _mm256_i32gather_ps(table, idx, sizeof(float)));
+        table += 256;
+    }
+
+    return accu;
+}
+
+/// Splits the 16-bit sums of a pair of sub-quantizers into the two lanes
+JECQ_TARGET_AVX2 inline void pq4_store_accu(
+        __m256i even,
+        __m256i odd,
+        uint16_t* accu) {
+    const __m128i even_sum = _mm_add_epi16(
+            _mm256_castsi256_si128(even), _mm256_extracti128_si256(even, 1));
+    const __m128i odd_sum = _mm_add_epi16(
+            _mm256_castsi256_si128(odd), _mm256_extracti128_si256(odd, 1));
+
+    _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(accu),
+            _mm_unpacklo_epi16(even_sum, odd_sum));
+    _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(accu + 8),
+            _mm_unpackhi_epi16(even_sum, odd_sum));
+}
+
+/// Per 64-bit lane popcount with a nibble lookup table
+JECQ_TARGET_AVX2 inline __m256i popcount_epi64(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+    const __m256i lo = _mm256_and_si256(v, low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    const __m256i counts = _mm256_add_epi8(
+            _mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+JECQ_TARGET_AVX2 inline __m256i load_xor(const uint8_t* a, const uint8_t* b) {
+    return _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+}
+
+/// Carry-save adder: h:l = a + b + c
+JECQ_TARGET_AVX2 inline void csa(
+        __m256i& h,
+        __m256i& l,
+        __m256i a,
+        __m256i b,
+        __m256i c) {
+    const __m256i u = _mm256_xor_si256(a, b);
+    h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    l = _mm256_xor_si256(u, c);
+}
+
+/** Hamming distance of two codes of at least 32 bytes.
+ *
+ * Groups of 16 vectors go through a Harley-Seal carry-save adder tree, so
+ * that only one popcount is needed per group.
+ */
+JECQ_TARGET_AVX2 int hamming_distance_avx2(
+        const uint8_t* a,
+        const uint8_t* b,
+        size_t code_size) {
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+
+    if (code_size >= 16 * 32) {
+        __m256i ones = _mm256_setzero_si256();
+        __m256i twos = _mm256_setzero_si256();
+        __m256i fours = _mm256_setzero_si256();
+        __m256i eights = _mm256_setzero_si256();
+        __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+        for (; i + 16 * 32 <= code_size; i += 16 * 32) {
+            __m256i v[16];
+            for (int t = 0; t < 16; ++t) {
+                v[t] = load_xor(a + i + 32 * t, b + i + 32 * t);
+            }
+
+            csa(twos_a, ones, ones, v[0], v[1]);
+            csa(twos_b, ones, ones, v[2], v[3]);
+            csa(fours_a, twos, twos, twos_a, twos_b);
+            csa(twos_a, ones, ones, v[4], v[5]);
+            csa(twos_b, ones, ones, v[6], v[7]);
+            csa(fours_b, twos, twos, twos_a, twos_b);
+            csa(eights_a, fours, fours, fours_a, fours_b);
+            csa(twos_a, ones, ones, v[8], v[9]);
+            csa(twos_b, ones, ones, v[10], v[11]);
+            csa(fours_a, twos, twos, twos_a, twos_b);
+            csa(twos_a, ones, ones, v[12], v[13]);
+            csa(twos_b, ones, ones, v[14], v[15]);
+            csa(fours_b, twos, twos, twos_a, twos_b);
+            csa(eights_b, fours, fours, fours_a, fours_b);
+            csa(sixteens, eights, eights, eights_a, eights_b);
+
+            total = _mm256_add_epi64(total, popcount_epi64(sixteens));
+        }
+
+        total = _mm256_slli_epi64(total, 4);
+        total = _mm256_add_epi64(
+                total, _mm256_slli_epi64(popcount_epi64(eights), 3));
+        total = _mm256_add_epi64(
+                total, _mm256_slli_epi64(popcount_epi64(fours), 2));
+        total = _mm256_add_epi64(
+                total, _mm256_slli_epi64(popcount_epi64(twos), 1));
+        total = _mm256_add_epi64(total, popcount_epi64(ones));
+    }
+
+    for (; i + 32 <= code_size; i += 32) {
+        total = _mm256_add_epi64(total, popcount_epi64(load_xor(a + i, b + i)));
+    }
+
+    const __m128i sum = _mm_add_epi64(
+            _mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    const int distance = static_cast<int>(
+            _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+
+    return distance +
+            jecq::hamming_distance_scalar(a + i, b + i, code_size - i);
+}
+
+} // namespace
+
+namespace jecq {
+namespace avx2 {
+
+JECQ_TARGET_AVX2 void pq_adc_distances(
+        const float* table,
+        size_t M,
+        size_t n,
+        const uint8_t* codes,
+        size_t code_stride,
+        float* distances) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(
+                distances + i,
+                pq_adc_distances_8(
+                        table, M, codes + i * code_stride, code_stride));
+    }
+
+    for (; i < n; ++i) {
+        distances[i] = pq_adc_distance(table, M, codes + i * code_stride);
+    }
+}
+
+JECQ_TARGET_AVX2 void pq4_accumulate_block(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu) {
+    const size_t padded_M = pq4_padded_M(M);
+
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    const __m256i low_byte_mask = _mm256_set1_epi16(0x00ff);
+
+    // Vectors 0..15 and 16..31, split by even and odd vector index
+    __m256i accu_lo_even = _mm256_setzero_si256();
+    __m256i accu_lo_odd = _mm256_setzero_si256();
+    __m256i accu_hi_even = _mm256_setzero_si256();
+    __m256i accu_hi_odd = _mm256_setzero_si256();
+
+    // One register holds a pair of sub-quantizers, one per 128-bit lane
+    for (size_t m = 0; m < padded_M; m += 2) {
+        const __m256i codes = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(block + m * 16));
+        const __m256i lut = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(qtable + m * 16));
+
+        const __m256i lo = _mm256_shuffle_epi8(
+                lut, _mm256_and_si256(codes, nibble_mask));
+        const __m256i hi = _mm256_shuffle_epi8(
+                lut,
+                _mm256_and_si256(_mm256_srli_epi16(codes, 4), nibble_mask));
+
+        accu_lo_even = _mm256_add_epi16(
+                accu_lo_even, _mm256_and_si256(lo, low_byte_mask));
+        accu_lo_odd = _mm256_add_epi16(accu_lo_odd, _mm256_srli_epi16(lo, 8));
+        accu_hi_even = _mm256_add_epi16(
+                accu_hi_even, _mm256_and_si256(hi, low_byte_mask));
+        accu_hi_odd = _mm256_add_epi16(accu_hi_odd, _mm256_srli_epi16(hi, 8));
+    }
+
+    pq4_store_accu(accu_lo_even, accu_lo_odd, accu);
+    pq4_store_accu(accu_hi_even, accu_hi_odd, accu + 16);
+}
+
+JECQ_TARGET_AVX2 void hamming_distances(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances) {
+    size_t i = 0;
+
+    if (code_size <= 8) {
+        const uint64_t q = load_word(query, code_size);
+
+        // Full 64-bit loads, masked down to the code. They read past the
+        // code, so they stop 8 bytes before the end of the last one.
+        const size_t end = n == 0 ? 0 : (n - 1) * code_stride + code_size;
+        const uint64_t word_mask = code_size == 8
+                ? ~uint64_t(0)
+                : (uint64_t(1) << (8 * code_size)) - 1;
+
+        const __m256i qv = _mm256_set1_epi64x(q);
+        const __m256i mask = _mm256_set1_epi64x(word_mask);
+        const __m256i offsets = _mm256_setr_epi64x(
+                0, code_stride, 2 * code_stride, 3 * code_stride);
+
+        for (; (i + 3) * code_stride + 8 <= end; i += 4) {
+            const __m256i words = _mm256_i64gather_epi64(
+                    reinterpret_cast<const long long*>(
+                            codes + i * code_stride),
+                    offsets,
+                    1);
+            const __m256i x =
+                    _mm256_and_si256(_mm256_xor_si256(words, qv), mask);
+
+            alignas(32) int64_t counts[4];
+            _mm256_store_si256(
+                    reinterpret_cast<__m256i*>(counts), popcount_epi64(x));
+            for (int l = 0; l < 4; ++l) {
+                distances[i + l] = static_cast<int>(counts[l]);
+            }
+        }
+
+        for (; i < n; ++i) {
+            distances[i] = __builtin_popcountll(
+                    q ^ load_word(codes + i * code_stride, code_size));
+        }
+
+        return;
+    }
+
+    for (; i < n; ++i) {
+        const uint8_t* code = codes + i * code_stride;
+        distances[i] = code_size >= 32
+                ? hamming_distance_avx2(query, code, code_size)
+                : hamming_distance_scalar(query, code, code_size);
+    }
+}
+
+JECQ_TARGET_AVX2 void gather_features(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output) {
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = x + d * i;
+        size_t f = 0;
+
+        for (; f + 4 <= n_features; f += 4) {
+            const __m256i idx = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(features + f));
+            _mm_storeu_ps(output + f, _mm256_i64gather_ps(row, idx, 4));
+        }
+
+        for (; f < n_features; ++f) {
+            output[f] = row[features[f]];
+        }
+
+        output += n_features;
+    }
+}
+
+} // namespace avx2
+} // namespace jecq
+
+#endif
@@ -0,0 +1,213 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "distance_kernels.h"
+#include "distance_kernels_impl.h"
+
+#ifdef JECQ_WITH_AVX512
+
+#include <immintrin.h>
+
+#include <algorithm>
+
+namespace {
+
+/// Hamming distance of two codes, 64 bytes at a time with masked loads
+JECQ_TARGET_AVX512 inline int hamming_distance_avx512(
+        const uint8_t* a,
+        const uint8_t* b,
+        size_t code_size) {
+    __m512i accu = _mm512_setzero_si512();
+
+    for (size_t i = 0; i < code_size; i += 64) {
+        const size_t len = std::min<size_t>(64, code_size - i);
+        const __mmask64 mask = len == 64 ? ~__mmask64(0)
+                                         : (__mmask64(1) << len) - 1;
+
+        const __m512i x = _mm512_xor_si512(
+                _mm512_maskz_loadu_epi8(mask, a + i),
+                _mm512_maskz_loadu_epi8(mask, b + i));
+        accu = _mm512_add_epi64(accu, _mm512_popcnt_epi64(x));
+    }
+
+    return static_cast<int>(_mm512_reduce_add_epi64(accu));
+}
+
+/// Sum of the four 128-bit lanes, as 16-bit integers
+JECQ_TARGET_AVX512 inline __m128i sum_lanes_epi16(__m512i v) {
+    const __m256i sum = _mm256_add_epi16(
+            _mm512_castsi512_si256(v), _mm512_extracti64x4_epi64(v, 1));
+    return _mm_add_epi16(
+            _mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+}
+
+/// Splits the 16-bit sums of the sub-quantizers into the two lanes, as
+/// avx2::pq4_accumulate_block does
+JECQ_TARGET_AVX512 inline void pq4_store_accu(
+        __m512i even,
+        __m512i odd,
+        uint16_t* accu) {
+    const __m128i even_sum = sum_lanes_epi16(even);
+    const __m128i odd_sum = sum_lanes_epi16(odd);
+
+    _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(accu),
+            _mm_unpacklo_epi16(even_sum, odd_sum));
+    _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(accu + 8),
+            _mm_unpackhi_epi16(even_sum, odd_sum));
+}
+
+} // namespace
+
+namespace jecq {
+namespace avx512 {
+
+JECQ_TARGET_AVX512 void hamming_distances(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances) {
+    size_t i = 0;
+
+    if (code_size <= 8) {
+        const uint64_t q = load_word(query, code_size);
+
+        // Full 64-bit loads, masked down to the code. They read past the
+        // code, so they stop 8 bytes before the end of the last one.
+        const size_t end = n == 0 ? 0 : (n - 1) * code_stride + code_size;
+        const uint64_t word_mask = code_size == 8
+                ? ~uint64_t(0)
+                : (uint64_t(1) << (8 * code_size)) - 1;
+
+        const __m512i qv = _mm512_set1_epi64(q);
+        const __m512i mask = _mm512_set1_epi64(word_mask);
+        const int64_t s = code_stride;
+        const __m512i offsets = _mm512_setr_epi64(
+                0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+
+        for (; (i + 7) * code_stride + 8 <= end; i += 8) {
+            const __m512i words = _mm512_i64gather_epi64(
+                    offsets, codes + i * code_stride, 1);
+            const __m512i counts = _mm512_popcnt_epi64(
+                    _mm512_and_si512(_mm512_xor_si512(words, qv), mask));
+            _mm256_storeu_si256(
+                    reinterpret_cast<__m256i*>(distances + i),
+                    _mm512_cvtepi64_epi32(counts));
+        }
+
+        for (; i < n; ++i) {
+            distances[i] = __builtin_popcountll(
+                    q ^ load_word(codes + i * code_stride, code_size));
+        }
+
+        return;
+    }
+
+    for (; i < n; ++i) {
+        distances[i] = hamming_distance_avx512(
+                query, codes + i * code_stride, code_size);
+    }
+}
+
+JECQ_TARGET_AVX512 void pq4_accumulate_block(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu) {
+    const size_t padded_M = pq4_padded_M(M);
+
+    const __m512i nibble_mask = _mm512_set1_epi8(0x0f);
+    const __m512i low_byte_mask = _mm512_set1_epi16(0x00ff);
+
+    // Vectors 0..15 and 16..31, split by even and odd vector index
+    __m512i accu_lo_even = _mm512_setzero_si512();
+    __m512i accu_lo_odd = _mm512_setzero_si512();
+    __m512i accu_hi_even = _mm512_setzero_si512();
+    __m512i accu_hi_odd = _mm512_setzero_si512();
+
+    // One register holds four sub-quantizers, one per 128-bit lane. A last
+    // pair fills the lower half, the zero upper half adds nothing.
+    for (size_t m = 0; m < padded_M; m += 4) {
+        __m512i codes, lut;
+        if (m + 4 <= padded_M) {
+            codes = _mm512_loadu_si512(block + m * 16);
+            lut = _mm512_loadu_si512(qtable + m * 16);
+        } else {
+            codes = _mm512_inserti64x4(
+                    _mm512_setzero_si512(),
+                    _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(block + m * 16)),
+                    0);
+            lut = _mm512_inserti64x4(
+                    _mm512_setzero_si512(),
+                    _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(qtable + m * 16)),
+                    0);
+        }
+
+        const __m512i lo = _mm512_shuffle_epi8(
+                lut, _mm512_and_si512(codes, nibble_mask));
+        const __m512i hi = _mm512_shuffle_epi8(
+                lut,
+                _mm512_and_si512(_mm512_srli_epi16(codes, 4), nibble_mask));
+
+        accu_lo_even = _mm512_add_epi16(
+                accu_lo_even, _mm512_and_si512(lo, low_byte_mask));
+        accu_lo_odd = _mm512_add_epi16(accu_lo_odd, _mm512_srli_epi16(lo, 8));
+        accu_hi_even = _mm512_add_epi16(
+                accu_hi_even, _mm512_and_si512(hi, low_byte_mask));
+        accu_hi_odd = _mm512_add_epi16(accu_hi_odd, _mm512_srli_epi16(hi, 8));
+    }
+
+    pq4_store_accu(accu_lo_even, accu_lo_odd, accu);
+    pq4_store_accu(accu_hi_even, accu_hi_odd, accu + 16);
+}
+
+JECQ_TARGET_AVX512 void gather_features(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output) {
+    for (size_t i = 0; i < n; ++i) {
+        const float* row = x + d * i;
+        size_t f = 0;
+
+        for (; f + 8 <= n_features; f += 8) {
+            const __m512i idx = _mm512_loadu_si512(features + f);
+            _mm256_storeu_ps(output + f, _mm512_i64gather_ps(idx, row, 4));
+        }
+
+        for (; f < n_features; ++f) {
+            output[f] = row[features[f]];
+        }
+
+        output += n_features;
+    }
+}
+
+} // namespace avx512
+} // namespace jecq
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+// Per instruction set implementations of the kernels of distance_kernels.h,
+// selected at runtime. Not part of the public API.
+
+#include <faiss/impl/platform_macros.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+// Every variant is compiled, each function for its own instruction set
+#define JECQ_RUNTIME_DISPATCH
+#define JECQ_TARGET(isa) __attribute__((target(isa)))
+#define JECQ_WITH_AVX2
+#define JECQ_WITH_AVX512
+#else
+// Only the variants enabled by the compiler flags
+#define JECQ_TARGET(isa)
+#ifdef __AVX2__
+#define JECQ_WITH_AVX2
+#endif
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512BW__)
+#define JECQ_WITH_AVX512
+#endif
+#endif
+
+#define JECQ_TARGET_AVX2 JECQ_TARGET("avx2,fma,popcnt")
+#define JECQ_TARGET_AVX512 \
+    JECQ_TARGET("avx2,fma,popcnt,avx512f,avx512bw,avx512vpopcntdq")
+
+namespace jecq {
+
+inline uint64_t load_word(const uint8_t* p, size_t size) {
+    uint64_t word = 0;
+    memcpy(&word, p, size);
+    return word;
+}
+
+/// Hamming distance of two codes, one 64-bit popcount at a time
+inline int hamming_distance_scalar(
+        const uint8_t* a,
+        const uint8_t* b,
+        size_t code_size) {
+    int distance = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= code_size; i += 8) {
+        distance += __builtin_popcountll(
+                load_word(a + i, 8) ^ load_word(b + i, 8));
+    }
+
+    if (i < code_size) {
+        const size_t tail = code_size - i;
+        distance += __builtin_popcountll(
+                load_word(a + i, tail) ^ load_word(b + i, tail));
+    }
+
+    return distance;
+}
+
+#ifdef JECQ_WITH_AVX2
+namespace avx2 {
+
+void pq_adc_distances(
+        const float* table,
+        size_t M,
+        size_t n,
+        const uint8_t* codes,
+        size_t code_stride,
+        float* distances);
+
+void pq4_accumulate_block(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu);
+
+void hamming_distances(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances);
+
+void gather_features(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output);
+
+} // namespace avx2
+#endif
+
+#ifdef JECQ_WITH_AVX512
+namespace avx512 {
+
+void pq4_accumulate_block(
+        const uint8_t* qtable,
+        size_t M,
+        const uint8_t* block,
+        uint16_t* accu);
+
+void hamming_distances(
+        const uint8_t* query,
+        const uint8_t* codes,
+        size_t n,
+        size_t code_size,
+        size_t code_stride,
+        int* distances);
+
+void gather_features(
+        size_t n,
+        size_t d,
+        const float* x,
+        const int64_t* features,
+        size_t n_features,
+        float* output);
+
+} // namespace avx512
+#endif
+
+} // namespace jecq
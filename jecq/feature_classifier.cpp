@@ -19,6 +19,7 @@
 // SOFTWARE.
 
 #include "feature_classifier.h"
+#include "distance_kernels.h"
 
 #include <faiss/VectorTransform.h>
 
@@ -90,23 +91,37 @@ void filter_by_features(
         const float* x,
         const std::vector<faiss::idx_t>& features,
         float* output) {
+    gather_features(n, d, x, features.data(), features.size(), output);
+}
+
+void filter_by_features(
+        const float* x,
+        const std::vector<faiss::idx_t>& features,
+        float* output) {
+    gather_features(1, 0, x, features.data(), features.size(), output);
+}
+
+void scatter_by_features(
+        faiss::idx_t n,
+        faiss::idx_t d,
+        const float* x,
+        const std::vector<faiss::idx_t>& features,
+        float* output) {
+    const size_t nf = features.size();
     for (faiss::idx_t i = 0; i < n; ++i) {
-        const float* row = x + d * i;
-        for (const auto feature : features) {
-            *output = row[feature];
-            ++output;
+        const float* xi = x + i * nf;
+        float* oi = output + i * d;
+        for (size_t f = 0; f < nf; ++f) {
+            oi[features[f]] = xi[f];
         }
     }
 }
 
-void filter_by_features(
+void scatter_by_features(
         const float* x,
         const std::vector<faiss::idx_t>& features,
         float* output) {
-    for (const auto feature : features) {
-        *output = x[feature];
-        ++output;
-    }
+    scatter_by_features(1, 0, x, features, output);
 }
 
 } // namespace jecq
@@ -54,4 +54,19 @@ void filter_by_features(
         const float* x,
         const std::vector<faiss::idx_t>& features,
         float* output);
+
+/// Inverse of filter_by_features: writes component i of each of the n rows
+/// of x, of size n * features.size(), to component features[i] of the row of
+/// output, of size n * d. The other components of output are left unchanged.
+void scatter_by_features(
+        faiss::idx_t n,
+        faiss::idx_t d,
+        const float* x,
+        const std::vector<faiss::idx_t>& features,
+        float* output);
+
+void scatter_by_features(
+        const float* x,
+        const std::vector<faiss::idx_t>& features,
+        float* output);
 } // namespace jecq
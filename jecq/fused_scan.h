@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+// Block scan of PQ + ITQ codes shared by IndexJecq and the IndexIVFJecq
+// scanner. Not part of the public API.
+
+#include "distance_kernels.h"
+#include "id_selection.h"
+#include "itq_quantizer.h"
+
+#include <faiss/MetricType.h>
+#include <faiss/impl/ProductQuantizer.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace jecq {
+
+/// Codes and query tables needed to score vectors against a single query
+struct QueryScan {
+    /// PQ code of vector j at pq_codes + j * pq_stride
+    const uint8_t* pq_codes;
+    size_t pq_stride;
+    /// 0 without high variance features
+    size_t pq_code_size;
+    const faiss::ProductQuantizer& pq;
+    /// scaled lookup table, see compute_scaled_inner_prod_table
+    const float* pq_table;
+    /// largest PQ term of any code, only read by pruning handlers
+    float pq_upper;
+    /// added to every score, the query-centroid term of a residual list
+    float bias;
+
+    /// ITQ code of vector j at itq_codes + j * itq_stride
+    const uint8_t* itq_codes;
+    size_t itq_stride;
+    /// 0 without mid variance features
+    size_t itq_code_size;
+    const ITQQuantizer& itq;
+    const uint8_t* itq_query_code;
+
+    /// vectors to score, nullptr for all of them
+    const IDSelection* selection;
+    /// ids tested against the selection, nullptr to test positions
+    const faiss::idx_t* ids;
+
+    bool is_selected(faiss::idx_t j) const {
+        return !selection || selection->is_member(ids ? ids[j] : j);
+    }
+};
+
+/** Scores vectors [j_begin, j_end) against a single query and passes them to
+ * the handler in increasing position order, so no distance array of the
+ * whole range is materialized.
+ *
+ * The handler provides add(distance, j), called for every scored vector, and
+ * threshold(), below which a score is never kept. With Handler::prunes set,
+ * the threshold is used to skip vectors that cannot reach it.
+ *
+ * Vectors are processed in blocks of candidates. Vectors rejected by the
+ * selection never reach the handler. When most of a block is selected, its
+ * PQ and ITQ terms are computed with the ADC and Hamming kernels over the
+ * whole block, rejected vectors included; otherwise only the candidates are
+ * scored, one by one, and the codes of the others are not read.
+ *
+ * With a pruning handler and both tiers present, the ITQ terms are computed
+ * first: a vector whose ITQ term plus the largest possible PQ term does not
+ * exceed the threshold is dropped before its PQ code is read.
+ */
+template <bool with_pq, bool with_itq, class Handler>
+void scan_fused(
+        faiss::idx_t j_begin,
+        faiss::idx_t j_end,
+        const QueryScan& scan,
+        Handler& handler) {
+    constexpr faiss::idx_t block_size = 256;
+    float block_pq[block_size];
+    float block_itq[block_size] = {};
+    int block_hammings[block_size];
+    faiss::idx_t candidates[block_size];
+
+    for (faiss::idx_t j0 = j_begin; j0 < j_end; j0 += block_size) {
+        const faiss::idx_t bs = std::min(block_size, j_end - j0);
+
+        faiss::idx_t n_candidates = 0;
+        for (faiss::idx_t t = 0; t < bs; ++t) {
+            if (scan.is_selected(j0 + t)) {
+                candidates[n_candidates++] = t;
+            }
+        }
+
+        if (with_itq) {
+            if (2 * n_candidates > bs) {
+                hamming_distances(
+                        scan.itq_query_code,
+                        scan.itq_codes + j0 * scan.itq_stride,
+                        bs,
+                        scan.itq_code_size,
+                        scan.itq_stride,
+                        block_hammings);
+            } else {
+                for (faiss::idx_t c = 0; c < n_candidates; ++c) {
+                    const faiss::idx_t t = candidates[c];
+                    hamming_distances(
+                            scan.itq_query_code,
+                            scan.itq_codes + (j0 + t) * scan.itq_stride,
+                            1,
+                            scan.itq_code_size,
+                            scan.itq_stride,
+                            block_hammings + t);
+                }
+            }
+
+            for (faiss::idx_t c = 0; c < n_candidates; ++c) {
+                const faiss::idx_t t = candidates[c];
+                block_itq[t] =
+                        scan.itq.get_inner_product_distance(block_hammings[t]);
+            }
+        }
+
+        if (Handler::prunes && with_pq && with_itq) {
+            const float threshold = handler.threshold();
+            faiss::idx_t n_kept = 0;
+
+            for (faiss::idx_t c = 0; c < n_candidates; ++c) {
+                const faiss::idx_t t = candidates[c];
+                if ((scan.pq_upper + block_itq[t]) + scan.bias > threshold) {
+                    candidates[n_kept++] = t;
+                }
+            }
+
+            n_candidates = n_kept;
+        }
+
+        if (with_pq) {
+            if (2 * n_candidates > bs) {
+                pq_adc_distances(
+                        scan.pq_table,
+                        scan.pq.M,
+                        bs,
+                        scan.pq_codes + j0 * scan.pq_stride,
+                        scan.pq_stride,
+                        block_pq);
+            } else {
+                for (faiss::idx_t c = 0; c < n_candidates; ++c) {
+                    const faiss::idx_t t = candidates[c];
+                    block_pq[t] = pq_adc_distance(
+                            scan.pq_table,
+                            scan.pq.M,
+                            scan.pq_codes + (j0 + t) * scan.pq_stride);
+                }
+            }
+        }
+
+        for (faiss::idx_t c = 0; c < n_candidates; ++c) {
+            const faiss::idx_t t = candidates[c];
+            float distance = with_pq ? block_pq[t] : 0.0f;
+
+            if (with_itq) {
+                distance += block_itq[t];
+            }
+
+            handler.add(distance + scan.bias, j0 + t);
+        }
+    }
+}
+
+/// Runs the scan_fused instance of the tiers present in scan
+template <class Handler>
+void scan_tiers(
+        faiss::idx_t j_begin,
+        faiss::idx_t j_end,
+        const QueryScan& scan,
+        Handler& handler) {
+    const bool with_pq = scan.pq_code_size > 0;
+    const bool with_itq = scan.itq_code_size > 0;
+
+    if (with_pq && with_itq) {
+        scan_fused<true, true>(j_begin, j_end, scan, handler);
+    } else if (with_pq) {
+        scan_fused<true, false>(j_begin, j_end, scan, handler);
+    } else if (with_itq) {
+        scan_fused<false, true>(j_begin, j_end, scan, handler);
+    } else {
+        scan_fused<false, false>(j_begin, j_end, scan, handler);
+    }
+}
+
+} // namespace jecq
@@ -0,0 +1,60 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "id_selection.h"
+
+#include <algorithm>
+
+namespace jecq {
+
+IDSelection::IDSelection(const faiss::IDSelector* sel) : sel(sel) {
+    if (const auto* bitmap_sel =
+                dynamic_cast<const faiss::IDSelectorBitmap*>(sel)) {
+        bitmap = bitmap_sel->bitmap;
+        bitmap_size = bitmap_sel->n;
+    }
+}
+
+void IDSelection::materialize(faiss::idx_t n) {
+    if (sel == nullptr || bitmap != nullptr) {
+        return;
+    }
+
+    const faiss::idx_t nbytes = (n + 7) / 8;
+    owned_bitmap.assign(nbytes, 0);
+
+#pragma omp parallel for if (n > 65536)
+    for (faiss::idx_t b = 0; b < nbytes; ++b) {
+        uint8_t byte = 0;
+
+        for (faiss::idx_t id = 8 * b; id < std::min(8 * b + 8, n); ++id) {
+            if (sel->is_member(id)) {
+                byte |= 1 << (id & 7);
+            }
+        }
+
+        owned_bitmap[b] = byte;
+    }
+
+    bitmap = owned_bitmap.data();
+    bitmap_size = owned_bitmap.size();
+}
+
+} // namespace jecq
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/MetricType.h>
+#include <faiss/impl/IDSelector.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace jecq {
+
+/** Membership test of an IDSelector, evaluated inside scan loops.
+ *
+ * The bits of an IDSelectorBitmap are read directly instead of through a
+ * virtual call; other selectors can be evaluated once into a bitmap with
+ * materialize. Without a selector every id is a member.
+ */
+class IDSelection {
+   private:
+    const faiss::IDSelector* sel = nullptr;
+    const uint8_t* bitmap = nullptr;
+    /// bytes of bitmap
+    size_t bitmap_size = 0;
+    std::vector<uint8_t> owned_bitmap;
+
+   public:
+    explicit IDSelection(const faiss::IDSelector* sel = nullptr);
+
+    IDSelection(const IDSelection&) = delete;
+    IDSelection& operator=(const IDSelection&) = delete;
+
+    /// Evaluates the selector for ids [0, n) into a bitmap, so that
+    /// is_member is a bit lookup for them
+    void materialize(faiss::idx_t n);
+
+    bool selects_all() const {
+        return sel == nullptr;
+    }
+
+    bool is_member(faiss::idx_t id) const {
+        if (bitmap) {
+            return size_t(id >> 3) < bitmap_size &&
+                    ((bitmap[id >> 3] >> (id & 7)) & 1);
+        }
+
+        return sel == nullptr || sel->is_member(id);
+    }
+};
+
+} // namespace jecq
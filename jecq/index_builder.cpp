@@ -0,0 +1,306 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "index_builder.h"
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <utility>
+
+namespace jecq {
+
+namespace {
+
+bool has_extension(const std::string& fname, const char* extension) {
+    const size_t len = strlen(extension);
+    return fname.size() >= len &&
+            fname.compare(fname.size() - len, len, extension) == 0;
+}
+
+/// Closes the file if the constructor of a source throws; the source takes
+/// it over with release() once it is fully constructed
+using FileGuard = std::unique_ptr<FILE, int (*)(FILE*)>;
+
+FileGuard open_file(const char* fname) {
+    FILE* f = fopen(fname, "rb");
+    FAISS_THROW_IF_NOT_FMT(
+            f, "could not open %s for reading: %s", fname, strerror(errno));
+    return FileGuard(f, fclose);
+}
+
+} // namespace
+
+VecsFileSource::VecsFileSource(const char* fname) {
+    const std::string name(fname);
+    FAISS_THROW_IF_NOT_FMT(
+            has_extension(name, ".fvecs") || has_extension(name, ".bvecs"),
+            "%s is neither a .fvecs nor a .bvecs file",
+            fname);
+    bytes = has_extension(name, ".bvecs");
+
+    FileGuard file = open_file(fname);
+    f = file.get();
+    int32_t dim = 0;
+    if (fread(&dim, sizeof(dim), 1, f) == 1) {
+        FAISS_THROW_IF_NOT_FMT(dim > 0, "invalid dimension %d", int(dim));
+        d = dim;
+    }
+    row.resize(bytes ? d : 0);
+    rewind();
+    file.release();
+}
+
+VecsFileSource::~VecsFileSource() {
+    fclose(f);
+}
+
+size_t VecsFileSource::read(size_t n, float* x) {
+    size_t i = 0;
+    for (; i < n; ++i) {
+        int32_t dim;
+        if (fread(&dim, sizeof(dim), 1, f) != 1) {
+            break;
+        }
+        FAISS_THROW_IF_NOT_FMT(
+                size_t(dim) == d,
+                "vector of dimension %d in a file of dimension %zd",
+                int(dim),
+                d);
+
+        float* xi = x + i * d;
+        if (bytes) {
+            FAISS_THROW_IF_NOT(fread(row.data(), 1, d, f) == d);
+            for (size_t j = 0; j < d; ++j) {
+                xi[j] = row[j];
+            }
+        } else {
+            FAISS_THROW_IF_NOT(fread(xi, sizeof(float), d, f) == d);
+        }
+    }
+    return i;
+}
+
+void VecsFileSource::rewind() {
+    FAISS_THROW_IF_NOT(fseek(f, 0, SEEK_SET) == 0);
+}
+
+// The header is a Python dict literal, e.g.
+// {'descr': '<f4', 'fortran_order': False, 'shape': (1000, 128), }
+NpyFileSource::NpyFileSource(const char* fname) {
+    FileGuard file = open_file(fname);
+    f = file.get();
+
+    char magic[8];
+    FAISS_THROW_IF_NOT_FMT(
+            fread(magic, 1, 8, f) == 8 && memcmp(magic, "\x93NUMPY", 6) == 0,
+            "%s is not a .npy file",
+            fname);
+    const int major = magic[6];
+
+    uint32_t header_len = 0;
+    if (major == 1) {
+        uint16_t len16;
+        FAISS_THROW_IF_NOT(fread(&len16, sizeof(len16), 1, f) == 1);
+        header_len = len16;
+    } else {
+        FAISS_THROW_IF_NOT(fread(&header_len, sizeof(header_len), 1, f) == 1);
+    }
+
+    std::string header(header_len, '\0');
+    FAISS_THROW_IF_NOT(fread(&header[0], 1, header_len, f) == header_len);
+    data_offset = ftell(f);
+
+    // value of a key, without the spaces before it
+    auto value_of = [&](const char* key) {
+        size_t pos = header.find(key);
+        FAISS_THROW_IF_NOT_FMT(
+                pos != std::string::npos, "no %s in the .npy header", key);
+        pos = header.find_first_not_of(' ', pos + strlen(key));
+        return header.substr(std::min(pos, header.size()));
+    };
+
+    const std::string descr = value_of("'descr':");
+    if (descr.compare(0, 5, "'<f4'") == 0) {
+        bytes = false;
+    } else if (descr.compare(0, 5, "'|u1'") == 0) {
+        bytes = true;
+    } else {
+        FAISS_THROW_FMT(
+                "%s: only float32 and uint8 .npy arrays are supported", fname);
+    }
+
+    FAISS_THROW_IF_NOT_FMT(
+            value_of("'fortran_order':").compare(0, 5, "False") == 0,
+            "%s: the .npy array must be in C order",
+            fname);
+
+    const std::string shape = value_of("'shape':");
+    unsigned long long rows, cols;
+    char close = 0;
+    FAISS_THROW_IF_NOT_FMT(
+            sscanf(shape.c_str(), "(%llu, %llu%c", &rows, &cols, &close) == 3 &&
+                    close == ')',
+            "%s: the .npy array must have 2 dimensions",
+            fname);
+    ntotal = rows;
+    d = cols;
+    row.resize(bytes ? d : 0);
+    file.release();
+}
+
+NpyFileSource::~NpyFileSource() {
+    fclose(f);
+}
+
+size_t NpyFileSource::read(size_t n, float* x) {
+    n = std::min(n, ntotal - n_read);
+    if (bytes) {
+        for (size_t i = 0; i < n; ++i) {
+            FAISS_THROW_IF_NOT(fread(row.data(), 1, d, f) == d);
+            for (size_t j = 0; j < d; ++j) {
+                x[i * d + j] = row[j];
+            }
+        }
+    } else {
+        FAISS_THROW_IF_NOT(fread(x, sizeof(float), n * d, f) == n * d);
+    }
+    n_read += n;
+    return n;
+}
+
+void NpyFileSource::rewind() {
+    FAISS_THROW_IF_NOT(fseek(f, data_offset, SEEK_SET) == 0);
+    n_read = 0;
+}
+
+CallbackVectorSource::CallbackVectorSource(
+        size_t d,
+        std::function<size_t(size_t, float*)> read_callback,
+        std::function<void()> rewind_callback)
+        : read_callback(std::move(read_callback)),
+          rewind_callback(std::move(rewind_callback)) {
+    this->d = d;
+}
+
+size_t CallbackVectorSource::read(size_t n, float* x) {
+    return read_callback(n, x);
+}
+
+void CallbackVectorSource::rewind() {
+    rewind_callback();
+}
+
+std::unique_ptr<VectorSource> open_vector_file(const char* fname) {
+    if (has_extension(fname, ".npy")) {
+        return std::make_unique<NpyFileSource>(fname);
+    }
+    return std::make_unique<VecsFileSource>(fname);
+}
+
+void build_index(
+        faiss::Index* index,
+        VectorSource& source,
+        const BuildParams& params) {
+    FAISS_THROW_IF_NOT_FMT(
+            source.d == size_t(index->d),
+            "source of dimension %zd for an index of dimension %d",
+            source.d,
+            index->d);
+    FAISS_THROW_IF_NOT(params.chunk_size > 0);
+
+    const size_t d = source.d;
+    const size_t chunk_size = params.chunk_size;
+    const auto t0 = faiss::getmillisecs();
+
+    if (!index->is_trained) {
+        FAISS_THROW_IF_NOT(params.max_train_points > 0);
+
+        // reservoir sampling: after n_seen vectors, each of them is in the
+        // sample with probability max_train_points / n_seen
+        std::vector<float> sample;
+        sample.reserve(params.max_train_points * d);
+        std::vector<float> chunk(chunk_size * d);
+        faiss::RandomGenerator rng(params.seed);
+        size_t n_seen = 0;
+
+        source.rewind();
+        while (size_t n = source.read(chunk_size, chunk.data())) {
+            for (size_t i = 0; i < n; ++i, ++n_seen) {
+                const float* xi = chunk.data() + i * d;
+                if (n_seen < params.max_train_points) {
+                    sample.insert(sample.end(), xi, xi + d);
+                    continue;
+                }
+                const size_t j = rng.rand_int64() % (n_seen + 1);
+                if (j < params.max_train_points) {
+                    memcpy(sample.data() + j * d, xi, d * sizeof(float));
+                }
+            }
+        }
+
+        const size_t n_train = sample.size() / d;
+        FAISS_THROW_IF_NOT_MSG(n_train > 0, "the source is empty");
+        if (params.verbose) {
+            printf("build_index: training on %zd of %zd vectors\n",
+                   n_train,
+                   n_seen);
+        }
+        index->train(n_train, sample.data());
+    }
+
+    // double buffering: the next chunk is read while the current one is
+    // added
+    std::vector<float> current(chunk_size * d), next(chunk_size * d);
+    source.rewind();
+    size_t n_current = source.read(chunk_size, current.data());
+    const faiss::idx_t ntotal0 = index->ntotal;
+
+    while (n_current > 0) {
+        auto pending = std::async(std::launch::async, [&] {
+            return source.read(chunk_size, next.data());
+        });
+
+        index->add(n_current, current.data());
+
+        n_current = pending.get();
+        std::swap(current, next);
+
+        if (params.verbose) {
+            printf("build_index: %" PRId64 " vectors added in %.1f s\r",
+                   index->ntotal - ntotal0,
+                   (faiss::getmillisecs() - t0) / 1000);
+            fflush(stdout);
+        }
+    }
+
+    if (params.verbose) {
+        printf("\n");
+    }
+}
+
+} // namespace jecq
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/Index.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace jecq {
+
+/** Vectors of dimension d, read in chunks.
+ *
+ * build_index reads a source twice, once to sample the training set and once
+ * to add the vectors, with a rewind in between.
+ */
+struct VectorSource {
+    size_t d = 0;
+
+    /// Reads up to n vectors into x, of size n * d, and returns how many were
+    /// read. Returns 0 once all vectors have been read.
+    virtual size_t read(size_t n, float* x) = 0;
+
+    /// Restarts from the first vector
+    virtual void rewind() = 0;
+
+    virtual ~VectorSource() = default;
+};
+
+/** Vectors of a .fvecs or .bvecs file, chosen by the extension.
+ *
+ * Each vector is stored as its dimension (int32) followed by d float32 or d
+ * uint8 components. bvecs components are converted to float.
+ */
+struct VecsFileSource : VectorSource {
+    FILE* f = nullptr;
+    /// bvecs: 1-byte components
+    bool bytes = false;
+    std::vector<uint8_t> row;
+
+    explicit VecsFileSource(const char* fname);
+    ~VecsFileSource() override;
+
+    size_t read(size_t n, float* x) override;
+    void rewind() override;
+};
+
+/// Vectors of a 2-D .npy array of float32 or uint8 in C order
+struct NpyFileSource : VectorSource {
+    FILE* f = nullptr;
+    /// uint8 components
+    bool bytes = false;
+    /// number of vectors of the array
+    size_t ntotal = 0;
+    /// number of vectors read since the last rewind
+    size_t n_read = 0;
+    /// file offset of the array data
+    long data_offset = 0;
+    std::vector<uint8_t> row;
+
+    explicit NpyFileSource(const char* fname);
+    ~NpyFileSource() override;
+
+    size_t read(size_t n, float* x) override;
+    void rewind() override;
+};
+
+/// Vectors produced by user functions with the semantics of VectorSource
+struct CallbackVectorSource : VectorSource {
+    std::function<size_t(size_t, float*)> read_callback;
+    std::function<void()> rewind_callback;
+
+    CallbackVectorSource(
+            size_t d,
+            std::function<size_t(size_t, float*)> read_callback,
+            std::function<void()> rewind_callback);
+
+    size_t read(size_t n, float* x) override;
+    void rewind() override;
+};
+
+/// Opens a .fvecs, .bvecs or .npy file by its extension
+std::unique_ptr<VectorSource> open_vector_file(const char* fname);
+
+struct BuildParams {
+    /// vectors read and added at a time
+    size_t chunk_size = 65536;
+
+    /// size of the uniform sample of the source the index is trained on
+    size_t max_train_points = 100000;
+
+    /// seed of the training sample
+    int64_t seed = 1234;
+
+    bool verbose = false;
+};
+
+/** Trains and fills an index from a source too large to be held in memory.
+ *
+ * If the index is not trained, a first pass draws a uniform sample of at
+ * most max_train_points vectors (reservoir sampling) and trains on it. The
+ * second pass adds the vectors chunk by chunk: the next chunk is read on
+ * another thread while the current one is added, so reading overlaps with
+ * the feature selection and encoding done by add. Apart from the index
+ * itself, at most (max_train_points + 2 * chunk_size) * d floats are held.
+ *
+ * Works with any index, notably IndexJecq and IndexIVFJecq.
+ */
+void build_index(
+        faiss::Index* index,
+        VectorSource& source,
+        const BuildParams& params = BuildParams());
+
+} // namespace jecq
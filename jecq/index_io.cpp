@@ -0,0 +1,589 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "index_io.h"
+#include "compressed_ids_inverted_lists.h"
+#include "distance_kernels.h"
+#include "index_itq_flat.h"
+#include "index_ivf_jecq.h"
+#include "index_ivf_jecq_fast_scan.h"
+#include "index_jecq.h"
+#include "index_jecq_fast_scan.h"
+#include "itq_quantizer.h"
+#include "pq4_block_inverted_lists.h"
+#include "split_inverted_lists.h"
+#include "variable_size_inverted_lists.h"
+
+#include <faiss/IndexPQ.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io_macros.h>
+#include <faiss/impl/mapped_io.h>
+#include <faiss/impl/zerocopy_io.h>
+#include <faiss/index_io.h>
+#include <faiss/invlists/InvertedListsIOHook.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace jecq {
+
+void write_io_version(faiss::IOWriter* f) {
+    const uint32_t version = jecq_io_version;
+    WRITE1(version);
+}
+
+uint32_t read_io_version(faiss::IOReader* f) {
+    uint32_t version;
+    READ1(version);
+    FAISS_THROW_IF_NOT_FMT(
+            version >= 1 && version <= jecq_io_version,
+            "unsupported Jecq format version %u, this build reads up to %u",
+            version,
+            jecq_io_version);
+    return version;
+}
+
+void register_invlists_io_hooks() {
+    static std::once_flag registered;
+    std::call_once(registered, [] {
+        faiss::InvertedListsIOHook::add_callback(
+                new SplitInvertedListsIOHook());
+        faiss::InvertedListsIOHook::add_callback(
+                new VariableSizeInvertedListsIOHook());
+        faiss::InvertedListsIOHook::add_callback(
+                new CompressedIdsInvertedListsIOHook());
+        faiss::InvertedListsIOHook::add_callback(
+                new PQ4BlockInvertedListsIOHook());
+    });
+}
+
+namespace {
+
+/// Whether h tags an index written in the format of this library
+bool is_jecq_fourcc(uint32_t h) {
+    return h == faiss::fourcc("IwJf") || h == faiss::fourcc("IwJq") ||
+            h == faiss::fourcc("IxJf") || h == faiss::fourcc("IxJq") ||
+            h == faiss::fourcc("IxIt");
+}
+
+/** Moves a reader back over a fourcc that was read ahead.
+ *
+ * faiss::read_index then gets the reader itself, which it needs for
+ * IO_FLAG_MMAP and IO_FLAG_MMAP_IFC. Returns false if the reader cannot
+ * seek, e.g. a pipe.
+ */
+bool unread_fourcc(faiss::IOReader* f) {
+    const size_t n = sizeof(uint32_t);
+    if (auto* file = dynamic_cast<faiss::FileIOReader*>(f)) {
+        return fseek(file->f, -static_cast<long>(n), SEEK_CUR) == 0;
+    }
+    if (auto* mapped = dynamic_cast<faiss::MappedFileIOReader*>(f)) {
+        mapped->pos -= n;
+        return true;
+    }
+    if (auto* zero_copy = dynamic_cast<faiss::ZeroCopyIOReader*>(f)) {
+        zero_copy->rp_ -= n;
+        return true;
+    }
+    if (auto* vec = dynamic_cast<faiss::VectorIOReader*>(f)) {
+        vec->rp -= n;
+        return true;
+    }
+    return false;
+}
+
+/// Replays a fourcc that was read ahead, for readers that cannot seek
+struct FourccReplayReader : faiss::IOReader {
+    faiss::IOReader* reader;
+    uint32_t h;
+    /// bytes of h replayed so far
+    size_t pos = 0;
+
+    FourccReplayReader(faiss::IOReader* reader, uint32_t h)
+            : reader(reader), h(h) {
+        name = reader->name;
+    }
+
+    size_t operator()(void* ptr, size_t size, size_t nitems) override {
+        if (pos == sizeof(h)) {
+            return (*reader)(ptr, size, nitems);
+        }
+
+        const size_t nbytes = size * nitems;
+        const size_t from_h = std::min(nbytes, sizeof(h) - pos);
+        memcpy(ptr, reinterpret_cast<const uint8_t*>(&h) + pos, from_h);
+        pos += from_h;
+
+        const size_t from_reader = from_h < nbytes
+                ? (*reader)(static_cast<uint8_t*>(ptr) + from_h,
+                            1,
+                            nbytes - from_h)
+                : 0;
+        return (from_h + from_reader) / size;
+    }
+
+    int filedescriptor() override {
+        return reader->filedescriptor();
+    }
+};
+
+/** Reads a code array written with WRITEVECTOR.
+ *
+ * From a memory-mapped or zero-copy reader, the array becomes a view of the
+ * reader's buffer instead of a copy. A mapped view keeps the mapping alive.
+ */
+void read_codes(faiss::MaybeOwnedVector<uint8_t>& codes, faiss::IOReader* f) {
+    auto* mapped = dynamic_cast<faiss::MappedFileIOReader*>(f);
+    auto* zero_copy = dynamic_cast<faiss::ZeroCopyIOReader*>(f);
+    if (!mapped && !zero_copy) {
+        READVECTOR(codes);
+        return;
+    }
+
+    size_t size;
+    READ1(size);
+    void* address = nullptr;
+    const size_t nread = mapped ? mapped->mmap(&address, 1, size)
+                                : zero_copy->get_data_view(&address, 1, size);
+    FAISS_THROW_IF_NOT_FMT(
+            nread == size,
+            "read error in %s: %zd != %zd",
+            f->name.c_str(),
+            nread,
+            size);
+
+    std::shared_ptr<faiss::MmappedFileMappingOwner> owner;
+    if (mapped) {
+        owner = mapped->mmap_owner;
+    }
+    codes = faiss::MaybeOwnedVector<uint8_t>::create_view(address, size, owner);
+}
+
+} // namespace
+
+/// Writes and reads the Jecq classes, friend of those with private state
+struct JecqIO {
+    static void write_header(const faiss::Index& idx, faiss::IOWriter* f) {
+        WRITE1(idx.d);
+        WRITE1(idx.ntotal);
+        WRITE1(idx.is_trained);
+        WRITE1(idx.metric_type);
+        WRITE1(idx.metric_arg);
+    }
+
+    static void read_header(faiss::Index& idx, faiss::IOReader* f) {
+        READ1(idx.d);
+        READ1(idx.ntotal);
+        READ1(idx.is_trained);
+        READ1(idx.metric_type);
+        READ1(idx.metric_arg);
+        idx.verbose = false;
+    }
+
+    static void write_base(const IndexJecqBase& index, faiss::IOWriter* f) {
+        WRITE1(index.pq_multiplier);
+        WRITE1(index.th_high);
+        WRITE1(index.th_mid);
+        WRITE1(index.reclassify_features_when_training);
+        WRITEVECTOR(index.pq_features);
+        WRITEVECTOR(index.itq_features);
+        WRITEVECTOR(index.feature_variances);
+    }
+
+    static void read_base(IndexJecqBase& index, faiss::IOReader* f) {
+        READ1(index.pq_multiplier);
+        READ1(index.th_high);
+        READ1(index.th_mid);
+        READ1(index.reclassify_features_when_training);
+        READVECTOR(index.pq_features);
+        READVECTOR(index.itq_features);
+        READVECTOR(index.feature_variances);
+    }
+
+    static void write_pq(
+            const faiss::ProductQuantizer& pq,
+            faiss::IOWriter* f) {
+        faiss::write_ProductQuantizer(&pq, f);
+    }
+
+    static void read_pq(faiss::ProductQuantizer& pq, faiss::IOReader* f) {
+        std::unique_ptr<faiss::ProductQuantizer> read(
+                faiss::read_ProductQuantizer(f));
+        pq = std::move(*read);
+    }
+
+    static void write_itq(const ITQQuantizer& itq, faiss::IOWriter* f) {
+        WRITE1(itq.d);
+        WRITE1(itq.code_size);
+        WRITE1(itq.itq_transform.itq.max_iter);
+        faiss::write_VectorTransform(&itq.itq_transform, f);
+    }
+
+    static void read_itq(ITQQuantizer& itq, faiss::IOReader* f) {
+        int max_iter;
+        READ1(itq.d);
+        READ1(itq.code_size);
+        READ1(max_iter);
+
+        std::unique_ptr<faiss::VectorTransform> vt(
+                faiss::read_VectorTransform(f));
+        auto* transform = dynamic_cast<faiss::ITQTransform*>(vt.get());
+        FAISS_THROW_IF_NOT_MSG(transform, "expected an ITQTransform");
+
+        itq.itq_transform = std::move(*transform);
+        itq.itq_transform.itq.max_iter = max_iter;
+    }
+
+    static void write_itq_flat(const IndexITQFlat& index, faiss::IOWriter* f) {
+        write_header(index, f);
+        WRITE1(index.code_size);
+        write_itq(index.itq, f);
+        WRITEVECTOR(index.codes);
+    }
+
+    static void read_itq_flat(IndexITQFlat& index, faiss::IOReader* f) {
+        read_header(index, f);
+        READ1(index.code_size);
+        read_itq(index.itq, f);
+        read_codes(index.codes, f);
+        FAISS_THROW_IF_NOT(
+                index.codes.size() == index.ntotal * index.code_size);
+    }
+
+    static void write_jecq(const IndexJecq& index, faiss::IOWriter* f) {
+        write_header(index, f);
+        write_base(index, f);
+        WRITE1(index.interleaved_codes);
+        WRITE1(index.search_mode);
+        WRITE1(index.prefilter_k_factor);
+        WRITE1(index.code_size);
+        write_header(index.index_pq, f);
+        WRITE1(index.index_pq.code_size);
+        write_pq(index.index_pq.pq, f);
+        WRITEVECTOR(index.index_pq.codes);
+        write_itq_flat(index.index_itq, f);
+        WRITEVECTOR(index.codes);
+    }
+
+    static void read_jecq(IndexJecq& index, faiss::IOReader* f) {
+        read_header(index, f);
+        read_base(index, f);
+        READ1(index.interleaved_codes);
+        READ1(index.search_mode);
+        READ1(index.prefilter_k_factor);
+        READ1(index.code_size);
+
+        // the PQ tier is written as the ITQ tier, so that its codes are
+        // read by read_codes as well
+        read_header(index.index_pq, f);
+        READ1(index.index_pq.code_size);
+        read_pq(index.index_pq.pq, f);
+        read_codes(index.index_pq.codes, f);
+        FAISS_THROW_IF_NOT(
+                index.index_pq.codes.size() ==
+                index.index_pq.ntotal * index.index_pq.code_size);
+
+        read_itq_flat(index.index_itq, f);
+        read_codes(index.codes, f);
+
+        // the codes of one layout only, of ntotal vectors
+        const size_t ntotal = index.ntotal;
+        const size_t n_separate = index.interleaved_codes ? 0 : ntotal;
+        FAISS_THROW_IF_NOT(
+                !index.is_trained ||
+                index.code_size ==
+                        index.index_pq.code_size + index.index_itq.code_size);
+        FAISS_THROW_IF_NOT(
+                index.codes.size() ==
+                (index.interleaved_codes ? ntotal * index.code_size : 0));
+        FAISS_THROW_IF_NOT(
+                index.index_pq.codes.size() ==
+                n_separate * index.index_pq.code_size);
+        FAISS_THROW_IF_NOT(
+                index.index_itq.codes.size() ==
+                n_separate * index.index_itq.code_size);
+    }
+
+    static void write_jecq_fast_scan(
+            const IndexJecqFastScan& index,
+            faiss::IOWriter* f) {
+        write_header(index, f);
+        write_base(index, f);
+        WRITE1(index.itq_iters);
+        write_pq(index.pq_quantizer, f);
+        write_itq(index.itq_quantizer, f);
+        WRITEVECTOR(index.pq_codes);
+        WRITEVECTOR(index.itq_codes);
+    }
+
+    static void read_jecq_fast_scan(
+            IndexJecqFastScan& index,
+            faiss::IOReader* f) {
+        read_header(index, f);
+        read_base(index, f);
+        READ1(index.itq_iters);
+        read_pq(index.pq_quantizer, f);
+        read_itq(index.itq_quantizer, f);
+        read_codes(index.pq_codes, f);
+        read_codes(index.itq_codes, f);
+
+        const size_t nblocks = (index.ntotal + pq4_block_vectors - 1) /
+                pq4_block_vectors;
+        FAISS_THROW_IF_NOT(
+                index.pq_codes.size() ==
+                nblocks * pq4_block_size(index.get_pq_M()));
+        FAISS_THROW_IF_NOT(
+                index.itq_codes.size() ==
+                index.ntotal * index.itq_quantizer.code_size);
+    }
+
+    static void write_direct_map(
+            const faiss::DirectMap& dm,
+            faiss::IOWriter* f) {
+        const int type = dm.type;
+        WRITE1(type);
+        WRITEVECTOR(dm.array);
+
+        const std::vector<std::pair<faiss::idx_t, faiss::idx_t>> hashtable(
+                dm.hashtable.begin(), dm.hashtable.end());
+        WRITEVECTOR(hashtable);
+    }
+
+    static void read_direct_map(faiss::DirectMap& dm, faiss::IOReader* f) {
+        int type;
+        READ1(type);
+        dm.type = faiss::DirectMap::Type(type);
+        READVECTOR(dm.array);
+
+        std::vector<std::pair<faiss::idx_t, faiss::idx_t>> hashtable;
+        READVECTOR(hashtable);
+        dm.hashtable.clear();
+        dm.hashtable.insert(hashtable.begin(), hashtable.end());
+    }
+
+    static void write_ivf_jecq(const IndexIVFJecq& index, faiss::IOWriter* f) {
+        write_header(index, f);
+        write_base(index, f);
+
+        WRITE1(index.nlist);
+        WRITE1(index.nprobe);
+        WRITE1(index.max_codes);
+        WRITE1(index.by_residual);
+        WRITE1(index.parallel_mode);
+        WRITE1(index.code_size);
+        jecq::write_index(index.quantizer, f);
+        write_direct_map(index.direct_map, f);
+
+        WRITE1(index.pq_nbits);
+        WRITE1(index.itq_iters);
+        write_pq(index.pq_quantizer, f);
+        write_itq(index.itq_quantizer, f);
+
+        WRITE1(index.split_codes);
+        WRITE1(index.per_list_features);
+        WRITE1(index.per_list_min_points);
+        WRITE1(index.compress_ids);
+        WRITE1(index.adaptive_nprobe);
+        WRITE1(index.probe_margin);
+
+        const size_t n_tiers = index.list_tiers.size();
+        WRITE1(n_tiers);
+        for (const JecqListTiers& tiers : index.list_tiers) {
+            WRITEVECTOR(tiers.pq_features);
+            WRITEVECTOR(tiers.itq_features);
+            write_pq(tiers.pq_quantizer, f);
+            write_itq(tiers.itq_quantizer, f);
+        }
+
+        faiss::write_InvertedLists(index.invlists, f);
+    }
+
+    static void read_ivf_jecq(
+            IndexIVFJecq& index,
+            faiss::IOReader* f,
+            int io_flags) {
+        read_header(index, f);
+        read_base(index, f);
+
+        READ1(index.nlist);
+        READ1(index.nprobe);
+        READ1(index.max_codes);
+        READ1(index.by_residual);
+        READ1(index.parallel_mode);
+        READ1(index.code_size);
+
+        if (index.own_fields) {
+            delete index.quantizer;
+        }
+        index.quantizer = jecq::read_index(f, io_flags);
+        index.own_fields = true;
+        read_direct_map(index.direct_map, f);
+
+        READ1(index.pq_nbits);
+        READ1(index.itq_iters);
+        read_pq(index.pq_quantizer, f);
+        read_itq(index.itq_quantizer, f);
+
+        READ1(index.split_codes);
+        READ1(index.per_list_features);
+        READ1(index.per_list_min_points);
+        READ1(index.compress_ids);
+        READ1(index.adaptive_nprobe);
+        READ1(index.probe_margin);
+
+        size_t n_tiers;
+        READ1(n_tiers);
+        FAISS_THROW_IF_NOT(n_tiers == 0 || n_tiers == index.nlist);
+        index.list_tiers.resize(n_tiers);
+        for (JecqListTiers& tiers : index.list_tiers) {
+            READVECTOR(tiers.pq_features);
+            READVECTOR(tiers.itq_features);
+            read_pq(tiers.pq_quantizer, f);
+            read_itq(tiers.itq_quantizer, f);
+        }
+
+        index.replace_invlists(faiss::read_InvertedLists(f, io_flags), true);
+        FAISS_THROW_IF_NOT(
+                index.invlists->nlist == index.nlist &&
+                index.invlists->code_size == index.code_size);
+
+        // centroids_pq is derived from the coarse quantizer
+        if (index.is_trained) {
+            index.update_centroids_pq();
+        }
+    }
+};
+
+void write_index(const faiss::Index* idx, faiss::IOWriter* f, int io_flags) {
+    register_invlists_io_hooks();
+
+    // subclasses before their parents
+    uint32_t h;
+    if (auto* index = dynamic_cast<const IndexIVFJecqFastScan*>(idx)) {
+        h = faiss::fourcc("IwJf");
+        WRITE1(h);
+        write_io_version(f);
+        JecqIO::write_ivf_jecq(*index, f);
+    } else if (auto* index = dynamic_cast<const IndexIVFJecq*>(idx)) {
+        h = faiss::fourcc("IwJq");
+        WRITE1(h);
+        write_io_version(f);
+        JecqIO::write_ivf_jecq(*index, f);
+    } else if (auto* index = dynamic_cast<const IndexJecqFastScan*>(idx)) {
+        h = faiss::fourcc("IxJf");
+        WRITE1(h);
+        write_io_version(f);
+        JecqIO::write_jecq_fast_scan(*index, f);
+    } else if (auto* index = dynamic_cast<const IndexJecq*>(idx)) {
+        h = faiss::fourcc("IxJq");
+        WRITE1(h);
+        write_io_version(f);
+        JecqIO::write_jecq(*index, f);
+    } else if (auto* index = dynamic_cast<const IndexITQFlat*>(idx)) {
+        h = faiss::fourcc("IxIt");
+        WRITE1(h);
+        write_io_version(f);
+        JecqIO::write_itq_flat(*index, f);
+    } else {
+        faiss::write_index(idx, f, io_flags);
+    }
+}
+
+void write_index(const faiss::Index* idx, FILE* f, int io_flags) {
+    faiss::FileIOWriter writer(f);
+    jecq::write_index(idx, &writer, io_flags);
+}
+
+void write_index(const faiss::Index* idx, const char* fname, int io_flags) {
+    faiss::FileIOWriter writer(fname);
+    jecq::write_index(idx, &writer, io_flags);
+}
+
+faiss::Index* read_index(faiss::IOReader* f, int io_flags) {
+    register_invlists_io_hooks();
+
+    uint32_t h;
+    READ1(h);
+
+    std::unique_ptr<faiss::Index> idx;
+    if (h == faiss::fourcc("IwJf") || h == faiss::fourcc("IwJq")) {
+        read_io_version(f);
+        std::unique_ptr<IndexIVFJecq> index(
+                h == faiss::fourcc("IwJf") ? new IndexIVFJecqFastScan()
+                                           : new IndexIVFJecq());
+        JecqIO::read_ivf_jecq(*index, f, io_flags);
+        idx = std::move(index);
+    } else if (h == faiss::fourcc("IxJf")) {
+        read_io_version(f);
+        auto index = std::make_unique<IndexJecqFastScan>();
+        JecqIO::read_jecq_fast_scan(*index, f);
+        idx = std::move(index);
+    } else if (h == faiss::fourcc("IxJq")) {
+        read_io_version(f);
+        auto index = std::make_unique<IndexJecq>();
+        JecqIO::read_jecq(*index, f);
+        idx = std::move(index);
+    } else if (h == faiss::fourcc("IxIt")) {
+        read_io_version(f);
+        auto index = std::make_unique<IndexITQFlat>();
+        JecqIO::read_itq_flat(*index, f);
+        idx = std::move(index);
+    } else if (unread_fourcc(f)) {
+        idx.reset(faiss::read_index(f, io_flags));
+    } else {
+        FourccReplayReader replay(f, h);
+        idx.reset(faiss::read_index(&replay, io_flags));
+    }
+
+    return idx.release();
+}
+
+faiss::Index* read_index(FILE* f, int io_flags) {
+    faiss::FileIOReader reader(f);
+    return jecq::read_index(&reader, io_flags);
+}
+
+faiss::Index* read_index(const char* fname, int io_flags) {
+    uint32_t h;
+    {
+        faiss::FileIOReader reader(fname);
+        faiss::IOReader* f = &reader;
+        READ1(h);
+    }
+    if (!is_jecq_fourcc(h)) {
+        // faiss maps the file itself for IO_FLAG_MMAP and IO_FLAG_MMAP_IFC
+        return faiss::read_index(fname, io_flags);
+    }
+
+    if ((io_flags & faiss::IO_FLAG_MMAP_IFC) == faiss::IO_FLAG_MMAP_IFC) {
+        auto owner = std::make_shared<faiss::MmappedFileMappingOwner>(fname);
+        faiss::MappedFileIOReader reader(owner);
+        return jecq::read_index(&reader, io_flags);
+    }
+
+    faiss::FileIOReader reader(fname);
+    return jecq::read_index(&reader, io_flags);
+}
+
+} // namespace jecq
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/Index.h>
+#include <faiss/impl/io.h>
+
+#include <cstdint>
+#include <cstdio>
+
+namespace jecq {
+
+/** I/O of Jecq indexes.
+ *
+ * IndexITQFlat, IndexJecq, IndexJecqFastScan, IndexIVFJecq and
+ * IndexIVFJecqFastScan are written in their own format, tagged with a fourcc
+ * and followed by the version of the format. Any other index, e.g. the
+ * coarse quantizer of an IndexIVFJecq, is handed to faiss::write_index and
+ * faiss::read_index. The inverted lists of this library are written through
+ * faiss::InvertedListsIOHook, so faiss::write_InvertedLists and
+ * faiss::read_InvertedLists handle them as well.
+ *
+ * All arrays are written in one piece, so reading an index is one
+ * sequential pass over the data.
+ *
+ * With faiss::IO_FLAG_MMAP_IFC, read_index maps the file and the code arrays
+ * of the Jecq indexes, as well as those faiss maps itself, become read-only
+ * views of the mapping (is_owned = false) instead of copies. Processes that
+ * map the same file share its pages. A faiss::ZeroCopyIOReader gives views of
+ * an in-memory buffer the same way. Such an index is read-only.
+ */
+
+/// version of the format, written after the fourcc of each Jecq object
+constexpr uint32_t jecq_io_version = 1;
+
+void write_io_version(faiss::IOWriter* f);
+
+/// Reads a version written by write_io_version, throws if it is unknown
+uint32_t read_io_version(faiss::IOReader* f);
+
+void write_index(
+        const faiss::Index* idx,
+        faiss::IOWriter* writer,
+        int io_flags = 0);
+void write_index(const faiss::Index* idx, FILE* f, int io_flags = 0);
+void write_index(const faiss::Index* idx, const char* fname, int io_flags = 0);
+
+/// Reads an index written by write_index or faiss::write_index. The file
+/// name version honors faiss::IO_FLAG_MMAP_IFC. Other indexes are read by
+/// faiss::read_index from the same reader, so its flags, e.g.
+/// faiss::IO_FLAG_MMAP, apply to them as well.
+faiss::Index* read_index(faiss::IOReader* reader, int io_flags = 0);
+faiss::Index* read_index(FILE* f, int io_flags = 0);
+faiss::Index* read_index(const char* fname, int io_flags = 0);
+
+/// Registers the faiss::InvertedListsIOHook of the inverted lists of this
+/// library, once. Called by write_index and read_index.
+void register_invlists_io_hooks();
+
+} // namespace jecq
@@ -19,10 +19,14 @@
 // SOFTWARE.
 
 #include "index_itq_flat.h"
+#include "distance_kernels.h"
 #include "itq_quantizer.h"
 
 #include <faiss/utils/Heap.h>
-#include <faiss/utils/hamming.h>
+
+#include <omp.h>
+
+#include <algorithm>
 
 namespace jecq {
 
@@ -63,11 +67,63 @@ void IndexITQFlat::search(
 
     std::vector<int> hamming_distances(n * k);
 
-    faiss::int_maxheap_array_t res = {
-            size_t(n), size_t(k), labels, hamming_distances.data()};
-
-    hammings_knn_hc(
-            &res, q_codes.data(), codes.data(), ntotal, code_size, true);
+    // Queries are grouped in tiles that scan the database together, block
+    // by block, so that a block is read from memory once per tile.
+    const faiss::idx_t nt = omp_get_max_threads();
+    const faiss::idx_t tile_size = std::max<faiss::idx_t>(
+            1, std::min<faiss::idx_t>(scan_tile_queries, n / nt));
+    const faiss::idx_t n_tiles = (n + tile_size - 1) / tile_size;
+    const faiss::idx_t codes_per_block = std::max<size_t>(
+            256, scan_tile_code_bytes / std::max<size_t>(1, code_size));
+
+#pragma omp parallel if (n > 1)
+    {
+        std::vector<int> block_hammings(codes_per_block);
+
+#pragma omp for schedule(dynamic)
+        for (faiss::idx_t t = 0; t < n_tiles; ++t) {
+            const faiss::idx_t i0 = t * tile_size;
+            const faiss::idx_t i1 = std::min(i0 + tile_size, n);
+
+            for (faiss::idx_t i = i0; i < i1; ++i) {
+                faiss::maxheap_heapify(
+                        k, hamming_distances.data() + k * i, labels + k * i);
+            }
+
+            for (faiss::idx_t j0 = 0; j0 < ntotal; j0 += codes_per_block) {
+                const auto j1 = std::min(j0 + codes_per_block, ntotal);
+
+                for (faiss::idx_t i = i0; i < i1; ++i) {
+                    int* heap_hammings = hamming_distances.data() + k * i;
+                    faiss::idx_t* heap_labels = labels + k * i;
+
+                    jecq::hamming_distances(
+                            q_codes.data() + code_size * i,
+                            codes.data() + code_size * j0,
+                            j1 - j0,
+                            code_size,
+                            code_size,
+                            block_hammings.data());
+
+                    for (faiss::idx_t j = j0; j < j1; ++j) {
+                        if (block_hammings[j - j0] < heap_hammings[0]) {
+                            faiss::maxheap_replace_top(
+                                    k,
+                                    heap_hammings,
+                                    heap_labels,
+                                    block_hammings[j - j0],
+                                    j);
+                        }
+                    }
+                }
+            }
+
+            for (faiss::idx_t i = i0; i < i1; ++i) {
+                faiss::maxheap_reorder(
+                        k, hamming_distances.data() + k * i, labels + k * i);
+            }
+        }
+    }
 
     for (faiss::idx_t i = 0; i < hamming_distances.size(); ++i) {
         distances[i] =
@@ -19,13 +19,29 @@
 // SOFTWARE.
 
 #include "index_ivf_jecq.h"
+#include "compressed_ids_inverted_lists.h"
+#include "distance_kernels.h"
 #include "feature_classifier.h"
+#include "fused_scan.h"
+#include "id_selection.h"
+#include "pq4_block_inverted_lists.h"
+#include "split_inverted_lists.h"
+#include "variable_size_inverted_lists.h"
 
 #include <faiss/IndexFlat.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
 #include <faiss/utils/distances.h>
 #include <faiss/utils/utils.h>
 
+#include <algorithm>
 #include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <omp.h>
 
 namespace jecq {
 IndexIVFJecq::IndexIVFJecq() : IndexIVFJecq(0, 1, 10, 0.05, 0.005, 50) {}
@@ -37,93 +53,479 @@ IndexIVFJecq::IndexIVFJecq(
         float th_high,
         float th_mid,
         int itq_iters)
-        : IndexJecqBase(pq_multiplier, th_high, th_mid),
-          IndexIVF(
+        : IndexIVFJecq(
                   new faiss::IndexFlat(
                           d,
                           faiss::MetricType::METRIC_INNER_PRODUCT),
                   d,
                   nlist,
+                  pq_multiplier,
+                  th_high,
+                  th_mid,
+                  itq_iters) {
+    this->own_fields = true;
+}
+
+IndexIVFJecq::IndexIVFJecq(
+        faiss::Index* quantizer,
+        faiss::idx_t d,
+        faiss::idx_t nlist,
+        float pq_multiplier,
+        float th_high,
+        float th_mid,
+        int itq_iters)
+        : IndexJecqBase(pq_multiplier, th_high, th_mid),
+          IndexIVF(
+                  quantizer,
+                  d,
+                  nlist,
                   /*code_size=*/0,
                   faiss::MetricType::METRIC_INNER_PRODUCT),
-          itq_iters(itq_iters) {}
+          itq_iters(itq_iters) {
+    FAISS_THROW_IF_NOT_MSG(
+            quantizer->metric_type == faiss::MetricType::METRIC_INNER_PRODUCT,
+            "the coarse quantizer must use the inner product");
+    this->by_residual = false;
+}
+
+void IndexIVFJecq::update_centroids_pq() {
+    const size_t npq = pq_features.size();
+
+    if (!by_residual || npq == 0) {
+        centroids_pq.clear();
+        return;
+    }
+
+    centroids_pq.resize(nlist * npq);
+    std::vector<float> centroid(d);
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        quantizer->reconstruct(list_no, centroid.data());
+        filter_by_features(
+                centroid.data(),
+                pq_features,
+                centroids_pq.data() + list_no * npq);
+    }
+}
+
+void IndexIVFJecq::get_pq_data(
+        faiss::idx_t n,
+        const float* x,
+        const faiss::idx_t* list_nos,
+        float* pq_data) const {
+    const size_t npq = pq_features.size();
+
+    filter_by_features(n, d, x, pq_features, pq_data);
+
+    if (!by_residual) {
+        return;
+    }
+
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        if (list_nos[i] < 0) {
+            continue;
+        }
+
+        const float* centroid = centroids_pq.data() + list_nos[i] * npq;
+        for (size_t f = 0; f < npq; ++f) {
+            pq_data[i * npq + f] -= centroid[f];
+        }
+    }
+}
+
+float IndexIVFJecq::get_list_pq_bias(
+        const float* q_pq,
+        float pq_multiplier,
+        faiss::idx_t list_no) const {
+    if (!by_residual || pq_features.empty()) {
+        return 0.0f;
+    }
+
+    const size_t npq = pq_features.size();
+    return pq_multiplier *
+            faiss::fvec_inner_product(
+                   q_pq, centroids_pq.data() + list_no * npq, npq);
+}
+
+void IndexIVFJecq::encode_with_tiers(
+        const TiersRef& tiers,
+        const float* x,
+        float* pq_data,
+        float* itq_data,
+        uint8_t* code) const {
+    memset(code, 0, code_size);
+
+    if (!tiers.pq_features->empty()) {
+        filter_by_features(x, *tiers.pq_features, pq_data);
+        tiers.pq_quantizer->compute_code(pq_data, code);
+    }
+
+    if (!tiers.itq_features->empty()) {
+        filter_by_features(x, *tiers.itq_features, itq_data);
+        tiers.itq_quantizer->compute_codes(
+                itq_data, code + tiers.pq_quantizer->code_size, 1);
+    }
+}
 
 void IndexIVFJecq::encode_vectors(
         faiss::idx_t n,
         const float* x,
         const faiss::idx_t* list_nos,
-        uint8_t* code,
+        uint8_t* codes,
         bool include_listno) const {
-    std::vector<float> pq_data(pq_features.size());
-    std::vector<float> itq_data(itq_features.size());
+    // Vectors are encoded in blocks, one per thread at a time: the features
+    // of a whole block are gathered and its ITQ rotation is a single matrix
+    // product.
+    constexpr faiss::idx_t block_size = 4096;
 
-    for (faiss::idx_t i = 0; i < n; i++) {
-        const float* row = x + i * d;
-        uint8_t* const cp = code + i * code_size;
+    const size_t npq = pq_features.size();
+    const size_t nitq = itq_features.size();
+    const size_t pq_code_size = npq > 0 ? pq_quantizer.code_size : 0;
+    const size_t itq_code_size = itq_quantizer.code_size;
+    const size_t coarse_size = include_listno ? coarse_code_size() : 0;
+    const size_t record_size = coarse_size + code_size;
 
-        if (!pq_features.empty()) {
-            filter_by_features(row, pq_features, pq_data.data());
-            pq_quantizer.compute_code(pq_data.data(), cp);
-        }
+    const faiss::idx_t nblocks = (n + block_size - 1) / block_size;
+
+#pragma omp parallel if (nblocks > 1)
+    {
+        std::vector<float> pq_data(block_size * npq);
+        // per-list tiers may move PQ features to the ITQ tier
+        std::vector<float> itq_data(
+                block_size * (list_tiers.empty() ? nitq : npq + nitq));
+        std::vector<uint8_t> pq_codes(block_size * pq_code_size);
+        std::vector<uint8_t> itq_codes(block_size * itq_code_size);
+
+#pragma omp for schedule(dynamic)
+        for (faiss::idx_t b = 0; b < nblocks; ++b) {
+            const faiss::idx_t i0 = b * block_size;
+            const faiss::idx_t bs = std::min(block_size, n - i0);
+            const float* xb = x + i0 * d;
+
+            if (!list_tiers.empty()) {
+                // the tiers change from vector to vector
+                for (faiss::idx_t i = 0; i < bs; ++i) {
+                    const faiss::idx_t list_no =
+                            list_nos ? list_nos[i0 + i] : -1;
+                    uint8_t* record = codes + (i0 + i) * record_size;
+
+                    if (include_listno) {
+                        encode_listno(list_no, record);
+                        record += coarse_size;
+                    }
 
-        if (!itq_features.empty()) {
-            filter_by_features(row, itq_features, itq_data.data());
-            itq_quantizer.compute_codes(
-                    itq_data.data(), cp + pq_quantizer.code_size, 1);
+                    encode_with_tiers(
+                            get_list_tiers(list_no),
+                            xb + i * d,
+                            pq_data.data(),
+                            itq_data.data(),
+                            record);
+                }
+                continue;
+            }
+
+            if (npq > 0) {
+                get_pq_data(
+                        bs,
+                        xb,
+                        list_nos ? list_nos + i0 : nullptr,
+                        pq_data.data());
+                pq_quantizer.compute_codes(
+                        pq_data.data(), pq_codes.data(), bs);
+            }
+
+            if (nitq > 0) {
+                filter_by_features(bs, d, xb, itq_features, itq_data.data());
+                itq_quantizer.compute_codes(
+                        itq_data.data(), itq_codes.data(), bs);
+            }
+
+            for (faiss::idx_t i = 0; i < bs; ++i) {
+                uint8_t* record = codes + (i0 + i) * record_size;
+
+                if (include_listno) {
+                    encode_listno(list_nos[i0 + i], record);
+                    record += coarse_size;
+                }
+
+                memcpy(record,
+                       pq_codes.data() + i * pq_code_size,
+                       pq_code_size);
+                memcpy(record + pq_quantizer.code_size,
+                       itq_codes.data() + i * itq_code_size,
+                       itq_code_size);
+            }
         }
     }
 }
 
+namespace {
+
+/// Result labels of the entries of an inverted list
+struct ListLabels {
+    const faiss::idx_t* ids;
+    faiss::idx_t list_no;
+    bool store_pairs;
+    /// position in the list of the first entry being scanned
+    faiss::idx_t offset = 0;
+    /// decodes the ids of compressed lists scanned without ids
+    const CompressedIdsInvertedLists* id_lists = nullptr;
+
+    faiss::idx_t operator()(faiss::idx_t j) const {
+        if (store_pairs) {
+            return faiss::lo_build(list_no, offset + j);
+        }
+        return ids ? ids[offset + j] : id_lists->get_id(list_no, offset + j);
+    }
+};
+
+/// Keeps the k best scores of a list scan in the result min-heap. Vectors
+/// that cannot beat the current k-th score are pruned.
+struct ListHeapHandler {
+    static constexpr bool prunes = true;
+
+    ListLabels labels;
+    size_t k;
+    float* simi;
+    faiss::idx_t* idxi;
+    size_t nup = 0;
+
+    float threshold() const {
+        return simi[0];
+    }
+
+    void add(float distance, faiss::idx_t j) {
+        if (simi[0] < distance) {
+            faiss::minheap_replace_top(k, simi, idxi, distance, labels(j));
+            nup++;
+        }
+    }
+};
+
+/// Keeps the scores of a list scan above a radius
+struct ListRangeHandler {
+    static constexpr bool prunes = true;
+
+    ListLabels labels;
+    float radius;
+    faiss::RangeQueryResult& result;
+
+    float threshold() const {
+        return radius;
+    }
+
+    void add(float distance, faiss::idx_t j) {
+        if (distance > radius) {
+            result.add(distance, labels(j));
+        }
+    }
+};
+
+} // namespace
+
+/** Scans the inverted lists of an IndexIVFJecq for one query.
+ *
+ * set_query builds the scaled PQ lookup table and the ITQ code of the query
+ * in buffers sized at construction, so scanning does not allocate. With
+ * per_list_features, they are rebuilt by set_list for the tiers of each
+ * list. The lists are scored in blocks with the ADC and Hamming kernels, see
+ * scan_fused. The ITQ terms come first: the PQ codes of vectors that cannot
+ * beat the k-th score or the radius with the largest PQ term are not read.
+ */
 struct IVFJecqScanner : faiss::InvertedListScanner {
     const IndexIVFJecq* parent;
+    const float pq_multiplier;
+    const IDSelection selection;
+
+    /// tiers of the current list: those of the index, or the own tiers of
+    /// the list with per_list_features
+    IndexIVFJecq::TiersRef tiers;
+    /// 0 without high variance features
+    size_t pq_code_size = 0;
+    size_t itq_code_size = 0;
+
+    const float* query = nullptr;
     std::vector<float> q_pq;
+    std::vector<float> q_itq_data;
     std::vector<uint8_t> q_itq;
-    const float* q = nullptr;
 
-    IVFJecqScanner(const IndexIVFJecq* p, bool store_pairs)
-            : InvertedListScanner(store_pairs), parent(p) {
+    /// scaled PQ lookup table of the query
+    std::vector<float> pq_table;
+    /// largest PQ term any code can reach
+    float pq_upper = 0;
+    /// by_residual: PQ term of the centroid of the current list
+    float list_bias = 0;
+    /// bytes from one code of the current list to the next
+    size_t list_code_size;
+
+    /// lists in the split layout, nullptr otherwise
+    const SplitInvertedLists* split_lists;
+    /// lists storing codes of per-list sizes, nullptr otherwise
+    const VariableSizeInvertedLists* variable_lists;
+    /// lists with compressed ids, nullptr otherwise
+    const CompressedIdsInvertedLists* id_lists;
+
+    // A list has at most as many PQ features, and as many features in
+    // total, as the index: the buffers are sized for the index.
+    IVFJecqScanner(
+            const IndexIVFJecq* p,
+            bool store_pairs,
+            const faiss::IDSelector* sel,
+            float pq_multiplier)
+            : InvertedListScanner(store_pairs, sel),
+              parent(p),
+              pq_multiplier(pq_multiplier),
+              selection(sel),
+              tiers(p->get_list_tiers(-1)),
+              q_pq(p->pq_features.size()),
+              q_itq_data(p->pq_features.size() + p->itq_features.size()),
+              q_itq(ITQQuantizer::get_code_size(q_itq_data.size())),
+              pq_table(p->pq_features.size() * p->pq_quantizer.ksub),
+              list_code_size(p->code_size),
+              split_lists(
+                      dynamic_cast<const SplitInvertedLists*>(p->invlists)),
+              variable_lists(
+                      dynamic_cast<const VariableSizeInvertedLists*>(
+                              p->invlists)),
+              id_lists(dynamic_cast<const CompressedIdsInvertedLists*>(
+                      p->invlists)) {
         this->keep_max = true;
+        this->code_size = parent->code_size;
     }
 
-    void set_query(const float* query) override {
-        this->q = query;
-        this->code_size = parent->code_size;
+    /// Builds the query tables of the given tiers
+    void set_tiers(const IndexIVFJecq::TiersRef& t) {
+        tiers = t;
+        pq_code_size = tiers.pq_code_size();
+        itq_code_size = tiers.itq_quantizer->code_size;
+
+        if (pq_code_size > 0) {
+            const auto& pq = *tiers.pq_quantizer;
 
-        if (!parent->pq_features.empty()) {
-            q_pq.resize(parent->pq_features.size());
-            filter_by_features(query, parent->pq_features, q_pq.data());
+            filter_by_features(query, *tiers.pq_features, q_pq.data());
+            compute_scaled_inner_prod_table(
+                    pq, q_pq.data(), pq_multiplier, pq_table.data());
+            pq_upper = pq_adc_upper_bound(pq_table.data(), pq.M, pq.ksub);
         }
 
-        if (!parent->itq_features.empty()) {
-            std::vector<float> itq_data(parent->itq_features.size());
-            filter_by_features(query, parent->itq_features, itq_data.data());
+        if (itq_code_size > 0) {
+            filter_by_features(
+                    query, *tiers.itq_features, q_itq_data.data());
+            tiers.itq_quantizer->compute_codes(
+                    q_itq_data.data(), q_itq.data(), 1);
+        }
+    }
+
+    void set_query(const float* query) override {
+        this->query = query;
 
-            q_itq.resize(parent->itq_quantizer.code_size);
-            parent->itq_quantizer.compute_codes(
-                    itq_data.data(), q_itq.data(), 1);
+        if (parent->list_tiers.empty()) {
+            set_tiers(parent->get_list_tiers(-1));
         }
     }
 
-    void set_list(faiss::idx_t list_no, float coarse_dis) {}
+    void set_list(faiss::idx_t list_no, float /*coarse_dis*/) override {
+        this->list_no = list_no;
+
+        if (!parent->list_tiers.empty()) {
+            set_tiers(parent->get_list_tiers(list_no));
+        }
+
+        list_code_size = variable_lists
+                ? variable_lists->list_code_sizes[list_no]
+                : code_size;
+        list_bias =
+                parent->get_list_pq_bias(q_pq.data(), pq_multiplier, list_no);
+    }
 
     float distance_to_code(const uint8_t* code) const override {
-        float pq_distance = 0, itq_distance = 0;
+        float distance = 0;
+
+        if (pq_code_size > 0) {
+            distance = pq_adc_distance(
+                    pq_table.data(), tiers.pq_quantizer->M, code);
+        }
+
+        if (itq_code_size > 0) {
+            distance += tiers.itq_quantizer->get_inner_product_distance(
+                    code + tiers.pq_quantizer->code_size, q_itq.data());
+        }
+
+        return distance + list_bias;
+    }
+
+    /// Scan of the codes of a list, or of a block of a SplitInvertedLists
+    QueryScan get_list_scan(const uint8_t* codes, const faiss::idx_t* ids)
+            const {
+        const size_t pq_size = tiers.pq_quantizer->code_size;
+        const size_t n_per_block = split_lists ? split_lists->n_per_block : 0;
+
+        return {codes,
+                split_lists ? pq_size : list_code_size,
+                pq_code_size,
+                *tiers.pq_quantizer,
+                pq_table.data(),
+                pq_upper,
+                list_bias,
+                split_lists ? codes + n_per_block * pq_size : codes + pq_size,
+                split_lists ? itq_code_size : list_code_size,
+                itq_code_size,
+                *tiers.itq_quantizer,
+                q_itq.data(),
+                selection.selects_all() ? nullptr : &selection,
+                ids};
+    }
 
-        if (!parent->pq_features.empty()) {
-            std::vector<float> recon(parent->pq_features.size());
-            parent->pq_quantizer.decode(code, recon.data(), 1);
-            pq_distance = faiss::fvec_inner_product(
-                    q_pq.data(), recon.data(), recon.size());
+    /// Scores the entries of a list, one block at a time for split lists
+    template <class Handler>
+    void scan_list(
+            size_t list_size,
+            const uint8_t* codes,
+            const faiss::idx_t* ids,
+            Handler& handler) const {
+        if (!split_lists) {
+            scan_tiers(0, list_size, get_list_scan(codes, ids), handler);
+            return;
         }
 
-        code += parent->pq_quantizer.code_size;
+        const size_t n_per_block = split_lists->n_per_block;
 
-        if (!parent->itq_features.empty()) {
-            itq_distance = parent->itq_quantizer.get_inner_product_distance(
-                    code, q_itq.data());
+        for (size_t j0 = 0; j0 < list_size; j0 += n_per_block) {
+            const size_t bs = std::min(n_per_block, list_size - j0);
+            handler.labels.offset = j0;
+            scan_tiers(
+                    0,
+                    bs,
+                    get_list_scan(
+                            codes + j0 * code_size, ids ? ids + j0 : nullptr),
+                    handler);
         }
+    }
+
+    size_t scan_codes(
+            size_t list_size,
+            const uint8_t* codes,
+            const faiss::idx_t* ids,
+            float* simi,
+            faiss::idx_t* idxi,
+            size_t k) const override {
+        ListHeapHandler handler = {
+                {ids, list_no, store_pairs, 0, id_lists}, k, simi, idxi};
+        scan_list(list_size, codes, ids, handler);
+        return handler.nup;
+    }
 
-        return (parent->pq_multiplier * pq_distance + itq_distance);
+    /// Scores the ITQ terms first and skips the PQ terms of the codes that
+    /// cannot exceed the radius even with the largest PQ term.
+    void scan_codes_range(
+            size_t list_size,
+            const uint8_t* codes,
+            const faiss::idx_t* ids,
+            float radius,
+            faiss::RangeQueryResult& result) const override {
+        ListRangeHandler handler = {
+                {ids, list_no, store_pairs, 0, id_lists}, radius, result};
+        scan_list(list_size, codes, ids, handler);
     }
 };
 
@@ -131,10 +533,33 @@ faiss::InvertedListScanner* IndexIVFJecq::get_InvertedListScanner(
         bool store_pairs,
         const faiss::IDSelector* sel,
         const faiss::IVFSearchParameters* params) const {
-    return new IVFJecqScanner(this, store_pairs);
+    return new IVFJecqScanner(
+            this, store_pairs, sel, get_search_pq_multiplier(params));
+}
+
+float IndexIVFJecq::get_search_pq_multiplier(
+        const faiss::IVFSearchParameters* params) const {
+    const auto* jecq_params =
+            dynamic_cast<const SearchParametersIVFJecq*>(params);
+
+    return jecq_params && jecq_params->pq_multiplier > 0
+            ? jecq_params->pq_multiplier
+            : this->pq_multiplier;
 }
 
 void IndexIVFJecq::train(faiss::idx_t n, const float* x) {
+    // the stored codes would no longer match the new quantizers
+    FAISS_THROW_IF_NOT_MSG(
+            ntotal == 0, "cannot train an index that holds vectors, reset it");
+    FAISS_THROW_IF_NOT_MSG(
+            !per_list_features || !(by_residual || split_codes),
+            "per_list_features cannot be combined with by_residual or "
+            "split_codes");
+    FAISS_THROW_IF_NOT_MSG(
+            !compress_ids || !(split_codes || per_list_features),
+            "compress_ids cannot be combined with split_codes or "
+            "per_list_features");
+
     const auto t0 = faiss::getmillisecs();
 
     if (verbose) {
@@ -157,17 +582,44 @@ void IndexIVFJecq::train(faiss::idx_t n, const float* x) {
 
     const auto t1 = faiss::getmillisecs();
 
+    // The coarse quantizer comes first: in by_residual mode the PQ tier is
+    // trained on residuals. k-means assigns the training vectors to the
+    // centroids exhaustively: a quantizer other than a flat index (e.g.
+    // HNSW) only receives the final centroids.
+    if (!clustering_index && !dynamic_cast<faiss::IndexFlat*>(quantizer)) {
+        faiss::IndexFlat clustering_flat(d, metric_type);
+        clustering_index = &clustering_flat;
+        try {
+            train_q1(n, x, verbose, metric_type);
+        } catch (...) {
+            clustering_index = nullptr;
+            throw;
+        }
+        clustering_index = nullptr;
+    } else {
+        train_q1(n, x, verbose, metric_type);
+    }
+    update_centroids_pq();
+
+    const auto t2 = faiss::getmillisecs();
+
     if (!pq_features.empty()) {
-        const int nbits = 8;
         pq_quantizer = faiss::ProductQuantizer(
-                pq_features.size(), pq_features.size(), nbits);
-        const auto pq_data = get_filtered_features(n, d, x, pq_features);
+                pq_features.size(), pq_features.size(), pq_nbits);
+
+        std::vector<faiss::idx_t> assign(by_residual ? n : 0);
+        if (by_residual) {
+            quantizer->assign(n, x, assign.data());
+        }
+
+        std::vector<float> pq_data(n * pq_features.size());
+        get_pq_data(n, x, assign.data(), pq_data.data());
         pq_quantizer.train(n, pq_data.data());
     } else {
         pq_quantizer = faiss::ProductQuantizer();
     }
 
-    const auto t2 = faiss::getmillisecs();
+    const auto t3 = faiss::getmillisecs();
 
     if (!itq_features.empty()) {
         itq_quantizer = ITQQuantizer(itq_features.size(), itq_iters);
@@ -177,47 +629,911 @@ void IndexIVFJecq::train(faiss::idx_t n, const float* x) {
         itq_quantizer = ITQQuantizer();
     }
 
-    const auto t3 = faiss::getmillisecs();
+    const auto t4 = faiss::getmillisecs();
 
-    // Train base
     this->code_size = pq_quantizer.code_size + itq_quantizer.code_size;
-    assert(this->own_invlists);
-    delete this->invlists;
-    this->invlists = new faiss::ArrayInvertedLists(nlist, code_size);
-    IndexIVF::train(n, x);
 
-    const auto t4 = faiss::getmillisecs();
+    if (per_list_features) {
+        train_list_tiers(n, x);
+    } else {
+        list_tiers.clear();
+    }
+
+    const auto t5 = faiss::getmillisecs();
+
+    // Inverted lists installed with replace_invlists (e.g. on-disk lists) are
+    // kept as long as they hold codes of the trained size. Empty in-memory
+    // lists are recreated for the new code size and layout.
+    const bool in_memory =
+            dynamic_cast<faiss::ArrayInvertedLists*>(invlists) ||
+            dynamic_cast<SplitInvertedLists*>(invlists) ||
+            dynamic_cast<CompressedIdsInvertedLists*>(invlists) ||
+            dynamic_cast<VariableSizeInvertedLists*>(invlists) ||
+            dynamic_cast<PQ4BlockInvertedLists*>(invlists);
+
+    if (in_memory && invlists->compute_ntotal() == 0) {
+        replace_invlists(create_invlists(), true);
+    } else {
+        FAISS_THROW_IF_NOT_FMT(
+                invlists->code_size == code_size,
+                "inverted lists have code_size %zu, the trained index needs "
+                "%zu",
+                invlists->code_size,
+                code_size);
+    }
+    this->is_trained = true;
 
     if (verbose) {
-        printf("Training IndexIVFJecq complete; total_ms = %.1f, classification_ms=%.1f, pq_ms=%.1f, itq_ms=%.1f, IndexIVF_ms=%.1f\n",
-               t4 - t0,
+        printf("Training IndexIVFJecq complete; total_ms = %.1f, classification_ms=%.1f, pq_ms=%.1f, itq_ms=%.1f, IndexIVF_ms=%.1f, per_list_ms=%.1f\n",
+               t5 - t0,
                t1 - t0,
-               t2 - t1,
                t3 - t2,
-               t4 - t3);
+               t4 - t3,
+               t2 - t1,
+               t5 - t4);
+    }
+}
+
+void IndexIVFJecq::train_list_tiers(faiss::idx_t n, const float* x) {
+    std::vector<faiss::idx_t> assign(n);
+    quantizer->assign(n, x, assign.data());
+
+    std::vector<std::vector<faiss::idx_t>> list_points(nlist);
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        list_points[assign[i]].push_back(i);
+    }
+
+    // A list stays within the code size of the index: it gets at most as
+    // many PQ features and as many features in total.
+    const size_t max_pq_features = pq_features.size();
+    const size_t max_features = pq_features.size() + itq_features.size();
+    const size_t min_points =
+            std::max(per_list_min_points, size_t(1) << pq_nbits);
+
+    list_tiers.assign(nlist, JecqListTiers());
+    size_t n_own_tiers = 0;
+    size_t total_code_size = 0;
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        const auto& points = list_points[list_no];
+        JecqListTiers& tiers = list_tiers[list_no];
+
+        if (points.size() < min_points) {
+            tiers = {pq_features, itq_features, pq_quantizer, itq_quantizer};
+            total_code_size += code_size;
+            continue;
+        }
+
+        const faiss::idx_t nl = points.size();
+        std::vector<float> xl(nl * d);
+        for (faiss::idx_t i = 0; i < nl; ++i) {
+            memcpy(xl.data() + i * d, x + points[i] * d, sizeof(float) * d);
+        }
+
+        std::vector<float> variances;
+        classify_features(
+                nl,
+                d,
+                xl.data(),
+                th_high,
+                th_mid,
+                &tiers.pq_features,
+                &tiers.itq_features,
+                &variances);
+
+        if (tiers.pq_features.size() > max_pq_features) {
+            tiers.itq_features.insert(
+                    tiers.itq_features.begin(),
+                    tiers.pq_features.begin() + max_pq_features,
+                    tiers.pq_features.end());
+            tiers.pq_features.resize(max_pq_features);
+        }
+        if (tiers.pq_features.size() + tiers.itq_features.size() >
+            max_features) {
+            tiers.itq_features.resize(
+                    max_features - tiers.pq_features.size());
+        }
+
+        if (!tiers.pq_features.empty()) {
+            const size_t npq = tiers.pq_features.size();
+            tiers.pq_quantizer = faiss::ProductQuantizer(npq, npq, pq_nbits);
+            const auto pq_data =
+                    get_filtered_features(nl, d, xl.data(), tiers.pq_features);
+            tiers.pq_quantizer.train(nl, pq_data.data());
+        }
+
+        if (!tiers.itq_features.empty()) {
+            tiers.itq_quantizer =
+                    ITQQuantizer(tiers.itq_features.size(), itq_iters);
+            const auto itq_data = get_filtered_features(
+                    nl, d, xl.data(), tiers.itq_features);
+            tiers.itq_quantizer.train(nl, itq_data.data());
+        }
+
+        n_own_tiers++;
+        total_code_size += get_list_tiers(list_no).code_size();
+    }
+
+    if (verbose) {
+        printf("Trained the tiers of %zu of %zu lists; mean code size %.1f bytes, index code size %zu bytes\n",
+               n_own_tiers,
+               nlist,
+               double(total_code_size) / nlist,
+               code_size);
+    }
+}
+
+IndexIVFJecq::TiersRef IndexIVFJecq::get_list_tiers(
+        faiss::idx_t list_no) const {
+    if (list_no < 0 || list_tiers.empty()) {
+        return {&pq_features, &pq_quantizer, &itq_features, &itq_quantizer};
+    }
+
+    const JecqListTiers& tiers = list_tiers[list_no];
+    return {&tiers.pq_features,
+            &tiers.pq_quantizer,
+            &tiers.itq_features,
+            &tiers.itq_quantizer};
+}
+
+void IndexIVFJecq::train_probe_margin(
+        faiss::idx_t n,
+        const float* xq,
+        float quantile) {
+    FAISS_THROW_IF_NOT_MSG(is_trained && ntotal > 0, "index is empty");
+    FAISS_THROW_IF_NOT(quantile > 0 && quantile <= 1);
+
+    const size_t nprobe = std::min(nlist, this->nprobe);
+    std::vector<faiss::idx_t> keys(n * nprobe);
+    std::vector<float> coarse_dis(n * nprobe);
+    quantizer->search(n, xq, nprobe, coarse_dis.data(), keys.data());
+
+    // gap of each probed list, -inf for missing or empty lists
+    const float no_gap = -std::numeric_limits<float>::infinity();
+    std::vector<float> gaps(n * nprobe, no_gap);
+
+#pragma omp parallel
+    {
+        std::unique_ptr<faiss::InvertedListScanner> scanner(
+                get_InvertedListScanner(false));
+
+#pragma omp for
+        for (faiss::idx_t i = 0; i < n; ++i) {
+            scanner->set_query(xq + i * d);
+
+            for (size_t ik = 0; ik < nprobe; ++ik) {
+                const faiss::idx_t key = keys[i * nprobe + ik];
+                const size_t list_size =
+                        key < 0 ? 0 : invlists->list_size(key);
+                if (list_size == 0) {
+                    continue;
+                }
+
+                scanner->set_list(key, coarse_dis[i * nprobe + ik]);
+                faiss::InvertedLists::ScopedCodes codes(invlists, key);
+                faiss::InvertedLists::ScopedIds ids(invlists, key);
+
+                float best = -std::numeric_limits<float>::infinity();
+                faiss::idx_t label = -1;
+                scanner->scan_codes(
+                        list_size, codes.get(), ids.get(), &best, &label, 1);
+                gaps[i * nprobe + ik] = best - coarse_dis[i * nprobe + ik];
+            }
+        }
+    }
+
+    gaps.erase(std::remove(gaps.begin(), gaps.end(), no_gap), gaps.end());
+    FAISS_THROW_IF_NOT_MSG(!gaps.empty(), "no list probed by the queries");
+
+    const size_t rank = std::min(
+            gaps.size() - 1, size_t(std::ceil(quantile * gaps.size())) - 1);
+    std::nth_element(gaps.begin(), gaps.begin() + rank, gaps.end());
+    probe_margin = gaps[rank];
+
+    if (verbose) {
+        printf("IndexIVFJecq probe_margin = %g from %zu lists\n",
+               probe_margin,
+               gaps.size());
+    }
+}
+
+void IndexIVFJecq::search_preassigned(
+        faiss::idx_t n,
+        const float* x,
+        faiss::idx_t k,
+        const faiss::idx_t* keys,
+        const float* coarse_dis,
+        float* distances,
+        faiss::idx_t* labels,
+        bool store_pairs,
+        const faiss::IVFSearchParameters* params,
+        faiss::IndexIVFStats* stats) const {
+    const size_t nprobe =
+            std::min(nlist, params ? params->nprobe : this->nprobe);
+    const faiss::idx_t nt = omp_get_max_threads();
+
+    // With fewer queries than threads (e.g. single online queries), the
+    // probed lists of each query are split across the threads instead of
+    // the queries. IndexIVF::search runs batches in parallel slices, which
+    // keep the per-query loop.
+    const bool over_lists = parallel_mode == 0 && !omp_in_parallel() &&
+            n < nt && nprobe > 1;
+
+    const faiss::IDSelector* sel = params ? params->sel : nullptr;
+
+    // Compressed ids are decoded by the scanner for the results only. A
+    // selector tests the id of every entry, so it gets the decoded list.
+    const bool lazy_ids = !store_pairs && !sel &&
+            dynamic_cast<const CompressedIdsInvertedLists*>(invlists);
+
+    if (!adaptive_nprobe && !over_lists && !lazy_ids) {
+        IndexIVF::search_preassigned(
+                n,
+                x,
+                k,
+                keys,
+                coarse_dis,
+                distances,
+                labels,
+                store_pairs,
+                params,
+                stats);
+        return;
+    }
+
+    const size_t max_codes = params ? params->max_codes : this->max_codes;
+    FAISS_THROW_IF_NOT_MSG(
+            !(sel && store_pairs),
+            "selector and store_pairs cannot be combined");
+
+    // Scans a list into a heap, returns the size of the list
+    auto scan_one_list = [this, store_pairs, lazy_ids, k](
+                                 faiss::InvertedListScanner& scanner,
+                                 faiss::idx_t key,
+                                 float dis,
+                                 float* simi,
+                                 faiss::idx_t* idxi,
+                                 size_t& nheap) -> size_t {
+        const size_t list_size = invlists->list_size(key);
+        if (list_size == 0) {
+            return 0;
+        }
+
+        scanner.set_list(key, dis);
+        faiss::InvertedLists::ScopedCodes codes(invlists, key);
+        std::unique_ptr<faiss::InvertedLists::ScopedIds> ids;
+        if (!store_pairs && !lazy_ids) {
+            ids.reset(new faiss::InvertedLists::ScopedIds(invlists, key));
+        }
+
+        nheap += scanner.scan_codes(
+                list_size,
+                codes.get(),
+                ids ? ids->get() : nullptr,
+                simi,
+                idxi,
+                k);
+        return list_size;
+    };
+
+    // adaptive_nprobe: once the heap is full, lists whose centroid score
+    // plus probe_margin does not beat its k-th score are not visited. The
+    // lists come in decreasing centroid score, so none of the remaining
+    // ones can improve the results either.
+    auto stop_probing = [this](float dis,
+                               const float* simi,
+                               const faiss::idx_t* idxi) {
+        return adaptive_nprobe && idxi[0] >= 0 &&
+                dis + probe_margin <= simi[0];
+    };
+
+    const double t0 = faiss::getmillisecs();
+    size_t nlistv = 0, ndis = 0, nheap = 0;
+
+    if (over_lists) {
+        for (faiss::idx_t i = 0; i < n; ++i) {
+            float* simi = distances + i * k;
+            faiss::idx_t* idxi = labels + i * k;
+            faiss::minheap_heapify(k, simi, idxi);
+
+            // probes from stop_probe on are skipped by all threads
+            size_t stop_probe = nprobe;
+            size_t nscan = 0;
+            auto lower_stop_probe = [&stop_probe](size_t ik) {
+#pragma omp critical(jecq_stop_probe)
+                {
+                    if (ik < stop_probe) {
+#pragma omp atomic write
+                        stop_probe = ik;
+                    }
+                }
+            };
+
+#pragma omp parallel reduction(+ : nlistv, ndis, nheap)
+            {
+                std::unique_ptr<faiss::InvertedListScanner> scanner(
+                        get_InvertedListScanner(store_pairs, sel, params));
+                scanner->set_query(x + i * d);
+
+                // the k-th score of a thread never exceeds the one of the
+                // query, so it can stop the probing of all threads
+                std::vector<float> local_simi(k);
+                std::vector<faiss::idx_t> local_idxi(k);
+                faiss::minheap_heapify(
+                        k, local_simi.data(), local_idxi.data());
+
+#pragma omp for schedule(dynamic, 1)
+                for (size_t ik = 0; ik < nprobe; ++ik) {
+                    size_t stop;
+#pragma omp atomic read
+                    stop = stop_probe;
+
+                    const faiss::idx_t key = keys[i * nprobe + ik];
+                    if (ik >= stop || key < 0) {
+                        continue;
+                    }
+
+                    const float dis = coarse_dis[i * nprobe + ik];
+                    if (stop_probing(
+                                dis, local_simi.data(), local_idxi.data())) {
+                        lower_stop_probe(ik);
+                        continue;
+                    }
+
+                    const size_t list_size = scan_one_list(
+                            *scanner,
+                            key,
+                            dis,
+                            local_simi.data(),
+                            local_idxi.data(),
+                            nheap);
+                    if (list_size == 0) {
+                        continue;
+                    }
+
+                    nlistv++;
+                    ndis += list_size;
+
+                    if (max_codes) {
+                        size_t total;
+#pragma omp atomic capture
+                        total = nscan += list_size;
+
+                        if (total >= max_codes) {
+                            lower_stop_probe(ik + 1);
+                        }
+                    }
+                }
+
+#pragma omp critical(jecq_merge_heaps)
+                faiss::heap_addn<faiss::CMin<float, faiss::idx_t>>(
+                        k,
+                        simi,
+                        idxi,
+                        local_simi.data(),
+                        local_idxi.data(),
+                        k);
+            }
+
+            faiss::minheap_reorder(k, simi, idxi);
+        }
+    } else {
+#pragma omp parallel reduction(+ : nlistv, ndis, nheap)
+        {
+            std::unique_ptr<faiss::InvertedListScanner> scanner(
+                    get_InvertedListScanner(store_pairs, sel, params));
+
+#pragma omp for
+            for (faiss::idx_t i = 0; i < n; ++i) {
+                float* simi = distances + i * k;
+                faiss::idx_t* idxi = labels + i * k;
+                faiss::minheap_heapify(k, simi, idxi);
+                scanner->set_query(x + i * d);
+
+                size_t nscan = 0;
+                for (size_t ik = 0; ik < nprobe; ++ik) {
+                    const faiss::idx_t key = keys[i * nprobe + ik];
+                    if (key < 0) {
+                        continue;
+                    }
+
+                    const float dis = coarse_dis[i * nprobe + ik];
+                    if (stop_probing(dis, simi, idxi)) {
+                        break;
+                    }
+
+                    const size_t list_size = scan_one_list(
+                            *scanner, key, dis, simi, idxi, nheap);
+                    if (list_size == 0) {
+                        continue;
+                    }
+
+                    nlistv++;
+                    nscan += list_size;
+
+                    if (max_codes && nscan >= max_codes) {
+                        break;
+                    }
+                }
+
+                ndis += nscan;
+                faiss::minheap_reorder(k, simi, idxi);
+            }
+        }
+    }
+
+    if (stats) {
+        stats->nq += n;
+        stats->nlist += nlistv;
+        stats->ndis += ndis;
+        stats->nheap_updates += nheap;
+        stats->search_time += faiss::getmillisecs() - t0;
+    }
+}
+
+faiss::InvertedLists* IndexIVFJecq::create_invlists() const {
+    if (!list_tiers.empty()) {
+        std::vector<size_t> list_code_sizes(nlist);
+        for (size_t list_no = 0; list_no < nlist; ++list_no) {
+            list_code_sizes[list_no] = get_list_tiers(list_no).code_size();
+        }
+        return new VariableSizeInvertedLists(code_size, list_code_sizes);
+    }
+
+    if (split_codes) {
+        return new SplitInvertedLists(
+                nlist, pq_quantizer.code_size, itq_quantizer.code_size);
+    }
+
+    if (compress_ids) {
+        return new CompressedIdsInvertedLists(nlist, code_size);
+    }
+
+    return new faiss::ArrayInvertedLists(nlist, code_size);
+}
+
+size_t IndexIVFJecq::remove_ids(const faiss::IDSelector& sel) {
+    auto* lists = dynamic_cast<CompressedIdsInvertedLists*>(invlists);
+    if (!lists || !direct_map.no()) {
+        return IndexIVF::remove_ids(sel);
+    }
+
+    // same order as IndexIVF: a removed entry is replaced by the last one
+    size_t nremove = 0;
+
+#pragma omp parallel for reduction(+ : nremove)
+    for (faiss::idx_t list_no = 0; list_no < faiss::idx_t(nlist); ++list_no) {
+        const size_t list_size = lists->list_size(list_no);
+        std::vector<faiss::idx_t> ids(list_size);
+        {
+            faiss::InvertedLists::ScopedIds scoped_ids(lists, list_no);
+            std::copy_n(scoped_ids.get(), list_size, ids.data());
+        }
+
+        size_t l = list_size, j = 0;
+        while (j < l) {
+            if (sel.is_member(ids[j])) {
+                l--;
+                ids[j] = ids[l];
+                lists->update_entry(
+                        list_no,
+                        j,
+                        ids[l],
+                        faiss::InvertedLists::ScopedCodes(lists, list_no, l)
+                                .get());
+            } else {
+                j++;
+            }
+        }
+
+        if (l < list_size) {
+            lists->resize(list_no, l);
+            nremove += list_size - l;
+        }
+    }
+
+    ntotal -= nremove;
+    return nremove;
+}
+
+void IndexIVFJecq::check_compatible_for_merge(
+        const faiss::Index& otherIndex) const {
+    IndexIVF::check_compatible_for_merge(otherIndex);
+
+    const auto& other = static_cast<const IndexIVFJecq&>(otherIndex);
+    FAISS_THROW_IF_NOT_MSG(
+            is_trained && other.is_trained, "indexes must be trained");
+    FAISS_THROW_IF_NOT_MSG(
+            other.by_residual == by_residual,
+            "only one of the indexes encodes residuals");
+
+    check_compatible_features(other);
+    check_identical_pq(pq_quantizer, other.pq_quantizer);
+    itq_quantizer.check_identical(other.itq_quantizer);
+
+    FAISS_THROW_IF_NOT_MSG(
+            other.list_tiers.size() == list_tiers.size(),
+            "only one of the indexes has per-list tiers");
+    for (size_t list_no = 0; list_no < list_tiers.size(); ++list_no) {
+        const JecqListTiers& tiers = list_tiers[list_no];
+        const JecqListTiers& other_tiers = other.list_tiers[list_no];
+        FAISS_THROW_IF_NOT_FMT(
+                other_tiers.pq_features == tiers.pq_features &&
+                        other_tiers.itq_features == tiers.itq_features,
+                "list %zu classifies its features differently",
+                list_no);
+        check_identical_pq(tiers.pq_quantizer, other_tiers.pq_quantizer);
+        tiers.itq_quantizer.check_identical(other_tiers.itq_quantizer);
+    }
+}
+
+namespace {
+
+/// Copies the codes of a list in the layout of add_entries: code_size bytes
+/// each, the PQ code followed by the ITQ code
+void copy_list_codes(
+        const faiss::InvertedLists* lists,
+        size_t list_no,
+        uint8_t* codes) {
+    const size_t n = lists->list_size(list_no);
+    const size_t code_size = lists->code_size;
+
+    if (const auto* split = dynamic_cast<const SplitInvertedLists*>(lists)) {
+        const uint8_t* blocks = split->codes[list_no].data();
+        for (size_t i = 0; i < n; ++i) {
+            split->unpack(blocks, i, codes + i * code_size);
+        }
+        return;
+    }
+
+    if (const auto* pq4 = dynamic_cast<const PQ4BlockInvertedLists*>(lists)) {
+        const uint8_t* blocks = pq4->codes[list_no].data();
+        for (size_t i = 0; i < n; ++i) {
+            pq4->packer.unpack_1(blocks, i, codes + i * code_size);
+        }
+        return;
+    }
+
+    faiss::InvertedLists::ScopedCodes list_codes(lists, list_no);
+
+    if (const auto* variable =
+                dynamic_cast<const VariableSizeInvertedLists*>(lists)) {
+        const size_t stored_size = variable->list_code_sizes[list_no];
+        std::fill_n(codes, n * code_size, 0);
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(codes + i * code_size,
+                   list_codes.get() + i * stored_size,
+                   stored_size);
+        }
+        return;
+    }
+
+    memcpy(codes, list_codes.get(), n * code_size);
+}
+
+} // namespace
+
+void IndexIVFJecq::merge_from(faiss::Index& otherIndex, faiss::idx_t add_id) {
+    FAISS_THROW_IF_NOT_MSG(&otherIndex != this, "cannot merge with itself");
+    check_compatible_for_merge(otherIndex);
+
+    auto& other = static_cast<IndexIVFJecq&>(otherIndex);
+    faiss::InvertedLists* other_lists = other.invlists;
+
+    std::vector<faiss::idx_t> ids;
+    std::vector<uint8_t> codes;
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        const size_t list_size = other_lists->list_size(list_no);
+        if (list_size == 0) {
+            continue;
+        }
+
+        ids.resize(list_size);
+        {
+            faiss::InvertedLists::ScopedIds list_ids(other_lists, list_no);
+            for (size_t i = 0; i < list_size; ++i) {
+                ids[i] = list_ids[i] + add_id;
+            }
+        }
+
+        codes.resize(list_size * code_size);
+        copy_list_codes(other_lists, list_no, codes.data());
+
+        invlists->add_entries(list_no, list_size, ids.data(), codes.data());
+        other_lists->resize(list_no, 0);
+    }
+
+    ntotal += other.ntotal;
+    other.ntotal = 0;
+}
+
+void IndexIVFJecq::copy_subset_to(
+        faiss::IndexIVF& other,
+        faiss::InvertedLists::subset_type_t subset_type,
+        faiss::idx_t a1,
+        faiss::idx_t a2) const {
+    using subset_type_t = faiss::InvertedLists::subset_type_t;
+    FAISS_THROW_IF_NOT_FMT(
+            subset_type >= subset_type_t::SUBSET_TYPE_ID_RANGE &&
+                    subset_type <= subset_type_t::SUBSET_TYPE_INVLIST,
+            "subset type %d not implemented",
+            int(subset_type));
+    other.check_compatible_for_merge(*this);
+
+    // SUBSET_TYPE_ELEMENT_RANGE takes the entries [a1, a2) of the lists
+    // concatenated, spread over the lists in proportion of their sizes
+    const size_t ntotal_lists =
+            subset_type == subset_type_t::SUBSET_TYPE_ELEMENT_RANGE
+            ? invlists->compute_ntotal()
+            : 0;
+    size_t accu_n = 0, accu_a1 = 0, accu_a2 = 0;
+
+    std::vector<uint8_t> codes;
+    std::vector<faiss::idx_t> subset_ids;
+    std::vector<uint8_t> subset_codes;
+    size_t n_added = 0;
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        const size_t list_size = invlists->list_size(list_no);
+        if (list_size == 0) {
+            continue;
+        }
+
+        size_t i1 = 0, i2 = 0;
+        if (subset_type == subset_type_t::SUBSET_TYPE_ELEMENT_RANGE) {
+            const size_t next_accu_n = accu_n + list_size;
+            const size_t next_accu_a1 = next_accu_n * a1 / ntotal_lists;
+            const size_t next_accu_a2 = next_accu_n * a2 / ntotal_lists;
+            i1 = next_accu_a1 - accu_a1;
+            i2 = next_accu_a2 - accu_a2;
+            accu_n = next_accu_n;
+            accu_a1 = next_accu_a1;
+            accu_a2 = next_accu_a2;
+        }
+
+        faiss::InvertedLists::ScopedIds ids(invlists, list_no);
+        auto in_subset = [&](size_t i) {
+            const faiss::idx_t id = ids[i];
+            switch (subset_type) {
+                case subset_type_t::SUBSET_TYPE_ID_RANGE:
+                    return a1 <= id && id < a2;
+                case subset_type_t::SUBSET_TYPE_ID_MOD:
+                    return id % a1 == a2;
+                case subset_type_t::SUBSET_TYPE_ELEMENT_RANGE:
+                    return i1 <= i && i < i2;
+                case subset_type_t::SUBSET_TYPE_INVLIST_FRACTION:
+                    return faiss::idx_t(list_no) * a1 / faiss::idx_t(nlist) ==
+                            a2;
+                default:
+                    return a1 <= faiss::idx_t(list_no) &&
+                            faiss::idx_t(list_no) < a2;
+            }
+        };
+
+        codes.resize(list_size * code_size);
+        copy_list_codes(invlists, list_no, codes.data());
+
+        subset_ids.clear();
+        subset_codes.clear();
+        for (size_t i = 0; i < list_size; ++i) {
+            if (in_subset(i)) {
+                subset_ids.push_back(ids[i]);
+                subset_codes.insert(
+                        subset_codes.end(),
+                        codes.begin() + i * code_size,
+                        codes.begin() + (i + 1) * code_size);
+            }
+        }
+
+        if (!subset_ids.empty()) {
+            other.invlists->add_entries(
+                    list_no,
+                    subset_ids.size(),
+                    subset_ids.data(),
+                    subset_codes.data());
+            n_added += subset_ids.size();
+        }
+    }
+
+    other.ntotal += n_added;
+}
+
+void IndexIVFJecq::decode_with_tiers(
+        const TiersRef& tiers,
+        faiss::idx_t n,
+        const uint8_t* codes,
+        size_t stride,
+        const faiss::idx_t* list_nos,
+        float* x) const {
+    // Codes are copied block by block into contiguous buffers, so that each
+    // tier of a block is decoded in one call.
+    constexpr faiss::idx_t block_size = 4096;
+
+    const size_t npq = tiers.pq_features->size();
+    const size_t nitq = tiers.itq_features->size();
+    const size_t pq_code_size = tiers.pq_code_size();
+    const size_t itq_code_size = tiers.itq_quantizer->code_size;
+    const bool add_centroids = by_residual && npq > 0 && list_tiers.empty();
+    const faiss::idx_t nblocks = (n + block_size - 1) / block_size;
+
+    std::fill_n(x, n * d, 0.0f);
+
+#pragma omp parallel if (nblocks > 1)
+    {
+        std::vector<uint8_t> pq_block(block_size * pq_code_size);
+        std::vector<uint8_t> itq_block(block_size * itq_code_size);
+        std::vector<float> pq_data(block_size * npq);
+        std::vector<float> itq_data(block_size * nitq);
+
+#pragma omp for schedule(dynamic)
+        for (faiss::idx_t b = 0; b < nblocks; ++b) {
+            const faiss::idx_t i0 = b * block_size;
+            const faiss::idx_t bs = std::min(block_size, n - i0);
+            const uint8_t* cb = codes + i0 * stride;
+            float* xb = x + i0 * d;
+
+            if (npq > 0) {
+                for (faiss::idx_t i = 0; i < bs; ++i) {
+                    memcpy(pq_block.data() + i * pq_code_size,
+                           cb + i * stride,
+                           pq_code_size);
+                }
+                tiers.pq_quantizer->decode(
+                        pq_block.data(), pq_data.data(), bs);
+
+                for (faiss::idx_t i = 0; add_centroids && i < bs; ++i) {
+                    const faiss::idx_t list_no = list_nos[i0 + i];
+                    if (list_no < 0) {
+                        continue;
+                    }
+                    const float* centroid =
+                            centroids_pq.data() + list_no * npq;
+                    float* pq_i = pq_data.data() + i * npq;
+                    for (size_t f = 0; f < npq; ++f) {
+                        pq_i[f] += centroid[f];
+                    }
+                }
+
+                scatter_by_features(
+                        bs, d, pq_data.data(), *tiers.pq_features, xb);
+            }
+
+            if (nitq > 0) {
+                for (faiss::idx_t i = 0; i < bs; ++i) {
+                    memcpy(itq_block.data() + i * itq_code_size,
+                           cb + i * stride + pq_code_size,
+                           itq_code_size);
+                }
+                tiers.itq_quantizer->decode(
+                        itq_block.data(), itq_data.data(), bs);
+                scatter_by_features(
+                        bs, d, itq_data.data(), *tiers.itq_features, xb);
+            }
+        }
+    }
+}
+
+void IndexIVFJecq::decode_codes(
+        faiss::idx_t n,
+        const uint8_t* codes,
+        size_t stride,
+        const faiss::idx_t* list_nos,
+        float* x) const {
+    if (list_tiers.empty()) {
+        decode_with_tiers(get_list_tiers(-1), n, codes, stride, list_nos, x);
+        return;
+    }
+
+    faiss::idx_t i0 = 0;
+    while (i0 < n) {
+        faiss::idx_t i1 = i0 + 1;
+        while (i1 < n && list_nos[i1] == list_nos[i0]) {
+            ++i1;
+        }
+        decode_with_tiers(
+                get_list_tiers(list_nos[i0]),
+                i1 - i0,
+                codes + i0 * stride,
+                stride,
+                list_nos + i0,
+                x + i0 * d);
+        i0 = i1;
     }
 }
 
+void IndexIVFJecq::decode_vectors(
+        faiss::idx_t n,
+        const uint8_t* codes,
+        const faiss::idx_t* list_nos,
+        float* x) const {
+    decode_codes(n, codes, code_size, list_nos, x);
+}
+
+void IndexIVFJecq::sa_decode(faiss::idx_t n, const uint8_t* bytes, float* x)
+        const {
+    const size_t coarse_size = coarse_code_size();
+    const size_t record_size = coarse_size + code_size;
+
+    std::vector<faiss::idx_t> list_nos(n);
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        list_nos[i] = decode_listno(bytes + i * record_size);
+    }
+
+    decode_codes(n, bytes + coarse_size, record_size, list_nos.data(), x);
+}
+
 void IndexIVFJecq::reconstruct_from_offset(
         faiss::idx_t list_no,
         faiss::idx_t offset,
         float* recons) const {
-    const uint8_t* code = invlists->get_codes(list_no) + offset * code_size;
+    faiss::InvertedLists::ScopedCodes code(invlists, list_no, offset);
+    decode_with_tiers(
+            get_list_tiers(list_no), 1, code.get(), 0, &list_no, recons);
+}
 
-    std::fill_n(recons, d, 0.0f);
+void IndexIVFJecq::reconstruct_n(
+        faiss::idx_t i0,
+        faiss::idx_t ni,
+        float* recons) const {
+    FAISS_THROW_IF_NOT(ni == 0 || (i0 >= 0 && i0 + ni <= ntotal));
 
-    if (!pq_features.empty()) {
-        std::vector<float> pq_data(pq_features.size());
-        pq_quantizer.decode(code, pq_data.data(), 1);
-        filter_by_features(pq_data.data(), pq_features, recons);
+#pragma omp parallel if (nlist > 1)
+    {
+        std::vector<size_t> offsets;
+        std::vector<faiss::idx_t> slots;
+        std::vector<uint8_t> codes;
+        std::vector<float> decoded;
 
-        code += pq_quantizer.code_size;
-    }
+#pragma omp for schedule(dynamic)
+        for (faiss::idx_t list_no = 0; list_no < faiss::idx_t(nlist);
+             ++list_no) {
+            const size_t list_size = invlists->list_size(list_no);
+            if (list_size == 0) {
+                continue;
+            }
 
-    if (!itq_features.empty()) {
-        std::vector<float> itq_data(itq_features.size());
-        itq_quantizer.decode(code, itq_data.data(), 1);
-        filter_by_features(itq_data.data(), itq_features, recons);
+            offsets.clear();
+            slots.clear();
+            {
+                faiss::InvertedLists::ScopedIds ids(invlists, list_no);
+                for (size_t offset = 0; offset < list_size; ++offset) {
+                    if (ids[offset] >= i0 && ids[offset] < i0 + ni) {
+                        offsets.push_back(offset);
+                        slots.push_back(ids[offset] - i0);
+                    }
+                }
+            }
+            if (offsets.empty()) {
+                continue;
+            }
+
+            // the codes of a list are as long as the code of its tiers
+            const TiersRef tiers = get_list_tiers(list_no);
+            const size_t cs = tiers.code_size();
+            codes.resize(offsets.size() * cs);
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                faiss::InvertedLists::ScopedCodes code(
+                        invlists, list_no, offsets[i]);
+                memcpy(codes.data() + i * cs, code.get(), cs);
+            }
+
+            const std::vector<faiss::idx_t> list_nos(offsets.size(), list_no);
+            decoded.resize(offsets.size() * d);
+            decode_with_tiers(
+                    tiers,
+                    offsets.size(),
+                    codes.data(),
+                    cs,
+                    list_nos.data(),
+                    decoded.data());
+
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                memcpy(recons + slots[i] * d,
+                       decoded.data() + i * d,
+                       d * sizeof(float));
+            }
+        }
     }
 }
 
@@ -28,21 +28,211 @@
 #include <faiss/IndexIVF.h>
 #include <faiss/impl/ProductQuantizer.h>
 
+#include <limits>
 #include <memory>
 #include <vector>
 
 namespace jecq {
 
+/** Search parameters of IndexIVFJecq.
+ *
+ * The IDSelector in sel is evaluated inside the list scans: vectors it
+ * rejects never reach the results, and sparse blocks skip their codes.
+ */
+struct SearchParametersIVFJecq : faiss::SearchParametersIVF {
+    /// overrides the pq_multiplier of the index when positive
+    float pq_multiplier = 0;
+};
+
+/// Feature partition and quantizers of one inverted list, see
+/// IndexIVFJecq::per_list_features
+struct JecqListTiers {
+    std::vector<faiss::idx_t> pq_features;
+    std::vector<faiss::idx_t> itq_features;
+    faiss::ProductQuantizer pq_quantizer;
+    ITQQuantizer itq_quantizer;
+};
+
+/** IVF index with Jecq codes in its inverted lists.
+ *
+ * With by_residual set before training (off by default), the PQ tier encodes
+ * the high variance features relative to the coarse centroid of the list.
+ * The query-centroid term of those features is computed once per list in
+ * set_list, so the per-code cost stays a table lookup. The ITQ tier always
+ * encodes the mid variance features themselves: its Hamming estimate does
+ * not split into a centroid and a residual term.
+ *
+ * With split_codes set before training, the lists keep the PQ and ITQ codes
+ * in separate planes (see SplitInvertedLists): the scanner reads the ITQ
+ * codes of a block first and only the PQ codes of the vectors that can still
+ * enter the results.
+ *
+ * With per_list_features set before training, every list with enough
+ * training points classifies its features and trains its PQ and ITQ
+ * quantizers on those points alone. A list never gets more PQ features, or
+ * more features in total, than the index, so its codes fit in code_size
+ * bytes; the default in-memory lists store each code in the bytes its own
+ * tiers need (see VariableSizeInvertedLists).
+ *
+ * With compress_ids set before training, the lists store the ids bit-packed
+ * in blocks (see CompressedIdsInvertedLists). search decodes only the ids of
+ * the results, unless an IDSelector needs the ids of every scanned entry.
+ *
+ * The inverted lists can be replaced after training, e.g. by a
+ * faiss::OnDiskInvertedLists of code_size bytes per code; training again
+ * keeps them as long as the code size does not change.
+ */
 class IndexIVFJecq : public IndexJecqBase, public faiss::IndexIVF {
-   private:
+   protected:
+    /// bits per PQ sub-quantizer code
+    int pq_nbits = 8;
     int itq_iters;
     faiss::ProductQuantizer pq_quantizer;
     ITQQuantizer itq_quantizer;
 
+    /// by_residual: high variance features of the coarse centroids, one row
+    /// of pq_features.size() floats per list
+    std::vector<float> centroids_pq;
+
+    /// per_list_features: tiers of each list, empty otherwise
+    std::vector<JecqListTiers> list_tiers;
+
+    /// Fills centroids_pq from the coarse quantizer
+    void update_centroids_pq();
+
+    /// Fills list_tiers from the training vectors of each list
+    void train_list_tiers(faiss::idx_t n, const float* x);
+
+    /// Non-owning view of the feature partition and quantizers of a list
+    struct TiersRef {
+        const std::vector<faiss::idx_t>* pq_features;
+        const faiss::ProductQuantizer* pq_quantizer;
+        const std::vector<faiss::idx_t>* itq_features;
+        const ITQQuantizer* itq_quantizer;
+
+        /// 0 without high variance features
+        size_t pq_code_size() const {
+            return pq_features->empty() ? 0 : pq_quantizer->code_size;
+        }
+
+        /// bytes of a code, the PQ code followed by the ITQ code
+        size_t code_size() const {
+            return pq_quantizer->code_size + itq_quantizer->code_size;
+        }
+    };
+
+    /// Tiers that encode the codes of a list: its own with
+    /// per_list_features, those of the index otherwise or for list_no < 0
+    TiersRef get_list_tiers(faiss::idx_t list_no) const;
+
+    /** Encodes a single vector with the given tiers into code_size bytes,
+     * zero past the bytes of the tiers.
+     *
+     * @param pq_data   buffer of tiers.pq_features->size() floats
+     * @param itq_data  buffer of tiers.itq_features->size() floats
+     */
+    void encode_with_tiers(
+            const TiersRef& tiers,
+            const float* x,
+            float* pq_data,
+            float* itq_data,
+            uint8_t* code) const;
+
+    /** Decodes n codes of the given tiers, stride bytes apart.
+     *
+     * @param list_nos  list of each code, only read in by_residual mode
+     */
+    void decode_with_tiers(
+            const TiersRef& tiers,
+            faiss::idx_t n,
+            const uint8_t* codes,
+            size_t stride,
+            const faiss::idx_t* list_nos,
+            float* x) const;
+
+    /// Decodes n codes of the lists list_nos, stride bytes apart, in runs of
+    /// codes that share their tiers
+    void decode_codes(
+            faiss::idx_t n,
+            const uint8_t* codes,
+            size_t stride,
+            const faiss::idx_t* list_nos,
+            float* x) const;
+
+    /** Inputs of the PQ tier for n vectors: their high variance features,
+     * minus those of their list centroid in by_residual mode. A vector
+     * without a list (list_nos[i] < 0) is encoded as is.
+     *
+     * @param list_nos  list of each vector, only read in by_residual mode
+     * @param pq_data   output, size n * pq_features.size()
+     */
+    void get_pq_data(
+            faiss::idx_t n,
+            const float* x,
+            const faiss::idx_t* list_nos,
+            float* pq_data) const;
+
+    /// by_residual: PQ term of the centroid of a list for a query, 0 otherwise
+    float get_list_pq_bias(
+            const float* q_pq,
+            float pq_multiplier,
+            faiss::idx_t list_no) const;
+
+    /// pq_multiplier of a search, overridden by SearchParametersIVFJecq
+    float get_search_pq_multiplier(
+            const faiss::IVFSearchParameters* params) const;
+
+    /// Empty in-memory inverted lists in the layout selected by split_codes
+    /// and compress_ids
+    virtual faiss::InvertedLists* create_invlists() const;
+
    public:
+    /// store the PQ and ITQ codes of the lists in separate planes, read when
+    /// training sets up the inverted lists
+    bool split_codes = false;
+
+    /// classify the features and train the quantizers of every list on its
+    /// own training points, read by train
+    bool per_list_features = false;
+    /// lists with fewer training points use the tiers of the index
+    size_t per_list_min_points = 1024;
+
+    /// store the ids of the lists bit-packed, read when training sets up the
+    /// inverted lists; cannot be combined with split_codes or
+    /// per_list_features
+    bool compress_ids = false;
+
+    /** Adaptive probing: the probed lists are visited in decreasing centroid
+     * score, and a query stops at the first list whose centroid score plus
+     * probe_margin cannot beat its k-th result. nprobe and max_codes remain
+     * the list and code budgets of a query. Lists visited are counted in
+     * faiss::indexIVF_stats.nlist.
+     */
+    bool adaptive_nprobe = false;
+    /// bound on the best score of a list minus its centroid score, see
+    /// train_probe_margin
+    float probe_margin = std::numeric_limits<float>::infinity();
+
     IndexIVFJecq();
 
+    /// Owns a flat inner product coarse quantizer
+    IndexIVFJecq(
+            faiss::idx_t d,
+            faiss::idx_t nlist,
+            float pq_multiplier,
+            float th_high,
+            float th_mid,
+            int itq_iters = 50);
+
+    /** Uses the given inner product coarse quantizer. For a large nlist, a
+     * faiss::IndexHNSWFlat avoids the nlist * d cost of assigning a vector.
+     * As in Faiss, the quantizer is only deleted with the index when
+     * own_fields is set. Unless clustering_index is set, train runs k-means
+     * with a flat index and adds the centroids to a quantizer of another
+     * type.
+     */
     IndexIVFJecq(
+            faiss::Index* quantizer,
             faiss::idx_t d,
             faiss::idx_t nlist,
             float pq_multiplier,
@@ -64,6 +254,39 @@ class IndexIVFJecq : public IndexJecqBase, public faiss::IndexIVF {
 
     void train(faiss::idx_t n, const float* x) override;
 
+    /** Learns probe_margin from sample queries, once vectors are added.
+     *
+     * For each sample query and each of its nprobe lists, the best score of
+     * the list minus its centroid score is measured; probe_margin is set to
+     * the given quantile of these gaps. A quantile of 1 stops probing only
+     * where no sample query found a better vector.
+     *
+     * @param xq        sample queries, size n * d
+     * @param quantile  in (0, 1]
+     */
+    void train_probe_margin(
+            faiss::idx_t n,
+            const float* xq,
+            float quantile = 1);
+
+    /** Batches of fewer queries than threads are searched one query at a
+     * time, with the probed lists split across the threads: each thread
+     * scans into its own heap and the heaps are merged at the end. Other
+     * batches run a loop over queries, which is IndexIVF's own unless
+     * adaptive_nprobe or compress_ids is set.
+     */
+    void search_preassigned(
+            faiss::idx_t n,
+            const float* x,
+            faiss::idx_t k,
+            const faiss::idx_t* assign,
+            const float* centroid_dis,
+            float* distances,
+            faiss::idx_t* labels,
+            bool store_pairs,
+            const faiss::IVFSearchParameters* params = nullptr,
+            faiss::IndexIVFStats* stats = nullptr) const override;
+
     faiss::Index& as_faiss_index() override {
         return *this;
     }
@@ -72,12 +295,64 @@ class IndexIVFJecq : public IndexJecqBase, public faiss::IndexIVF {
         return *this;
     }
 
+    void decode_vectors(
+            faiss::idx_t n,
+            const uint8_t* codes,
+            const faiss::idx_t* list_nos,
+            float* x) const override;
+
+    /// Decodes the records of sa_encode: list number, then code
+    void sa_decode(faiss::idx_t n, const uint8_t* bytes, float* x)
+            const override;
+
     void reconstruct_from_offset(
             faiss::idx_t list_no,
             faiss::idx_t offset,
             float* recons) const override;
 
+    /// Decodes the vectors of each list that fall in [i0, i0 + ni) together
+    void reconstruct_n(faiss::idx_t i0, faiss::idx_t ni, float* recons)
+            const override;
+
+    /** In addition to the checks of IndexIVF (same type, coarse centroids
+     * and code size, no direct map), other must have the same feature tiers
+     * and quantizers, per list with per_list_features. The list layouts
+     * (split_codes, compress_ids) may differ.
+     */
+    void check_compatible_for_merge(const faiss::Index& otherIndex)
+            const override;
+
+    /** Moves the entries of other to the lists of this index without
+     * re-encoding them; other is left empty. add_id is added to the moved
+     * ids.
+     *
+     * IndexIVF moves the codes as returned by get_codes, which is not the
+     * code layout of SplitInvertedLists, VariableSizeInvertedLists or
+     * PQ4BlockInvertedLists.
+     */
+    void merge_from(faiss::Index& otherIndex, faiss::idx_t add_id) override;
+
+    /** Copies a subset of the entries to other, an index compatible for
+     * merge_from, as IndexIVF::copy_subset_to does.
+     *
+     * The codes of the split, variable-size and 4-bit block lists are copied
+     * through their record layout. The functions of the lists themselves,
+     * e.g. InvertedLists::merge_from, move whole lists as get_codes returns
+     * them: they must not be used on these lists, merge_from and
+     * copy_subset_to of the index handle them.
+     */
+    void copy_subset_to(
+            faiss::IndexIVF& other,
+            faiss::InvertedLists::subset_type_t subset_type,
+            faiss::idx_t a1,
+            faiss::idx_t a2) const override;
+
+    /// IndexIVF::remove_ids reads the ids of a list through a pointer it
+    /// expects to see its own updates, which decoded compressed ids do not
+    size_t remove_ids(const faiss::IDSelector& sel) override;
+
     friend class IVFJecqScanner;
+    friend struct JecqIO;
 };
 
 } // namespace jecq
@@ -0,0 +1,344 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "index_ivf_jecq_fast_scan.h"
+#include "compressed_ids_inverted_lists.h"
+#include "distance_kernels.h"
+#include "feature_classifier.h"
+#include "id_selection.h"
+#include "pq4_block_inverted_lists.h"
+#include "split_inverted_lists.h"
+
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/hamming.h>
+
+namespace jecq {
+
+IndexIVFJecqFastScan::IndexIVFJecqFastScan()
+        : IndexIVFJecqFastScan(0, 1, 10, 0.05, 0.005, 50) {}
+
+IndexIVFJecqFastScan::IndexIVFJecqFastScan(
+        faiss::idx_t d,
+        faiss::idx_t nlist,
+        float pq_multiplier,
+        float th_high,
+        float th_mid,
+        int itq_iters)
+        : IndexIVFJecq(d, nlist, pq_multiplier, th_high, th_mid, itq_iters) {
+    this->pq_nbits = 4;
+}
+
+IndexIVFJecqFastScan::IndexIVFJecqFastScan(
+        faiss::Index* quantizer,
+        faiss::idx_t d,
+        faiss::idx_t nlist,
+        float pq_multiplier,
+        float th_high,
+        float th_mid,
+        int itq_iters)
+        : IndexIVFJecq(
+                  quantizer,
+                  d,
+                  nlist,
+                  pq_multiplier,
+                  th_high,
+                  th_mid,
+                  itq_iters) {
+    this->pq_nbits = 4;
+}
+
+struct IVFJecqFastScanScanner : faiss::InvertedListScanner {
+    const IndexIVFJecqFastScan* parent;
+    const float pq_multiplier;
+    const IDSelection selection;
+
+    size_t M = 0;
+    size_t pq_code_size = 0;
+    size_t itq_code_size = 0;
+
+    std::vector<float> q_pq;
+    std::vector<float> table;
+    std::vector<uint8_t> qtable;
+    float scale = 0;
+    float bias = 0;
+    /// by_residual: PQ term of the centroid of the current list
+    float list_bias = 0;
+
+    std::vector<float> itq_data;
+    std::vector<uint8_t> q_itq;
+    faiss::HammingComputerDefault hc;
+
+    /// lists stored in blocks, nullptr otherwise
+    const PQ4BlockInvertedLists* block_lists;
+
+    /// lists of any other layout: scratch block the PQ codes of their
+    /// entries are regrouped into
+    mutable std::vector<uint8_t> block;
+
+    /// lists with compressed ids, nullptr otherwise
+    const CompressedIdsInvertedLists* id_lists;
+
+    IVFJecqFastScanScanner(
+            const IndexIVFJecqFastScan* p,
+            bool store_pairs,
+            const faiss::IDSelector* sel,
+            float pq_multiplier)
+            : InvertedListScanner(store_pairs, sel),
+              parent(p),
+              pq_multiplier(pq_multiplier),
+              selection(sel),
+              block_lists(
+                      dynamic_cast<const PQ4BlockInvertedLists*>(p->invlists)),
+              id_lists(dynamic_cast<const CompressedIdsInvertedLists*>(
+                      p->invlists)) {
+        this->keep_max = true;
+        this->code_size = parent->code_size;
+
+        if (!parent->pq_features.empty()) {
+            M = parent->pq_quantizer.M;
+            pq_code_size = parent->pq_quantizer.code_size;
+        }
+        itq_code_size = parent->itq_quantizer.code_size;
+
+        q_pq.resize(parent->pq_features.size());
+        table.resize(M * parent->pq_quantizer.ksub);
+        qtable.resize(pq4_padded_M(M) * 16);
+        itq_data.resize(parent->itq_features.size());
+        q_itq.resize(itq_code_size);
+        if (!block_lists) {
+            block.resize(pq4_block_size(M));
+        }
+    }
+
+    void set_query(const float* query) override {
+        if (M > 0) {
+            filter_by_features(query, parent->pq_features, q_pq.data());
+            compute_scaled_inner_prod_table(
+                    parent->pq_quantizer,
+                    q_pq.data(),
+                    pq_multiplier,
+                    table.data());
+            pq4_quantize_table(table.data(), M, qtable.data(), &scale, &bias);
+        }
+
+        if (itq_code_size > 0) {
+            filter_by_features(query, parent->itq_features, itq_data.data());
+            parent->itq_quantizer.compute_codes(
+                    itq_data.data(), q_itq.data(), 1);
+            hc.set(q_itq.data(), itq_code_size);
+        }
+    }
+
+    void set_list(faiss::idx_t list_no, float /*coarse_dis*/) override {
+        this->list_no = list_no;
+        list_bias =
+                parent->get_list_pq_bias(q_pq.data(), pq_multiplier, list_no);
+    }
+
+    float itq_distance(const uint8_t* code) const {
+        return itq_code_size > 0
+                ? parent->itq_quantizer.get_inner_product_distance(
+                          hc.hamming(code + pq_code_size))
+                : 0.0f;
+    }
+
+    float distance_to_code(const uint8_t* code) const override {
+        float distance = 0;
+
+        if (M > 0) {
+            uint16_t accu = 0;
+            for (size_t m = 0; m < M; ++m) {
+                accu += qtable[m * 16 + ((code[m / 2] >> (4 * (m & 1))) & 15)];
+            }
+            pq4_distances_from_accu(&accu, 1, scale, bias, &distance);
+        }
+
+        return distance + itq_distance(code) + list_bias;
+    }
+
+    /// Result label of entry j, decoded from compressed lists without ids
+    faiss::idx_t label(const faiss::idx_t* ids, size_t j) const {
+        if (store_pairs) {
+            return faiss::lo_build(list_no, j);
+        }
+        return ids ? ids[j] : id_lists->get_id(list_no, j);
+    }
+
+    /** Scores the selected entries of a list block by block and passes each
+     * distance and entry to consume. Blocks without a selected entry are
+     * skipped.
+     *
+     * @param codes  blocks of PQ4BlockInvertedLists, records of code_size
+     *               bytes for the other lists
+     */
+    template <class Consume>
+    void scan_blocks(
+            size_t list_size,
+            const uint8_t* codes,
+            const faiss::idx_t* ids,
+            Consume&& consume) const {
+        constexpr size_t bs = pq4_block_vectors;
+        uint16_t accu[bs];
+        float distances[bs] = {};
+        int hamming[bs];
+        bool selected[bs];
+
+        const bool use_sel = !selection.selects_all();
+
+        for (size_t j0 = 0; j0 < list_size; j0 += bs) {
+            const size_t n = std::min(bs, list_size - j0);
+
+            size_t n_selected = n;
+            if (use_sel) {
+                n_selected = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    selected[i] = selection.is_member(ids[j0 + i]);
+                    n_selected += selected[i];
+                }
+                if (n_selected == 0) {
+                    continue;
+                }
+            }
+
+            const uint8_t* pq_block;
+            const uint8_t* itq_codes;
+            size_t itq_stride;
+            if (block_lists) {
+                const CodePackerJecqPQ4& packer = block_lists->packer;
+                pq_block = codes + (j0 / bs) * packer.block_size;
+                itq_codes = pq_block + packer.pq_block_size();
+                itq_stride = itq_code_size;
+            } else {
+                for (size_t i = 0; M > 0 && i < n; ++i) {
+                    pq4_set_code(
+                            M, codes + (j0 + i) * code_size, i, block.data());
+                }
+                pq_block = block.data();
+                itq_codes = codes + j0 * code_size + pq_code_size;
+                itq_stride = code_size;
+            }
+
+            if (M > 0) {
+                pq4_accumulate_block(qtable.data(), M, pq_block, accu);
+                pq4_distances_from_accu(accu, n, scale, bias, distances);
+            }
+
+            if (itq_code_size > 0) {
+                hamming_distances(
+                        q_itq.data(),
+                        itq_codes,
+                        n,
+                        itq_code_size,
+                        itq_stride,
+                        hamming);
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                if (use_sel && !selected[i]) {
+                    continue;
+                }
+
+                const float itq_term = itq_code_size > 0
+                        ? parent->itq_quantizer.get_inner_product_distance(
+                                  hamming[i])
+                        : 0.0f;
+                consume(distances[i] + itq_term + list_bias, j0 + i);
+            }
+        }
+    }
+
+    size_t scan_codes(
+            size_t list_size,
+            const uint8_t* codes,
+            const faiss::idx_t* ids,
+            float* simi,
+            faiss::idx_t* idxi,
+            size_t k) const override {
+        size_t nup = 0;
+
+        scan_blocks(list_size, codes, ids, [&](float distance, size_t j) {
+            if (simi[0] < distance) {
+                faiss::minheap_replace_top(
+                        k, simi, idxi, distance, label(ids, j));
+                nup++;
+            }
+        });
+
+        return nup;
+    }
+
+    void scan_codes_range(
+            size_t list_size,
+            const uint8_t* codes,
+            const faiss::idx_t* ids,
+            float radius,
+            faiss::RangeQueryResult& result) const override {
+        scan_blocks(list_size, codes, ids, [&](float distance, size_t j) {
+            if (distance > radius) {
+                result.add(distance, label(ids, j));
+            }
+        });
+    }
+};
+
+void IndexIVFJecqFastScan::train(faiss::idx_t n, const float* x) {
+    FAISS_THROW_IF_NOT_MSG(
+            !split_codes, "IndexIVFJecqFastScan does not support split_codes");
+    FAISS_THROW_IF_NOT_MSG(
+            !per_list_features,
+            "IndexIVFJecqFastScan does not support per_list_features");
+    IndexIVFJecq::train(n, x);
+}
+
+faiss::InvertedLists* IndexIVFJecqFastScan::create_invlists() const {
+    if (compress_ids) {
+        return IndexIVFJecq::create_invlists();
+    }
+
+    const size_t M = pq_features.empty() ? 0 : pq_quantizer.M;
+    return new PQ4BlockInvertedLists(nlist, M, itq_quantizer.code_size);
+}
+
+faiss::CodePacker* IndexIVFJecqFastScan::get_CodePacker() const {
+    if (const auto* lists =
+                dynamic_cast<const PQ4BlockInvertedLists*>(invlists)) {
+        return lists->packer.clone();
+    }
+    return IndexIVFJecq::get_CodePacker();
+}
+
+faiss::InvertedListScanner* IndexIVFJecqFastScan::get_InvertedListScanner(
+        bool store_pairs,
+        const faiss::IDSelector* sel,
+        const faiss::IVFSearchParameters* params) const {
+    FAISS_THROW_IF_NOT_MSG(
+            !dynamic_cast<const SplitInvertedLists*>(invlists),
+            "IndexIVFJecqFastScan does not support split_codes");
+    FAISS_THROW_IF_NOT_MSG(
+            list_tiers.empty(),
+            "IndexIVFJecqFastScan does not support per_list_features");
+    return new IVFJecqFastScanScanner(
+            this, store_pairs, sel, get_search_pq_multiplier(params));
+}
+
+} // namespace jecq
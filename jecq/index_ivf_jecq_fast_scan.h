@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "index_ivf_jecq.h"
+
+namespace jecq {
+
+/** Variant of IndexIVFJecq with 4-bit PQ codes for the high variance
+ * features.
+ *
+ * The default in-memory lists store their entries in blocks of 32, in the
+ * layout of IndexJecqFastScan (see PQ4BlockInvertedLists), and the scanner
+ * passes the blocks to the SIMD kernels as they are. Lists of another type,
+ * e.g. on disk or with compress_ids, keep the IndexIVFJecq record layout
+ * with the PQ part halved and are regrouped into blocks while scanning. Both
+ * indices score with the same byte-quantized lookup table, so they return
+ * the same distances.
+ */
+class IndexIVFJecqFastScan : public IndexIVFJecq {
+   public:
+    IndexIVFJecqFastScan();
+
+    IndexIVFJecqFastScan(
+            faiss::idx_t d,
+            faiss::idx_t nlist,
+            float pq_multiplier,
+            float th_high,
+            float th_mid,
+            int itq_iters = 50);
+
+    /// Uses the given coarse quantizer, see IndexIVFJecq
+    IndexIVFJecqFastScan(
+            faiss::Index* quantizer,
+            faiss::idx_t d,
+            faiss::idx_t nlist,
+            float pq_multiplier,
+            float th_high,
+            float th_mid,
+            int itq_iters = 50);
+
+    /// Throws for the layouts the scanner cannot read: split_codes and
+    /// per_list_features
+    void train(faiss::idx_t n, const float* x) override;
+
+    /// Packer of the lists in PQ4BlockInvertedLists, flat otherwise
+    faiss::CodePacker* get_CodePacker() const override;
+
+    faiss::InvertedListScanner* get_InvertedListScanner(
+            bool store_pairs,
+            const faiss::IDSelector* sel = nullptr,
+            const faiss::IVFSearchParameters* params = nullptr) const override;
+
+   protected:
+    /// PQ4BlockInvertedLists, or CompressedIdsInvertedLists with
+    /// compress_ids
+    faiss::InvertedLists* create_invlists() const override;
+
+    friend struct IVFJecqFastScanScanner;
+};
+
+} // namespace jecq
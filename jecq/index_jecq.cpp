@@ -19,22 +19,115 @@
 // SOFTWARE.
 
 #include "index_jecq.h"
+#include "distance_kernels.h"
 #include "feature_classifier.h"
+#include "fused_scan.h"
 
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/hamming.h>
 #include <faiss/utils/utils.h>
 
+#include <algorithm>
+#include <omp.h>
+
 #include <cinttypes>
-#include <memory>
-#include <numeric>
-#include <queue>
+#include <cstring>
+#include <utility>
 
 namespace {
 
-void fill_with_labels(faiss::idx_t ntotal, std::vector<faiss::idx_t>* vec) {
-    assert(ntotal == 0 ? vec->empty() : (vec->size() % ntotal == 0));
+/// Below this many codes per thread, a search is only parallelized over queries
+constexpr faiss::idx_t min_codes_per_thread = 1 << 14;
+
+/// Keeps the k best scores in a min-heap
+struct HeapHandler {
+    static constexpr bool prunes = false;
+
+    faiss::idx_t k;
+    float* heap_distances;
+    faiss::idx_t* heap_labels;
+
+    float threshold() const {
+        return heap_distances[0];
+    }
+
+    void add(float distance, faiss::idx_t j) {
+        if (heap_distances[0] < distance) {
+            faiss::minheap_replace_top(
+                    k, heap_distances, heap_labels, distance, j);
+        }
+    }
+};
+
+/// Keeps the scores above a radius
+struct RangeHandler {
+    static constexpr bool prunes = true;
+
+    float radius;
+    faiss::RangeQueryResult& qres;
+
+    float threshold() const {
+        return radius;
+    }
+
+    void add(float distance, faiss::idx_t j) {
+        if (distance > radius) {
+            qres.add(distance, j);
+        }
+    }
+};
+
+/** Keeps, for each query, the pool_size selected codes with the smallest
+ * Hamming distance to the query code in a max-heap of (hamming, label).
+ *
+ * Contiguous codes without a selection go through faiss::hammings_knn_hc;
+ * otherwise the codes are scanned with a stride.
+ */
+void hamming_pool(
+        faiss::idx_t n,
+        const uint8_t* query_codes,
+        faiss::idx_t ntotal,
+        const jecq::IndexJecq::TierCodes& codes,
+        const jecq::IDSelection* selection,
+        faiss::idx_t pool_size,
+        int* pool_hammings,
+        faiss::idx_t* pool_labels) {
+    if (codes.stride == codes.code_size && !selection) {
+        faiss::int_maxheap_array_t pool = {
+                size_t(n), size_t(pool_size), pool_labels, pool_hammings};
+
+        faiss::hammings_knn_hc(
+                &pool,
+                query_codes,
+                codes.data,
+                ntotal,
+                codes.code_size,
+                /*ordered=*/false);
+        return;
+    }
+
+#pragma omp parallel for if (n > 1)
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        int* heap_hammings = pool_hammings + pool_size * i;
+        faiss::idx_t* heap_labels = pool_labels + pool_size * i;
+
+        faiss::HammingComputerDefault hc(
+                query_codes + codes.code_size * i, codes.code_size);
+
+        faiss::maxheap_heapify(pool_size, heap_hammings, heap_labels);
+
+        for (faiss::idx_t j = 0; j < ntotal; ++j) {
+            if (selection && !selection->is_member(j)) {
+                continue;
+            }
 
-    for (faiss::idx_t i = 0; i < vec->size(); ++i) {
-        (*vec)[i] = i % ntotal;
+            const int hamming = hc.hamming(codes.get(j));
+
+            if (hamming < heap_hammings[0]) {
+                faiss::maxheap_replace_top(
+                        pool_size, heap_hammings, heap_labels, hamming, j);
+            }
+        }
     }
 }
 } // namespace
@@ -62,9 +155,256 @@ IndexJecq::IndexJecq(
     this->is_trained = false;
 }
 
+IndexJecq::TierCodes IndexJecq::get_pq_codes() const {
+    if (interleaved_codes) {
+        return {codes.data(), code_size, index_pq.code_size};
+    }
+
+    return {index_pq.codes.data(), index_pq.code_size, index_pq.code_size};
+}
+
+IndexJecq::TierCodes IndexJecq::get_itq_codes() const {
+    if (interleaved_codes) {
+        return {codes.data() + index_pq.code_size,
+                code_size,
+                index_itq.code_size};
+    }
+
+    return {index_itq.codes.data(), index_itq.code_size, index_itq.code_size};
+}
+
+void IndexJecq::set_interleaved_codes(bool interleaved) {
+    FAISS_THROW_IF_NOT_MSG(
+            ntotal == 0, "code layout can only change on an empty index");
+    interleaved_codes = interleaved;
+}
+
+bool IndexJecq::owns_codes() const {
+    if (interleaved_codes) {
+        return codes.is_owned;
+    }
+    return index_pq.codes.is_owned || index_itq.codes.is_owned;
+}
+
+void IndexJecq::encode_interleaved(
+        faiss::idx_t n,
+        const float* x,
+        uint8_t* records) const {
+    const size_t pq_code_size = index_pq.code_size;
+    const size_t itq_code_size = index_itq.code_size;
+
+    const faiss::idx_t bs = std::min<faiss::idx_t>(
+            faiss::product_quantizer_compute_codes_bs, n);
+
+    std::vector<float> pq_data(pq_features.size() * bs);
+    std::vector<float> itq_data(itq_features.size() * bs);
+    std::vector<uint8_t> pq_block(pq_code_size * bs);
+    std::vector<uint8_t> itq_block(itq_code_size * bs);
+
+    for (faiss::idx_t i0 = 0; i0 < n; i0 += bs) {
+        const auto actual_bs = std::min(bs, n - i0);
+        const float* xi = x + this->d * i0;
+
+        if (pq_code_size > 0) {
+            filter_by_features(
+                    actual_bs, d, xi, pq_features, pq_data.data());
+            index_pq.pq.compute_codes(
+                    pq_data.data(), pq_block.data(), actual_bs);
+        }
+
+        if (itq_code_size > 0) {
+            filter_by_features(
+                    actual_bs, d, xi, itq_features, itq_data.data());
+            index_itq.itq.compute_codes(
+                    itq_data.data(), itq_block.data(), actual_bs);
+        }
+
+        for (faiss::idx_t i = 0; i < actual_bs; ++i) {
+            uint8_t* record = records + (i0 + i) * code_size;
+            memcpy(record, pq_block.data() + i * pq_code_size, pq_code_size);
+            memcpy(record + pq_code_size,
+                   itq_block.data() + i * itq_code_size,
+                   itq_code_size);
+        }
+    }
+}
+
+void IndexJecq::decode_tiers(
+        faiss::idx_t n,
+        const TierCodes& pq_codes,
+        const TierCodes& itq_codes,
+        float* x) const {
+    // Codes are copied block by block into contiguous buffers, so that each
+    // tier of a block is decoded in one call.
+    constexpr faiss::idx_t block_size = 4096;
+
+    const size_t npq = pq_features.size();
+    const size_t nitq = itq_features.size();
+    const faiss::idx_t nblocks = (n + block_size - 1) / block_size;
+
+    std::fill_n(x, n * d, 0.0f);
+
+#pragma omp parallel if (nblocks > 1)
+    {
+        std::vector<uint8_t> pq_block(block_size * pq_codes.code_size);
+        std::vector<uint8_t> itq_block(block_size * itq_codes.code_size);
+        std::vector<float> pq_data(block_size * npq);
+        std::vector<float> itq_data(block_size * nitq);
+
+#pragma omp for schedule(dynamic)
+        for (faiss::idx_t b = 0; b < nblocks; ++b) {
+            const faiss::idx_t i0 = b * block_size;
+            const faiss::idx_t bs = std::min(block_size, n - i0);
+            float* xb = x + i0 * d;
+
+            if (pq_codes.code_size > 0) {
+                for (faiss::idx_t i = 0; i < bs; ++i) {
+                    memcpy(pq_block.data() + i * pq_codes.code_size,
+                           pq_codes.get(i0 + i),
+                           pq_codes.code_size);
+                }
+                index_pq.pq.decode(pq_block.data(), pq_data.data(), bs);
+                scatter_by_features(bs, d, pq_data.data(), pq_features, xb);
+            }
+
+            if (itq_codes.code_size > 0) {
+                for (faiss::idx_t i = 0; i < bs; ++i) {
+                    memcpy(itq_block.data() + i * itq_codes.code_size,
+                           itq_codes.get(i0 + i),
+                           itq_codes.code_size);
+                }
+                index_itq.itq.decode(itq_block.data(), itq_data.data(), bs);
+                scatter_by_features(bs, d, itq_data.data(), itq_features, xb);
+            }
+        }
+    }
+}
+
+size_t IndexJecq::sa_code_size() const {
+    return code_size;
+}
+
+void IndexJecq::sa_encode(faiss::idx_t n, const float* x, uint8_t* bytes)
+        const {
+    FAISS_THROW_IF_NOT(is_trained);
+    encode_interleaved(n, x, bytes);
+}
+
+void IndexJecq::sa_decode(faiss::idx_t n, const uint8_t* bytes, float* x)
+        const {
+    FAISS_THROW_IF_NOT(is_trained);
+    const size_t pq_code_size = index_pq.code_size;
+    decode_tiers(
+            n,
+            {bytes, code_size, pq_code_size},
+            {bytes + pq_code_size, code_size, index_itq.code_size},
+            x);
+}
+
+void IndexJecq::reconstruct(faiss::idx_t key, float* recons) const {
+    reconstruct_n(key, 1, recons);
+}
+
+void IndexJecq::reconstruct_n(faiss::idx_t i0, faiss::idx_t ni, float* recons)
+        const {
+    FAISS_THROW_IF_NOT(ni == 0 || (i0 >= 0 && i0 + ni <= ntotal));
+
+    TierCodes pq_codes = get_pq_codes();
+    TierCodes itq_codes = get_itq_codes();
+    pq_codes.data += i0 * pq_codes.stride;
+    itq_codes.data += i0 * itq_codes.stride;
+    decode_tiers(ni, pq_codes, itq_codes, recons);
+}
+
+void IndexJecq::check_compatible_for_merge(
+        const faiss::Index& otherIndex) const {
+    const auto* other = dynamic_cast<const IndexJecq*>(&otherIndex);
+    FAISS_THROW_IF_NOT_MSG(other, "can only merge another IndexJecq");
+    FAISS_THROW_IF_NOT_MSG(
+            is_trained && other->is_trained, "indexes must be trained");
+    FAISS_THROW_IF_NOT(other->d == d && other->code_size == code_size);
+
+    check_compatible_features(*other);
+    check_identical_pq(index_pq.pq, other->index_pq.pq);
+    index_itq.itq.check_identical(other->index_itq.itq);
+}
+
+void IndexJecq::merge_from(faiss::Index& otherIndex, faiss::idx_t add_id) {
+    FAISS_THROW_IF_NOT_MSG(add_id == 0, "cannot set ids in IndexJecq");
+    FAISS_THROW_IF_NOT_MSG(&otherIndex != this, "cannot merge with itself");
+    check_compatible_for_merge(otherIndex);
+
+    auto& other = static_cast<IndexJecq&>(otherIndex);
+    const faiss::idx_t n = other.ntotal;
+    if (n == 0) {
+        return;
+    }
+
+    const TierCodes pq_codes = other.get_pq_codes();
+    const TierCodes itq_codes = other.get_itq_codes();
+
+    if (interleaved_codes && other.interleaved_codes) {
+        codes.resize((ntotal + n) * code_size);
+        memcpy(codes.data() + ntotal * code_size,
+               other.codes.data(),
+               n * code_size);
+    } else if (interleaved_codes) {
+        codes.resize((ntotal + n) * code_size);
+        uint8_t* records = codes.data() + ntotal * code_size;
+        for (faiss::idx_t i = 0; i < n; ++i) {
+            memcpy(records + i * code_size,
+                   pq_codes.get(i),
+                   pq_codes.code_size);
+            memcpy(records + i * code_size + pq_codes.code_size,
+                   itq_codes.get(i),
+                   itq_codes.code_size);
+        }
+    } else {
+        // the sub-indexes take contiguous codes of their own tier
+        std::vector<uint8_t> tier_codes;
+        auto append_tier = [&](const TierCodes& tier,
+                               faiss::IndexFlatCodes& sub_index) {
+            if (tier.code_size == 0) {
+                return;
+            }
+            const uint8_t* data = tier.data;
+            if (tier.stride != tier.code_size) {
+                tier_codes.resize(n * tier.code_size);
+                for (faiss::idx_t i = 0; i < n; ++i) {
+                    memcpy(tier_codes.data() + i * tier.code_size,
+                           tier.get(i),
+                           tier.code_size);
+                }
+                data = tier_codes.data();
+            }
+            sub_index.add_sa_codes(n, data, nullptr);
+        };
+        append_tier(pq_codes, index_pq);
+        append_tier(itq_codes, index_itq);
+    }
+
+    ntotal += n;
+    other.reset();
+}
+
 void IndexJecq::add(faiss::idx_t n, const float* x) {
     FAISS_THROW_IF_NOT(is_trained);
 
+    if (interleaved_codes) {
+        const auto t0 = faiss::getmillisecs();
+
+        codes.resize((ntotal + n) * code_size);
+        encode_interleaved(n, x, codes.data() + ntotal * code_size);
+        ntotal += n;
+
+        if (verbose && n > 0) {
+            printf("Adding IndexJecq complete; total_ms = %.1f, interleaved\n",
+                   faiss::getmillisecs() - t0);
+        }
+
+        return;
+    }
+
     ntotal += n;
 
     const auto t0 = faiss::getmillisecs();
@@ -102,12 +442,22 @@ void IndexJecq::add(faiss::idx_t n, const float* x) {
                     ntotal * this->index_itq.code_size);
         }
 
-        std::vector<float> itq_row(itq_features.size());
+        const faiss::idx_t max_bs = faiss::product_quantizer_compute_codes_bs;
+        const auto usual_bs = std::min(max_bs, n);
+
+        std::vector<float> itq_data(itq_features.size() * usual_bs);
+
+        for (faiss::idx_t i = 0; i < n; i += usual_bs) {
+            const auto actual_bs = std::min(usual_bs, n - i);
 
-        for (faiss::idx_t i = 0; i < n; ++i) {
             filter_by_features(
-                    x + this->d * i, this->itq_features, itq_row.data());
-            this->index_itq.add(1, itq_row.data());
+                    actual_bs,
+                    d,
+                    x + this->d * i,
+                    this->itq_features,
+                    itq_data.data());
+
+            this->index_itq.add(actual_bs, itq_data.data());
         }
     }
 
@@ -121,6 +471,106 @@ void IndexJecq::add(faiss::idx_t n, const float* x) {
     }
 }
 
+void IndexJecq::compute_query_tables(
+        const float* pq_vector,
+        const float* itq_vector,
+        float pq_multiplier,
+        float* pq_table,
+        uint8_t* itq_code) const {
+    if (index_pq.code_size > 0) {
+        compute_scaled_inner_prod_table(
+                index_pq.pq, pq_vector, pq_multiplier, pq_table);
+    }
+
+    if (index_itq.code_size > 0) {
+        index_itq.itq.compute_codes(itq_vector, itq_code, 1);
+    }
+}
+
+namespace {
+
+/// Scan of the codes of an IndexJecq against one query
+QueryScan make_query_scan(
+        const IndexJecq::TierCodes& pq_codes,
+        const faiss::ProductQuantizer& pq,
+        const IndexJecq::TierCodes& itq_codes,
+        const ITQQuantizer& itq,
+        const float* pq_table,
+        float pq_upper,
+        const uint8_t* itq_code,
+        const IDSelection* selection) {
+    return {pq_codes.data,
+            pq_codes.stride,
+            pq_codes.code_size,
+            pq,
+            pq_table,
+            pq_upper,
+            0.0f,
+            itq_codes.data,
+            itq_codes.stride,
+            itq_codes.code_size,
+            itq,
+            itq_code,
+            selection,
+            nullptr};
+}
+
+} // namespace
+
+void IndexJecq::scan_codes(
+        faiss::idx_t j_begin,
+        faiss::idx_t j_end,
+        const float* pq_table,
+        const uint8_t* itq_code,
+        const IDSelection* selection,
+        faiss::idx_t k,
+        float* heap_distances,
+        faiss::idx_t* heap_labels) const {
+    HeapHandler handler = {k, heap_distances, heap_labels};
+
+    scan_tiers(
+            j_begin,
+            j_end,
+            make_query_scan(
+                    get_pq_codes(),
+                    index_pq.pq,
+                    get_itq_codes(),
+                    index_itq.itq,
+                    pq_table,
+                    0,
+                    itq_code,
+                    selection),
+            handler);
+}
+
+void IndexJecq::scan_codes_range(
+        faiss::idx_t j_begin,
+        faiss::idx_t j_end,
+        const float* pq_table,
+        const uint8_t* itq_code,
+        const IDSelection* selection,
+        float radius,
+        faiss::RangeQueryResult& qres) const {
+    const float pq_upper = index_pq.code_size > 0
+            ? pq_adc_upper_bound(pq_table, index_pq.pq.M, index_pq.pq.ksub)
+            : 0.0f;
+    RangeHandler handler = {radius, qres};
+
+    scan_tiers(
+            j_begin,
+            j_end,
+            make_query_scan(
+                    get_pq_codes(),
+                    index_pq.pq,
+                    get_itq_codes(),
+                    index_itq.itq,
+                    pq_table,
+                    pq_upper,
+                    itq_code,
+                    selection),
+            handler);
+}
+
 void IndexJecq::search(
         faiss::idx_t n,
         const float* x,
@@ -128,100 +578,389 @@ void IndexJecq::search(
         float* distances,
         faiss::idx_t* labels,
         const faiss::SearchParameters* params) const {
-    FAISS_THROW_IF_NOT_MSG(
-            !params, "search params not supported for this index");
     FAISS_THROW_IF_NOT(k > 0);
     FAISS_THROW_IF_NOT(is_trained);
 
-    std::vector<float> pq_distances(n * index_pq.ntotal, 0.0);
-    std::vector<faiss::idx_t> pq_labels(n * index_pq.ntotal, -1);
-
-    if (index_pq.ntotal > 0) {
-        const auto pq_vector = get_pq_vector(n, x);
-        index_pq.search(
-                n,
-                pq_vector.data(),
-                index_pq.ntotal,
-                pq_distances.data(),
-                pq_labels.data(),
-                nullptr);
-    } else {
-        fill_with_labels(this->ntotal, &pq_labels);
+    JecqSearchMode mode = this->search_mode;
+    float k_factor = this->prefilter_k_factor;
+    float multiplier = this->pq_multiplier;
+    const faiss::IDSelector* sel = nullptr;
+
+    if (params) {
+        const auto* jecq_params =
+                dynamic_cast<const SearchParametersJecq*>(params);
+        FAISS_THROW_IF_NOT_MSG(
+                jecq_params, "IndexJecq params have incorrect type");
+
+        if (jecq_params->search_mode != JecqSearchMode::IndexDefault) {
+            mode = jecq_params->search_mode;
+        }
+        if (jecq_params->prefilter_k_factor > 0) {
+            k_factor = jecq_params->prefilter_k_factor;
+        }
+        if (jecq_params->pq_multiplier > 0) {
+            multiplier = jecq_params->pq_multiplier;
+        }
+        sel = jecq_params->sel;
     }
 
-    std::vector<float> itq_distances(n * index_itq.ntotal, 0.0);
-    std::vector<faiss::idx_t> itq_labels(n * index_itq.ntotal, -1);
+    // Every query tests every vector, so a selector is evaluated once
+    // into a bitmap up front.
+    IDSelection selection(sel);
+    selection.materialize(this->ntotal);
+    const IDSelection* selection_ptr = sel ? &selection : nullptr;
 
-    if (index_itq.ntotal > 0) {
-        const auto itq_vector = get_itq_vector(n, x);
-        index_itq.search(
-                n,
-                itq_vector.data(),
-                index_itq.ntotal,
-                itq_distances.data(),
-                itq_labels.data(),
-                nullptr);
-    } else {
-        fill_with_labels(this->ntotal, &itq_labels);
+    const auto pq_vectors = get_pq_vector(n, x);
+    const auto itq_vectors = get_itq_vector(n, x);
+
+    // The prefilter only pays off when both tiers are present and the
+    // candidate pool is smaller than the database.
+    if (mode == JecqSearchMode::ITQPrefilter && index_pq.code_size > 0 &&
+        index_itq.code_size > 0) {
+        FAISS_THROW_IF_NOT_MSG(
+                k_factor >= 1, "prefilter_k_factor must be at least 1");
+
+        const auto pool_size = static_cast<faiss::idx_t>(k * k_factor);
+
+        if (pool_size < this->ntotal) {
+            search_itq_prefilter(
+                    n,
+                    pq_vectors.data(),
+                    itq_vectors.data(),
+                    multiplier,
+                    selection_ptr,
+                    k,
+                    pool_size,
+                    distances,
+                    labels);
+            return;
+        }
     }
 
-    std::vector<float> total_distances(this->ntotal, 0.0);
+    search_exhaustive(
+            n,
+            pq_vectors.data(),
+            itq_vectors.data(),
+            multiplier,
+            selection_ptr,
+            k,
+            distances,
+            labels);
+}
 
-    const auto distance_comparer = [&total_distances](
-                                           faiss::idx_t a, faiss::idx_t b) {
-        return total_distances[b] < total_distances[a];
-    };
+void IndexJecq::search_exhaustive(
+        faiss::idx_t n,
+        const float* pq_vectors,
+        const float* itq_vectors,
+        float pq_multiplier,
+        const IDSelection* selection,
+        faiss::idx_t k,
+        float* distances,
+        faiss::idx_t* labels) const {
+    const size_t pq_table_size = index_pq.pq.M * index_pq.pq.ksub;
+    const size_t itq_code_size = index_itq.code_size;
 
-    std::priority_queue<
-            faiss::idx_t,
-            std::vector<faiss::idx_t>,
-            decltype(distance_comparer)>
-            best_labels(distance_comparer);
+    const faiss::idx_t nt = omp_get_max_threads();
 
-    for (faiss::idx_t i = 0; i < n; ++i) {
-        std::fill(total_distances.begin(), total_distances.end(), 0.0);
-        assert(best_labels.empty());
+    if (n >= nt || this->ntotal < 2 * min_codes_per_thread) {
+        // Enough queries to keep all threads busy. Queries are grouped in
+        // tiles that scan the database together, block by block, so that
+        // each block is read from memory once per tile instead of once per
+        // query.
+        const faiss::idx_t tile_size = std::max<faiss::idx_t>(
+                1, std::min<faiss::idx_t>(scan_tile_queries, n / nt));
+        const faiss::idx_t n_tiles = (n + tile_size - 1) / tile_size;
+        const faiss::idx_t codes_per_block = std::max<size_t>(
+                256, scan_tile_code_bytes / std::max<size_t>(1, code_size));
+
+#pragma omp parallel if (n > 1)
+        {
+            std::vector<float> pq_tables(pq_table_size * tile_size);
+            std::vector<uint8_t> itq_tile_codes(itq_code_size * tile_size);
 
-        for (faiss::idx_t j = 0; j < this->index_pq.ntotal; ++j) {
-            const auto pq_index = this->index_pq.ntotal * i + j;
+#pragma omp for schedule(dynamic)
+            for (faiss::idx_t t = 0; t < n_tiles; ++t) {
+                const faiss::idx_t i0 = t * tile_size;
+                const faiss::idx_t i1 = std::min(i0 + tile_size, n);
 
-            auto& total_distance = total_distances[pq_labels[pq_index]];
+                for (faiss::idx_t i = i0; i < i1; ++i) {
+                    compute_query_tables(
+                            pq_vectors + pq_features.size() * i,
+                            itq_vectors + itq_features.size() * i,
+                            pq_multiplier,
+                            pq_tables.data() + pq_table_size * (i - i0),
+                            itq_tile_codes.data() + itq_code_size * (i - i0));
+                    faiss::minheap_heapify(
+                            k, distances + k * i, labels + k * i);
+                }
 
-            assert(total_distance == 0.0);
+                for (faiss::idx_t j0 = 0; j0 < this->ntotal;
+                     j0 += codes_per_block) {
+                    const auto j1 = std::min(j0 + codes_per_block, ntotal);
 
-            total_distance = pq_distances[pq_index] * this->pq_multiplier;
+                    for (faiss::idx_t i = i0; i < i1; ++i) {
+                        scan_codes(
+                                j0,
+                                j1,
+                                pq_tables.data() + pq_table_size * (i - i0),
+                                itq_tile_codes.data() +
+                                        itq_code_size * (i - i0),
+                                selection,
+                                k,
+                                distances + k * i,
+                                labels + k * i);
+                    }
+                }
+
+                for (faiss::idx_t i = i0; i < i1; ++i) {
+                    faiss::minheap_reorder(
+                            k, distances + k * i, labels + k * i);
+                }
+            }
         }
 
-        for (faiss::idx_t j = 0; j < this->index_itq.ntotal; ++j) {
-            const auto itq_index = this->index_itq.ntotal * i + j;
-            total_distances[itq_labels[itq_index]] += itq_distances[itq_index];
+        return;
+    }
+
+    // Few queries on a large database: split the database into contiguous
+    // slices, scan each slice into a thread-local heap and merge the heaps.
+    const faiss::idx_t n_slices =
+            std::min(nt, this->ntotal / min_codes_per_thread);
+
+    std::vector<float> pq_table(pq_table_size);
+    std::vector<uint8_t> itq_code(itq_code_size);
+    std::vector<float> slice_distances(n_slices * k);
+    std::vector<faiss::idx_t> slice_labels(n_slices * k);
+
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        float* heap_distances = distances + k * i;
+        faiss::idx_t* heap_labels = labels + k * i;
+
+        compute_query_tables(
+                pq_vectors + pq_features.size() * i,
+                itq_vectors + itq_features.size() * i,
+                pq_multiplier,
+                pq_table.data(),
+                itq_code.data());
+
+#pragma omp parallel for num_threads(n_slices)
+        for (faiss::idx_t s = 0; s < n_slices; ++s) {
+            float* slice_heap_distances = slice_distances.data() + k * s;
+            faiss::idx_t* slice_heap_labels = slice_labels.data() + k * s;
+
+            faiss::minheap_heapify(k, slice_heap_distances, slice_heap_labels);
+            scan_codes(
+                    this->ntotal * s / n_slices,
+                    this->ntotal * (s + 1) / n_slices,
+                    pq_table.data(),
+                    itq_code.data(),
+                    selection,
+                    k,
+                    slice_heap_distances,
+                    slice_heap_labels);
         }
 
-        for (faiss::idx_t t = 0; t < this->ntotal; ++t) {
-            if (best_labels.size() < k) {
-                best_labels.push(t);
+        faiss::minheap_heapify(k, heap_distances, heap_labels);
+
+        for (faiss::idx_t t = 0; t < n_slices * k; ++t) {
+            if (slice_labels[t] >= 0 &&
+                heap_distances[0] < slice_distances[t]) {
+                faiss::minheap_replace_top(
+                        k,
+                        heap_distances,
+                        heap_labels,
+                        slice_distances[t],
+                        slice_labels[t]);
             }
+        }
+
+        faiss::minheap_reorder(k, heap_distances, heap_labels);
+    }
+}
+
+void IndexJecq::range_search(
+        faiss::idx_t n,
+        const float* x,
+        float radius,
+        faiss::RangeSearchResult* result,
+        const faiss::SearchParameters* params) const {
+    FAISS_THROW_IF_NOT(is_trained);
 
-            else if (distance_comparer(t, best_labels.top())) {
-                best_labels.pop();
-                best_labels.push(t);
+    float multiplier = this->pq_multiplier;
+    const faiss::IDSelector* sel = nullptr;
+
+    if (params) {
+        const auto* jecq_params =
+                dynamic_cast<const SearchParametersJecq*>(params);
+        FAISS_THROW_IF_NOT_MSG(
+                jecq_params, "IndexJecq params have incorrect type");
+
+        if (jecq_params->pq_multiplier > 0) {
+            multiplier = jecq_params->pq_multiplier;
+        }
+        sel = jecq_params->sel;
+    }
+
+    IDSelection selection(sel);
+    selection.materialize(this->ntotal);
+    const IDSelection* selection_ptr = sel ? &selection : nullptr;
+
+    const auto pq_vectors = get_pq_vector(n, x);
+    const auto itq_vectors = get_itq_vector(n, x);
+
+    const size_t pq_table_size = index_pq.pq.M * index_pq.pq.ksub;
+    const size_t itq_code_size = index_itq.code_size;
+
+    const faiss::idx_t nt = omp_get_max_threads();
+
+    if (n >= nt || this->ntotal < 2 * min_codes_per_thread) {
+        // Parallel over queries: each thread streams its results into a
+        // partial result, copied into `result` once all queries are done.
+#pragma omp parallel if (n > 1)
+        {
+            faiss::RangeSearchPartialResult pres(result);
+            std::vector<float> pq_table(pq_table_size);
+            std::vector<uint8_t> itq_code(itq_code_size);
+
+#pragma omp for schedule(dynamic)
+            for (faiss::idx_t i = 0; i < n; ++i) {
+                compute_query_tables(
+                        pq_vectors.data() + pq_features.size() * i,
+                        itq_vectors.data() + itq_features.size() * i,
+                        multiplier,
+                        pq_table.data(),
+                        itq_code.data());
+                scan_codes_range(
+                        0,
+                        this->ntotal,
+                        pq_table.data(),
+                        itq_code.data(),
+                        selection_ptr,
+                        radius,
+                        pres.new_result(i));
             }
+
+            pres.finalize();
         }
 
-        const auto available_count = best_labels.size();
+        return;
+    }
+
+    // Few queries on a large database: each slice of the database is scanned
+    // into its own partial result. The partial results are merged in slice
+    // order, so the results of a query stay sorted by id.
+    const faiss::idx_t n_slices =
+            std::min(nt, this->ntotal / min_codes_per_thread);
 
-        for (faiss::idx_t t = 0; t < available_count; ++t) {
-            const auto top = best_labels.top();
-            const auto label_index = k * i + available_count - 1 - t;
+    std::vector<float> pq_tables(pq_table_size * n);
+    std::vector<uint8_t> itq_codes(itq_code_size * n);
 
-            labels[label_index] = top;
-            distances[label_index] = total_distances[top];
-            best_labels.pop();
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        compute_query_tables(
+                pq_vectors.data() + pq_features.size() * i,
+                itq_vectors.data() + itq_features.size() * i,
+                multiplier,
+                pq_tables.data() + pq_table_size * i,
+                itq_codes.data() + itq_code_size * i);
+    }
+
+    std::vector<faiss::RangeSearchPartialResult*> slice_results(n_slices);
+
+#pragma omp parallel for num_threads(n_slices)
+    for (faiss::idx_t s = 0; s < n_slices; ++s) {
+        auto* pres = new faiss::RangeSearchPartialResult(result);
+        slice_results[s] = pres;
+
+        for (faiss::idx_t i = 0; i < n; ++i) {
+            scan_codes_range(
+                    this->ntotal * s / n_slices,
+                    this->ntotal * (s + 1) / n_slices,
+                    pq_tables.data() + pq_table_size * i,
+                    itq_codes.data() + itq_code_size * i,
+                    selection_ptr,
+                    radius,
+                    pres->new_result(i));
         }
+    }
+
+    faiss::RangeSearchPartialResult::merge(slice_results);
+}
+
+void IndexJecq::search_itq_prefilter(
+        faiss::idx_t n,
+        const float* pq_vectors,
+        const float* itq_vectors,
+        float pq_multiplier,
+        const IDSelection* selection,
+        faiss::idx_t k,
+        faiss::idx_t pool_size,
+        float* distances,
+        faiss::idx_t* labels) const {
+    const auto pq_codes = get_pq_codes();
+    const auto itq_codes = get_itq_codes();
+
+    // Stage 1: shortlist pool_size candidates per query from the ITQ codes
+    std::vector<uint8_t> query_codes(n * itq_codes.code_size);
+    index_itq.itq.compute_codes(itq_vectors, query_codes.data(), n);
 
-        for (faiss::idx_t t = available_count; t < k; ++t) {
-            labels[k * i + t] = -1;
-            distances[k * i + t] = -std::numeric_limits<float>::infinity();
+    std::vector<faiss::idx_t> pool_labels(n * pool_size);
+    std::vector<int> pool_hammings(n * pool_size);
+
+    hamming_pool(
+            n,
+            query_codes.data(),
+            this->ntotal,
+            itq_codes,
+            selection,
+            pool_size,
+            pool_hammings.data(),
+            pool_labels.data());
+
+    // Stage 2: re-rank the candidates with the full Jecq score, reading PQ
+    // codes only for them and in increasing id order.
+#pragma omp parallel if (n > 1)
+    {
+        std::vector<float> pq_table(index_pq.pq.M * index_pq.pq.ksub);
+        std::vector<std::pair<faiss::idx_t, int>> candidates;
+        candidates.reserve(pool_size);
+
+#pragma omp for schedule(dynamic)
+        for (faiss::idx_t i = 0; i < n; ++i) {
+            float* heap_distances = distances + k * i;
+            faiss::idx_t* heap_labels = labels + k * i;
+
+            compute_scaled_inner_prod_table(
+                    index_pq.pq,
+                    pq_vectors + pq_features.size() * i,
+                    pq_multiplier,
+                    pq_table.data());
+
+            candidates.clear();
+            for (faiss::idx_t j = pool_size * i; j < pool_size * (i + 1);
+                 ++j) {
+                if (pool_labels[j] >= 0) {
+                    candidates.emplace_back(pool_labels[j], pool_hammings[j]);
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            faiss::minheap_heapify(k, heap_distances, heap_labels);
+
+            for (const auto& [label, hamming] : candidates) {
+                const float distance =
+                        pq_adc_distance(
+                                pq_table.data(),
+                                index_pq.pq.M,
+                                pq_codes.get(label)) +
+                        index_itq.itq.get_inner_product_distance(hamming);
+
+                if (heap_distances[0] < distance) {
+                    faiss::minheap_replace_top(
+                            k, heap_distances, heap_labels, distance, label);
+                }
+            }
+
+            faiss::minheap_reorder(k, heap_distances, heap_labels);
         }
     }
 }
@@ -229,6 +968,8 @@ void IndexJecq::search(
 void IndexJecq::reset() {
     index_pq.reset();
     index_itq.reset();
+    codes.clear();
+    ntotal = 0;
 }
 
 void IndexJecq::train(faiss::idx_t n, const float* x) {
@@ -278,6 +1019,8 @@ void IndexJecq::train(faiss::idx_t n, const float* x) {
         index_itq = IndexITQFlat();
     }
 
+    code_size = index_pq.code_size + index_itq.code_size;
+
     const auto t3 = faiss::getmillisecs();
 
     this->is_trained = true;
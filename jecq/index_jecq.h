@@ -22,25 +22,152 @@
 
 #pragma once
 
+#include "id_selection.h"
 #include "index_itq_flat.h"
 #include "index_jecq_base.h"
 
 #include <faiss/IndexPQ.h>
 #include <faiss/faiss/Index.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/maybe_owned_vector.h>
 
 #include <vector>
 
 namespace jecq {
 
+/// Strategies for scanning the codes of an IndexJecq
+enum class JecqSearchMode {
+    /// score the PQ and ITQ terms of every vector
+    Exhaustive,
+    /// shortlist candidates by ITQ Hamming distance, then re-rank them with
+    /// the full PQ + ITQ score
+    ITQPrefilter,
+    /// in SearchParametersJecq: keep the search mode of the index
+    IndexDefault,
+};
+
+/** Search parameters of IndexJecq, overriding the index defaults per call.
+ *
+ * Fields left at their defaults keep the values of the index, so parameters
+ * passed only to set sel do not change how the index searches.
+ */
+struct SearchParametersJecq : faiss::SearchParameters {
+    /// overrides the search_mode of the index unless IndexDefault
+    JecqSearchMode search_mode = JecqSearchMode::IndexDefault;
+
+    /// ITQPrefilter: candidate pool size as a multiple of k, overrides the
+    /// prefilter_k_factor of the index when positive
+    float prefilter_k_factor = 0;
+
+    /// overrides the pq_multiplier of the index when positive
+    float pq_multiplier = 0;
+};
+
 class IndexJecq : public IndexJecqBase, public faiss::Index {
+   public:
+    /// Codes of one tier: the code of vector j starts at data + j * stride
+    struct TierCodes {
+        const uint8_t* data;
+        size_t stride;
+        /// 0 when the tier has no features
+        size_t code_size;
+
+        const uint8_t* get(faiss::idx_t j) const {
+            return data + j * stride;
+        }
+    };
+
    private:
     faiss::IndexPQ index_pq;
     IndexITQFlat index_itq;
 
+    /// store codes as PQ + ITQ records in `codes` instead of in the
+    /// sub-indexes
+    bool interleaved_codes = false;
+
+    TierCodes get_pq_codes() const;
+    TierCodes get_itq_codes() const;
+
+    /// Encodes n vectors into records of code_size bytes
+    void encode_interleaved(faiss::idx_t n, const float* x, uint8_t* records)
+            const;
+
+    /// Decodes n vectors from their PQ and ITQ codes
+    void decode_tiers(
+            faiss::idx_t n,
+            const TierCodes& pq_codes,
+            const TierCodes& itq_codes,
+            float* x) const;
+
     std::vector<float> get_pq_vector(faiss::idx_t n, const float* x) const;
     std::vector<float> get_itq_vector(faiss::idx_t n, const float* x) const;
 
+    /// Builds the scaled PQ lookup table and the ITQ code of one query
+    void compute_query_tables(
+            const float* pq_vector,
+            const float* itq_vector,
+            float pq_multiplier,
+            float* pq_table,
+            uint8_t* itq_code) const;
+
+    void search_exhaustive(
+            faiss::idx_t n,
+            const float* pq_vectors,
+            const float* itq_vectors,
+            float pq_multiplier,
+            const IDSelection* selection,
+            faiss::idx_t k,
+            float* distances,
+            faiss::idx_t* labels) const;
+
+    void search_itq_prefilter(
+            faiss::idx_t n,
+            const float* pq_vectors,
+            const float* itq_vectors,
+            float pq_multiplier,
+            const IDSelection* selection,
+            faiss::idx_t k,
+            faiss::idx_t pool_size,
+            float* distances,
+            faiss::idx_t* labels) const;
+
+    /// Scores the selected vectors of [j_begin, j_end) into a min-heap of
+    /// size k; a null selection selects all of them
+    void scan_codes(
+            faiss::idx_t j_begin,
+            faiss::idx_t j_end,
+            const float* pq_table,
+            const uint8_t* itq_code,
+            const IDSelection* selection,
+            faiss::idx_t k,
+            float* heap_distances,
+            faiss::idx_t* heap_labels) const;
+
+    /// Adds the selected vectors of [j_begin, j_end) scoring above radius to
+    /// qres
+    void scan_codes_range(
+            faiss::idx_t j_begin,
+            faiss::idx_t j_end,
+            const float* pq_table,
+            const uint8_t* itq_code,
+            const IDSelection* selection,
+            float radius,
+            faiss::RangeQueryResult& qres) const;
+
    public:
+    /// default search mode, can be overridden with SearchParametersJecq;
+    /// IndexDefault scans exhaustively
+    JecqSearchMode search_mode = JecqSearchMode::Exhaustive;
+
+    /// default candidate pool size of ITQPrefilter as a multiple of k
+    float prefilter_k_factor = 10;
+
+    /// bytes per vector: PQ code followed by ITQ code
+    size_t code_size = 0;
+
+    /// interleaved layout only: encoded records, size ntotal * code_size
+    faiss::MaybeOwnedVector<uint8_t> codes;
+
     /** Constructor.
      *
      * @param d                    dimensionality of the input vectors
@@ -66,10 +193,67 @@ class IndexJecq : public IndexJecqBase, public faiss::Index {
             faiss::idx_t* labels,
             const faiss::SearchParameters* params) const override;
 
+    /** Finds all vectors whose score is above radius.
+     *
+     * Results are returned in increasing id order for each query.
+     */
+    void range_search(
+            faiss::idx_t n,
+            const float* x,
+            float radius,
+            faiss::RangeSearchResult* result,
+            const faiss::SearchParameters* params = nullptr) const override;
+
     void reset() override;
 
     void train(faiss::idx_t n, const float* x) override;
 
+    /// code_size: the records of sa_encode have the interleaved layout
+    size_t sa_code_size() const override;
+
+    void sa_encode(faiss::idx_t n, const float* x, uint8_t* bytes)
+            const override;
+
+    /** Decodes records of sa_encode.
+     *
+     * Each tier is decoded into its features, see ITQQuantizer::decode for
+     * the ITQ tier. The discarded features decode to 0.
+     */
+    void sa_decode(faiss::idx_t n, const uint8_t* bytes, float* x)
+            const override;
+
+    void reconstruct(faiss::idx_t key, float* recons) const override;
+
+    void reconstruct_n(faiss::idx_t i0, faiss::idx_t ni, float* recons)
+            const override;
+
+    /** Throws unless other is a trained IndexJecq with the same feature
+     * tiers and quantizers, whose codes can be appended without re-encoding.
+     * The code layouts may differ.
+     */
+    void check_compatible_for_merge(const faiss::Index& otherIndex)
+            const override;
+
+    /// Appends the codes of other, which is left empty; ids are sequential,
+    /// so add_id must be 0
+    void merge_from(faiss::Index& otherIndex, faiss::idx_t add_id = 0)
+            override;
+
+    /** Selects the code layout, only allowed on an empty index.
+     *
+     * The interleaved layout keeps the PQ and ITQ codes of a vector in one
+     * record, so a scan streams through a single buffer.
+     */
+    void set_interleaved_codes(bool interleaved);
+
+    bool is_interleaved_codes() const {
+        return interleaved_codes;
+    }
+
+    /// false when all code arrays are views, e.g. of a file mapped by
+    /// read_index
+    bool owns_codes() const;
+
     faiss::Index& as_faiss_index() override {
         return *this;
     }
@@ -77,5 +261,7 @@ class IndexJecq : public IndexJecqBase, public faiss::Index {
     const faiss::Index& as_faiss_index() const override {
         return *this;
     }
+
+    friend struct JecqIO;
 };
 } // namespace jecq
\ No newline at end of file
@@ -49,4 +49,23 @@ void IndexJecqBase::reclassify_features(faiss::idx_t n, const float* x) {
             &itq_features,
             &feature_variances);
 }
+
+void IndexJecqBase::check_compatible_features(
+        const IndexJecqBase& other) const {
+    FAISS_THROW_IF_NOT_MSG(
+            other.pq_features == pq_features &&
+                    other.itq_features == itq_features,
+            "indexes classify their features differently");
+}
+
+void check_identical_pq(
+        const faiss::ProductQuantizer& a,
+        const faiss::ProductQuantizer& b) {
+    FAISS_THROW_IF_NOT_MSG(
+            a.d == b.d && a.M == b.M && a.nbits == b.nbits,
+            "PQ quantizers have different parameters");
+    FAISS_THROW_IF_NOT_MSG(
+            a.centroids == b.centroids,
+            "PQ quantizers have different centroids");
+}
 } // namespace jecq
\ No newline at end of file
@@ -24,6 +24,7 @@
 
 #include <faiss/Index.h>
 #include <faiss/MetricType.h>
+#include <faiss/impl/ProductQuantizer.h>
 
 #include <vector>
 
@@ -39,6 +40,9 @@ class IndexJecqBase {
 
     void reclassify_features(faiss::idx_t n, const float* x);
 
+    /// Throws unless other splits the features into the same tiers
+    void check_compatible_features(const IndexJecqBase& other) const;
+
    public:
     bool reclassify_features_when_training = true;
 
@@ -50,6 +54,13 @@ class IndexJecqBase {
     virtual const faiss::Index& as_faiss_index() const = 0;
 
     virtual ~IndexJecqBase() = default;
+
+    friend struct JecqIO;
 };
 
+/// Throws unless a and b encode every vector to the same code
+void check_identical_pq(
+        const faiss::ProductQuantizer& a,
+        const faiss::ProductQuantizer& b);
+
 } // namespace jecq
\ No newline at end of file
@@ -0,0 +1,290 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "index_jecq_fast_scan.h"
+#include "distance_kernels.h"
+#include "feature_classifier.h"
+#include "id_selection.h"
+#include "index_jecq.h"
+
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/hamming.h>
+#include <faiss/utils/utils.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+namespace jecq {
+
+IndexJecqFastScan::IndexJecqFastScan()
+        : IndexJecqFastScan(0, 10.0, 0.05, 0.005) {}
+
+IndexJecqFastScan::IndexJecqFastScan(
+        faiss::idx_t d,
+        float pq_multiplier,
+        float th_high,
+        float th_mid,
+        int itq_iters)
+        : IndexJecqBase(pq_multiplier, th_high, th_mid),
+          Index(d, faiss::MetricType::METRIC_INNER_PRODUCT),
+          itq_iters(itq_iters) {
+    this->is_trained = false;
+}
+
+size_t IndexJecqFastScan::get_pq_M() const {
+    return pq_features.empty() ? 0 : pq_quantizer.M;
+}
+
+void IndexJecqFastScan::add(faiss::idx_t n, const float* x) {
+    FAISS_THROW_IF_NOT(is_trained);
+
+    const auto t0 = faiss::getmillisecs();
+
+    const size_t M = get_pq_M();
+    const size_t block_size = pq4_block_size(M);
+    const size_t itq_code_size = itq_quantizer.code_size;
+
+    const faiss::idx_t bs = std::min<faiss::idx_t>(
+            faiss::product_quantizer_compute_codes_bs, n);
+
+    std::vector<float> pq_data(pq_features.size() * bs);
+    std::vector<float> itq_data(itq_features.size() * bs);
+    std::vector<uint8_t> pq_block(pq_quantizer.code_size * bs);
+
+    // New blocks are zero-filled, the last partial block is completed
+    const size_t nblocks = (ntotal + n + pq4_block_vectors - 1) /
+            pq4_block_vectors;
+    pq_codes.resize(nblocks * block_size);
+    itq_codes.resize((ntotal + n) * itq_code_size);
+
+    for (faiss::idx_t i0 = 0; i0 < n; i0 += bs) {
+        const auto actual_bs = std::min(bs, n - i0);
+        const float* xi = x + this->d * i0;
+
+        if (M > 0) {
+            filter_by_features(actual_bs, d, xi, pq_features, pq_data.data());
+            pq_quantizer.compute_codes(
+                    pq_data.data(), pq_block.data(), actual_bs);
+
+            for (faiss::idx_t i = 0; i < actual_bs; ++i) {
+                const faiss::idx_t j = ntotal + i0 + i;
+                pq4_set_code(
+                        M,
+                        pq_block.data() + i * pq_quantizer.code_size,
+                        j % pq4_block_vectors,
+                        pq_codes.data() + (j / pq4_block_vectors) * block_size);
+            }
+        }
+
+        if (itq_code_size > 0) {
+            filter_by_features(
+                    actual_bs, d, xi, itq_features, itq_data.data());
+            itq_quantizer.compute_codes(
+                    itq_data.data(),
+                    itq_codes.data() + (ntotal + i0) * itq_code_size,
+                    actual_bs);
+        }
+    }
+
+    ntotal += n;
+
+    if (verbose && n > 0) {
+        printf("Adding IndexJecqFastScan complete; total_ms = %.1f\n",
+               faiss::getmillisecs() - t0);
+    }
+}
+
+void IndexJecqFastScan::search_one(
+        const float* pq_vector,
+        const float* itq_vector,
+        float pq_multiplier,
+        const IDSelection* selection,
+        faiss::idx_t k,
+        float* heap_distances,
+        faiss::idx_t* heap_labels) const {
+    const size_t M = get_pq_M();
+    const size_t block_size = pq4_block_size(M);
+    const size_t itq_code_size = itq_quantizer.code_size;
+
+    std::vector<uint8_t> qtable(pq4_padded_M(M) * 16);
+    float scale = 0, bias = 0;
+
+    if (M > 0) {
+        std::vector<float> table(M * pq_quantizer.ksub);
+        compute_scaled_inner_prod_table(
+                pq_quantizer, pq_vector, pq_multiplier, table.data());
+        pq4_quantize_table(table.data(), M, qtable.data(), &scale, &bias);
+    }
+
+    std::vector<uint8_t> itq_code(itq_code_size);
+    faiss::HammingComputerDefault hc;
+
+    if (itq_code_size > 0) {
+        itq_quantizer.compute_codes(itq_vector, itq_code.data(), 1);
+        hc.set(itq_code.data(), itq_code_size);
+    }
+
+    uint16_t accu[pq4_block_vectors];
+    float block_distances[pq4_block_vectors] = {};
+
+    for (faiss::idx_t j0 = 0; j0 < ntotal; j0 += pq4_block_vectors) {
+        const auto j1 = std::min<faiss::idx_t>(j0 + pq4_block_vectors, ntotal);
+
+        if (M > 0) {
+            pq4_accumulate_block(
+                    qtable.data(),
+                    M,
+                    pq_codes.data() + (j0 / pq4_block_vectors) * block_size,
+                    accu);
+            pq4_distances_from_accu(
+                    accu, j1 - j0, scale, bias, block_distances);
+        }
+
+        for (faiss::idx_t j = j0; j < j1; ++j) {
+            if (selection && !selection->is_member(j)) {
+                continue;
+            }
+
+            float distance = block_distances[j - j0];
+
+            if (itq_code_size > 0) {
+                distance += itq_quantizer.get_inner_product_distance(
+                        hc.hamming(itq_codes.data() + j * itq_code_size));
+            }
+
+            if (heap_distances[0] < distance) {
+                faiss::minheap_replace_top(
+                        k, heap_distances, heap_labels, distance, j);
+            }
+        }
+    }
+}
+
+void IndexJecqFastScan::search(
+        faiss::idx_t n,
+        const float* x,
+        faiss::idx_t k,
+        float* distances,
+        faiss::idx_t* labels,
+        const faiss::SearchParameters* params) const {
+    FAISS_THROW_IF_NOT(k > 0);
+    FAISS_THROW_IF_NOT(is_trained);
+
+    float multiplier = this->pq_multiplier;
+    const faiss::IDSelector* sel = nullptr;
+
+    if (params) {
+        const auto* jecq_params =
+                dynamic_cast<const SearchParametersJecq*>(params);
+        FAISS_THROW_IF_NOT_MSG(
+                jecq_params, "IndexJecqFastScan params have incorrect type");
+        FAISS_THROW_IF_NOT_MSG(
+                jecq_params->search_mode != JecqSearchMode::ITQPrefilter,
+                "IndexJecqFastScan does not support ITQPrefilter");
+
+        if (jecq_params->pq_multiplier > 0) {
+            multiplier = jecq_params->pq_multiplier;
+        }
+        sel = jecq_params->sel;
+    }
+
+    IDSelection selection(sel);
+    selection.materialize(this->ntotal);
+
+    const auto pq_vectors = get_filtered_features(n, d, x, pq_features);
+    const auto itq_vectors = get_filtered_features(n, d, x, itq_features);
+
+#pragma omp parallel for if (n > 1) schedule(dynamic)
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        float* heap_distances = distances + i * k;
+        faiss::idx_t* heap_labels = labels + i * k;
+
+        faiss::minheap_heapify(k, heap_distances, heap_labels);
+
+        search_one(
+                pq_vectors.data() + i * pq_features.size(),
+                itq_vectors.data() + i * itq_features.size(),
+                multiplier,
+                sel ? &selection : nullptr,
+                k,
+                heap_distances,
+                heap_labels);
+
+        faiss::minheap_reorder(k, heap_distances, heap_labels);
+    }
+}
+
+void IndexJecqFastScan::reset() {
+    pq_codes.clear();
+    itq_codes.clear();
+    ntotal = 0;
+}
+
+void IndexJecqFastScan::train(faiss::idx_t n, const float* x) {
+    const auto t0 = faiss::getmillisecs();
+
+    if (verbose) {
+        printf("Training IndexJecqFastScan with %d features on %" PRId64
+               " vectors\n ",
+               this->d,
+               n);
+    }
+
+    if (this->reclassify_features_when_training) {
+        this->reclassify_features(n, x);
+    }
+
+    const auto t1 = faiss::getmillisecs();
+
+    if (!pq_features.empty()) {
+        const int pq_nbits = 4;
+        pq_quantizer = faiss::ProductQuantizer(
+                pq_features.size(), pq_features.size(), pq_nbits);
+        const auto pq_data = get_filtered_features(n, d, x, pq_features);
+        pq_quantizer.train(n, pq_data.data());
+    } else {
+        pq_quantizer = faiss::ProductQuantizer();
+    }
+
+    const auto t2 = faiss::getmillisecs();
+
+    if (!itq_features.empty()) {
+        itq_quantizer = ITQQuantizer(itq_features.size(), itq_iters);
+        const auto itq_data = get_filtered_features(n, d, x, itq_features);
+        itq_quantizer.train(n, itq_data.data());
+    } else {
+        itq_quantizer = ITQQuantizer();
+    }
+
+    const auto t3 = faiss::getmillisecs();
+
+    this->is_trained = true;
+
+    if (verbose) {
+        printf("Training IndexJecqFastScan complete; total_ms = %.1f, classification_ms=%.1f, pq_ms=%.1f, itq_ms=%.1f\n",
+               t3 - t0,
+               t1 - t0,
+               t2 - t1,
+               t3 - t2);
+    }
+}
+
+} // namespace jecq
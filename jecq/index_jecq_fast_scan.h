@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "id_selection.h"
+#include "index_jecq_base.h"
+#include "itq_quantizer.h"
+
+#include <faiss/faiss/Index.h>
+#include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/maybe_owned_vector.h>
+
+namespace jecq {
+
+/** Variant of IndexJecq with 4-bit PQ codes for the high variance features.
+ *
+ * PQ codes are stored in blocks of 32 vectors (see pq4_block_size) and
+ * scored with a byte-quantized lookup table, in registers. The ITQ term is
+ * added per block while it is still in cache. Distances are approximate up
+ * to the quantization of the table.
+ */
+class IndexJecqFastScan : public IndexJecqBase, public faiss::Index {
+   private:
+    int itq_iters;
+    faiss::ProductQuantizer pq_quantizer;
+    ITQQuantizer itq_quantizer;
+
+    /// Number of PQ sub-quantizers, 0 without high variance features
+    size_t get_pq_M() const;
+
+    /// Scores the selected vectors for one query into a min-heap of size k;
+    /// a null selection selects all of them
+    void search_one(
+            const float* pq_vector,
+            const float* itq_vector,
+            float pq_multiplier,
+            const IDSelection* selection,
+            faiss::idx_t k,
+            float* heap_distances,
+            faiss::idx_t* heap_labels) const;
+
+   public:
+    /// PQ codes, ceil(ntotal / 32) blocks of pq4_block_size(M) bytes
+    faiss::MaybeOwnedVector<uint8_t> pq_codes;
+
+    /// ITQ codes, ntotal * itq code size bytes
+    faiss::MaybeOwnedVector<uint8_t> itq_codes;
+
+    /** Constructor.
+     *
+     * @param d                    dimensionality of the input vectors
+     * @param pq_multiplier        PQ Multiplier
+     * @param th_high              threshold for high variance features
+     * @param th_mid               threshold for mid variance features
+     * @param itq_iters            number of ITQ training iterations
+     */
+    explicit IndexJecqFastScan(
+            faiss::idx_t d,
+            float pq_multiplier,
+            float th_high,
+            float th_mid,
+            int itq_iters = 50);
+
+    IndexJecqFastScan();
+
+    void add(faiss::idx_t n, const float* x) override;
+
+    /// params must be SearchParametersJecq: sel and pq_multiplier apply,
+    /// the ITQPrefilter search mode is rejected
+    void search(
+            faiss::idx_t n,
+            const float* x,
+            faiss::idx_t k,
+            float* distances,
+            faiss::idx_t* labels,
+            const faiss::SearchParameters* params) const override;
+
+    void reset() override;
+
+    void train(faiss::idx_t n, const float* x) override;
+
+    faiss::Index& as_faiss_index() override {
+        return *this;
+    }
+
+    const faiss::Index& as_faiss_index() const override {
+        return *this;
+    }
+
+    friend struct JecqIO;
+};
+} // namespace jecq
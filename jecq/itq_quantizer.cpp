@@ -20,9 +20,13 @@
 
 #include "itq_quantizer.h"
 
+#include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/hamming.h>
 #include <faiss/utils/hamming_distance/common.h>
 
+#include <cmath>
+#include <vector>
+
 namespace jecq {
 float ITQQuantizer::get_inner_product_distance(
         const uint8_t* a,
@@ -56,10 +60,34 @@ void ITQQuantizer::compute_codes(const float* x, uint8_t* codes, size_t n)
     faiss::fvecs2bitvecs(x_proj.data(), codes, dim, n);
 }
 
-void ITQQuantizer::decode(const uint8_t* code, float* x, size_t n) const {
-    std::vector<float> x_proj(n * this->code_size * 8);
-    faiss::bitvecs2fvecs(code, x_proj.data(), this->code_size * 8, n);
+// The code holds the signs of the ITQ projection of the centered, L2
+// normalized vector. The unit vector of those signs is mapped back to the
+// input space.
+void ITQQuantizer::decode(const uint8_t* codes, float* x, size_t n) const {
+    const size_t dim = this->d;
+    const float bit_value = dim > 0 ? 1 / std::sqrt(float(dim)) : 0;
+
+    std::vector<float> x_proj(n * dim);
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t* code = codes + i * this->code_size;
+        for (size_t j = 0; j < dim; ++j) {
+            x_proj[i * dim + j] =
+                    (code[j >> 3] >> (j & 7)) & 1 ? bit_value : -bit_value;
+        }
+    }
+
+    itq_transform.pca_then_itq.transform_transpose(n, x_proj.data(), x);
+
+    const float* mean = itq_transform.mean.data();
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < dim; ++j) {
+            x[i * dim + j] += mean[j];
+        }
+    }
+}
 
-    itq_transform.reverse_transform(n, x_proj.data(), x);
+void ITQQuantizer::check_identical(const ITQQuantizer& other) const {
+    FAISS_THROW_IF_NOT_MSG(other.d == d, "ITQ quantizers differ in dimension");
+    itq_transform.check_identical(other.itq_transform);
 }
 } // namespace jecq
\ No newline at end of file
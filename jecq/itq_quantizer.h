@@ -59,10 +59,18 @@ class ITQQuantizer : public faiss::Quantizer {
     void compute_codes(const float* x, uint8_t* codes, size_t n) const override;
 
     /** Decode a set of vectors
+     *
+     * Only the direction of a vector around the training mean is encoded, so
+     * a vector decodes to the mean plus a unit vector.
      *
      * @param codes    input codes, size n * code_size
      * @param x        output vectors, size n * d
      */
-    void decode(const uint8_t* code, float* x, size_t n) const override;
+    void decode(const uint8_t* codes, float* x, size_t n) const override;
+
+    /// Throws unless other encodes every vector to the same code
+    void check_identical(const ITQQuantizer& other) const;
+
+    friend struct JecqIO;
 };
 } // namespace jecq
\ No newline at end of file
@@ -0,0 +1,208 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "pq4_block_inverted_lists.h"
+
+#include "distance_kernels.h"
+#include "index_io.h"
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/io_macros.h>
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <typeinfo>
+
+namespace jecq {
+
+CodePackerJecqPQ4::CodePackerJecqPQ4(size_t M, size_t itq_code_size)
+        : M(M), pq_code_size((M + 1) / 2), itq_code_size(itq_code_size) {
+    code_size = pq_code_size + itq_code_size;
+    nvec = pq4_block_vectors;
+    block_size = pq_block_size() + nvec * itq_code_size;
+}
+
+size_t CodePackerJecqPQ4::pq_block_size() const {
+    return M > 0 ? pq4_block_size(M) : 0;
+}
+
+void CodePackerJecqPQ4::pack_1(
+        const uint8_t* flat_code,
+        size_t offset,
+        uint8_t* block) const {
+    block += (offset / nvec) * block_size;
+    const size_t i = offset % nvec;
+
+    pq4_set_code(M, flat_code, i, block);
+    memcpy(block + pq_block_size() + i * itq_code_size,
+           flat_code + pq_code_size,
+           itq_code_size);
+}
+
+void CodePackerJecqPQ4::unpack_1(
+        const uint8_t* block,
+        size_t offset,
+        uint8_t* flat_code) const {
+    block += (offset / nvec) * block_size;
+    const size_t i = offset % nvec;
+
+    pq4_get_code(M, block, i, flat_code);
+    memcpy(flat_code + pq_code_size,
+           block + pq_block_size() + i * itq_code_size,
+           itq_code_size);
+}
+
+faiss::CodePacker* CodePackerJecqPQ4::clone() const {
+    return new CodePackerJecqPQ4(*this);
+}
+
+PQ4BlockInvertedLists::PQ4BlockInvertedLists(
+        size_t nlist,
+        size_t M,
+        size_t itq_code_size)
+        : InvertedLists(nlist, (M + 1) / 2 + itq_code_size),
+          packer(M, itq_code_size),
+          codes(nlist),
+          ids(nlist) {}
+
+size_t PQ4BlockInvertedLists::list_size(size_t list_no) const {
+    assert(list_no < nlist);
+    return ids[list_no].size();
+}
+
+const uint8_t* PQ4BlockInvertedLists::get_codes(size_t list_no) const {
+    assert(list_no < nlist);
+    return codes[list_no].data();
+}
+
+const faiss::idx_t* PQ4BlockInvertedLists::get_ids(size_t list_no) const {
+    assert(list_no < nlist);
+    return ids[list_no].data();
+}
+
+const uint8_t* PQ4BlockInvertedLists::get_single_code(
+        size_t list_no,
+        size_t offset) const {
+    assert(offset < list_size(list_no));
+    uint8_t* code = new uint8_t[code_size];
+    packer.unpack_1(codes[list_no].data(), offset, code);
+    return code;
+}
+
+void PQ4BlockInvertedLists::release_codes(
+        size_t list_no,
+        const uint8_t* codes) const {
+    // only the buffers of get_single_code are owned by the caller
+    if (codes != this->codes[list_no].data()) {
+        delete[] codes;
+    }
+}
+
+size_t PQ4BlockInvertedLists::add_entries(
+        size_t list_no,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    if (n_entry == 0) {
+        return 0;
+    }
+
+    assert(list_no < nlist);
+    const size_t o = ids[list_no].size();
+    resize(list_no, o + n_entry);
+    update_entries(list_no, o, n_entry, ids_in, code);
+    return o;
+}
+
+void PQ4BlockInvertedLists::update_entries(
+        size_t list_no,
+        size_t offset,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    assert(list_no < nlist);
+    assert(offset + n_entry <= ids[list_no].size());
+
+    memcpy(ids[list_no].data() + offset, ids_in, sizeof(ids_in[0]) * n_entry);
+
+    for (size_t i = 0; i < n_entry; ++i) {
+        packer.pack_1(code + i * code_size, offset + i, codes[list_no].data());
+    }
+}
+
+void PQ4BlockInvertedLists::resize(size_t list_no, size_t new_size) {
+    ids[list_no].resize(new_size);
+    const size_t n_blocks = (new_size + packer.nvec - 1) / packer.nvec;
+    codes[list_no].resize(n_blocks * packer.block_size);
+}
+
+PQ4BlockInvertedListsIOHook::PQ4BlockInvertedListsIOHook()
+        : InvertedListsIOHook("ilp4", typeid(PQ4BlockInvertedLists).name()) {}
+
+void PQ4BlockInvertedListsIOHook::write(
+        const faiss::InvertedLists* ils,
+        faiss::IOWriter* f) const {
+    const auto* il = dynamic_cast<const PQ4BlockInvertedLists*>(ils);
+    FAISS_THROW_IF_NOT(il);
+
+    const uint32_t h = faiss::fourcc(key);
+    WRITE1(h);
+    write_io_version(f);
+    WRITE1(il->nlist);
+    WRITE1(il->packer.M);
+    WRITE1(il->packer.itq_code_size);
+
+    for (size_t list_no = 0; list_no < il->nlist; ++list_no) {
+        WRITEVECTOR(il->ids[list_no]);
+        WRITEVECTOR(il->codes[list_no]);
+    }
+}
+
+faiss::InvertedLists* PQ4BlockInvertedListsIOHook::read(
+        faiss::IOReader* f,
+        int /*io_flags*/) const {
+    read_io_version(f);
+
+    size_t nlist, M, itq_code_size;
+    READ1(nlist);
+    READ1(M);
+    READ1(itq_code_size);
+
+    auto il = std::make_unique<PQ4BlockInvertedLists>(nlist, M, itq_code_size);
+    const size_t n_per_block = il->packer.nvec;
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        READVECTOR(il->ids[list_no]);
+        READVECTOR(il->codes[list_no]);
+
+        const size_t n_blocks =
+                (il->ids[list_no].size() + n_per_block - 1) / n_per_block;
+        FAISS_THROW_IF_NOT_MSG(
+                il->codes[list_no].size() == n_blocks * il->packer.block_size,
+                "inconsistent PQ4BlockInvertedLists list");
+    }
+
+    return il.release();
+}
+
+} // namespace jecq
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/MetricType.h>
+#include <faiss/impl/CodePacker.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/invlists/InvertedListsIOHook.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace jecq {
+
+/** Packs the codes of IndexIVFJecqFastScan in blocks of pq4_block_vectors
+ * entries.
+ *
+ * A code is the 4-bit PQ code of the high variance features followed by the
+ * ITQ code. A block holds the PQ codes of its entries in the layout of
+ * pq4_set_code, which pq4_accumulate_block reads as is, followed by their
+ * ITQ codes, itq_code_size bytes each.
+ */
+struct CodePackerJecqPQ4 : faiss::CodePacker {
+    /// number of 4-bit sub-quantizers
+    size_t M;
+    size_t pq_code_size;
+    size_t itq_code_size;
+
+    CodePackerJecqPQ4(size_t M, size_t itq_code_size);
+
+    /// bytes of the PQ codes at the start of a block
+    size_t pq_block_size() const;
+
+    /// An offset past the first block selects a later block of the list
+    void pack_1(const uint8_t* flat_code, size_t offset, uint8_t* block)
+            const override;
+    void unpack_1(const uint8_t* block, size_t offset, uint8_t* flat_code)
+            const override;
+
+    faiss::CodePacker* clone() const override;
+};
+
+/** In-memory inverted lists of IndexIVFJecqFastScan, stored in the blocks of
+ * CodePackerJecqPQ4 so that a scan passes them to the SIMD kernels without
+ * regrouping them.
+ *
+ * get_codes returns the blocks of a list, the last one padded to full size.
+ * All other methods take and return codes in the usual layout of code_size
+ * bytes, the PQ code followed by the ITQ code. As with SplitInvertedLists,
+ * lists are moved with IndexIVFJecq::merge_from and
+ * IndexIVFJecq::copy_subset_to, not with InvertedLists::merge_from.
+ */
+struct PQ4BlockInvertedLists : faiss::InvertedLists {
+    CodePackerJecqPQ4 packer;
+
+    std::vector<std::vector<uint8_t>> codes;
+    std::vector<std::vector<faiss::idx_t>> ids;
+
+    PQ4BlockInvertedLists(size_t nlist, size_t M, size_t itq_code_size);
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t* get_codes(size_t list_no) const override;
+    const faiss::idx_t* get_ids(size_t list_no) const override;
+
+    /// Unpacks the code into a buffer freed by release_codes
+    const uint8_t* get_single_code(size_t list_no, size_t offset)
+            const override;
+    void release_codes(size_t list_no, const uint8_t* codes) const override;
+
+    size_t add_entries(
+            size_t list_no,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void update_entries(
+            size_t list_no,
+            size_t offset,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void resize(size_t list_no, size_t new_size) override;
+};
+
+/// Writes and reads PQ4BlockInvertedLists, tagged "ilp4"
+struct PQ4BlockInvertedListsIOHook : faiss::InvertedListsIOHook {
+    PQ4BlockInvertedListsIOHook();
+
+    void write(const faiss::InvertedLists* ils, faiss::IOWriter* f)
+            const override;
+
+    faiss::InvertedLists* read(faiss::IOReader* f, int io_flags)
+            const override;
+};
+
+} // namespace jecq
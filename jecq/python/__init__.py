@@ -88,6 +88,8 @@ add_ref_in_constructor(IndexIVFResidualQuantizerFastScan, 0)
 add_ref_in_constructor(IndexIVFLocalSearchQuantizerFastScan, 0)
 add_ref_in_constructor(IndexIVFSpectralHash, 0)
 add_ref_in_method_explicit_own(IndexIVFSpectralHash, "replace_vt")
+add_ref_in_constructor(IndexIVFJecq, 0)
+add_ref_in_constructor(IndexIVFJecqFastScan, 0)
 
 add_ref_in_constructor(Index2Layer, 0)
 add_ref_in_constructor(Level1Quantizer, 0)
@@ -121,3 +123,26 @@ add_ref_in_constructor(IDSelectorTranslated, slice(2))
 
 add_ref_in_constructor(IDSelectorXOr, slice(2))
 add_ref_in_constructor(IndexIVFIndependentQuantizer, slice(3))
+
+# serialization of indexes to byte arrays, also used for pickling
+
+def serialize_index(index):
+    """ convert an index to a numpy uint8 array  """
+    writer = VectorIOWriter()
+    write_index(index, writer)
+    return vector_to_array(writer.data)
+
+
+def deserialize_index(data, io_flags=0):
+    reader = VectorIOReader()
+    copy_array_to_vector(data, reader.data)
+    return read_index(reader, io_flags)
+
+
+def _reduce_index(index):
+    return deserialize_index, (serialize_index(index),)
+
+
+for the_class in (IndexITQFlat, IndexJecq, IndexJecqFastScan,
+                  IndexIVFJecq, IndexIVFJecqFastScan):
+    the_class.__reduce__ = _reduce_index
@@ -0,0 +1,196 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "split_inverted_lists.h"
+#include "index_io.h"
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/io_macros.h>
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <typeinfo>
+
+namespace jecq {
+
+SplitInvertedLists::SplitInvertedLists(
+        size_t nlist,
+        size_t pq_code_size,
+        size_t itq_code_size,
+        size_t n_per_block)
+        : InvertedLists(nlist, pq_code_size + itq_code_size),
+          pq_code_size(pq_code_size),
+          itq_code_size(itq_code_size),
+          n_per_block(n_per_block),
+          codes(nlist),
+          ids(nlist) {
+    FAISS_THROW_IF_NOT(n_per_block > 0);
+}
+
+void SplitInvertedLists::pack(
+        const uint8_t* code,
+        size_t offset,
+        uint8_t* blocks) const {
+    uint8_t* block = blocks + (offset / n_per_block) * block_size();
+    const size_t i = offset % n_per_block;
+
+    memcpy(block + i * pq_code_size, code, pq_code_size);
+    memcpy(block + n_per_block * pq_code_size + i * itq_code_size,
+           code + pq_code_size,
+           itq_code_size);
+}
+
+void SplitInvertedLists::unpack(
+        const uint8_t* blocks,
+        size_t offset,
+        uint8_t* code) const {
+    const uint8_t* block = blocks + (offset / n_per_block) * block_size();
+    const size_t i = offset % n_per_block;
+
+    memcpy(code, block + i * pq_code_size, pq_code_size);
+    memcpy(code + pq_code_size,
+           block + n_per_block * pq_code_size + i * itq_code_size,
+           itq_code_size);
+}
+
+size_t SplitInvertedLists::list_size(size_t list_no) const {
+    assert(list_no < nlist);
+    return ids[list_no].size();
+}
+
+const uint8_t* SplitInvertedLists::get_codes(size_t list_no) const {
+    assert(list_no < nlist);
+    return codes[list_no].data();
+}
+
+const faiss::idx_t* SplitInvertedLists::get_ids(size_t list_no) const {
+    assert(list_no < nlist);
+    return ids[list_no].data();
+}
+
+const uint8_t* SplitInvertedLists::get_single_code(
+        size_t list_no,
+        size_t offset) const {
+    assert(offset < list_size(list_no));
+    uint8_t* code = new uint8_t[code_size];
+    unpack(codes[list_no].data(), offset, code);
+    return code;
+}
+
+void SplitInvertedLists::release_codes(size_t list_no, const uint8_t* codes)
+        const {
+    // only the buffers of get_single_code are owned by the caller
+    if (codes != this->codes[list_no].data()) {
+        delete[] codes;
+    }
+}
+
+size_t SplitInvertedLists::add_entries(
+        size_t list_no,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    if (n_entry == 0) {
+        return 0;
+    }
+
+    assert(list_no < nlist);
+    const size_t o = ids[list_no].size();
+    resize(list_no, o + n_entry);
+    update_entries(list_no, o, n_entry, ids_in, code);
+    return o;
+}
+
+void SplitInvertedLists::update_entries(
+        size_t list_no,
+        size_t offset,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    assert(list_no < nlist);
+    assert(offset + n_entry <= ids[list_no].size());
+
+    memcpy(ids[list_no].data() + offset, ids_in, sizeof(ids_in[0]) * n_entry);
+
+    for (size_t i = 0; i < n_entry; ++i) {
+        pack(code + i * code_size, offset + i, codes[list_no].data());
+    }
+}
+
+void SplitInvertedLists::resize(size_t list_no, size_t new_size) {
+    ids[list_no].resize(new_size);
+    const size_t n_blocks = (new_size + n_per_block - 1) / n_per_block;
+    codes[list_no].resize(n_blocks * block_size());
+}
+
+SplitInvertedListsIOHook::SplitInvertedListsIOHook()
+        : InvertedListsIOHook("ilsp", typeid(SplitInvertedLists).name()) {}
+
+void SplitInvertedListsIOHook::write(
+        const faiss::InvertedLists* ils,
+        faiss::IOWriter* f) const {
+    const auto* il = dynamic_cast<const SplitInvertedLists*>(ils);
+    FAISS_THROW_IF_NOT(il);
+
+    const uint32_t h = faiss::fourcc(key);
+    WRITE1(h);
+    write_io_version(f);
+    WRITE1(il->nlist);
+    WRITE1(il->pq_code_size);
+    WRITE1(il->itq_code_size);
+    WRITE1(il->n_per_block);
+
+    for (size_t list_no = 0; list_no < il->nlist; ++list_no) {
+        WRITEVECTOR(il->ids[list_no]);
+        WRITEVECTOR(il->codes[list_no]);
+    }
+}
+
+faiss::InvertedLists* SplitInvertedListsIOHook::read(
+        faiss::IOReader* f,
+        int /*io_flags*/) const {
+    read_io_version(f);
+
+    size_t nlist, pq_code_size, itq_code_size, n_per_block;
+    READ1(nlist);
+    READ1(pq_code_size);
+    READ1(itq_code_size);
+    READ1(n_per_block);
+
+    auto il = std::make_unique<SplitInvertedLists>(
+            nlist, pq_code_size, itq_code_size, n_per_block);
+
+    for (size_t list_no = 0; list_no < nlist; ++list_no) {
+        READVECTOR(il->ids[list_no]);
+        READVECTOR(il->codes[list_no]);
+
+        const size_t n_blocks =
+                (il->ids[list_no].size() + n_per_block - 1) / n_per_block;
+        FAISS_THROW_IF_NOT_MSG(
+                il->codes[list_no].size() == n_blocks * il->block_size(),
+                "inconsistent SplitInvertedLists list");
+    }
+
+    return il.release();
+}
+
+} // namespace jecq
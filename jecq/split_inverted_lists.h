@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/MetricType.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/invlists/InvertedListsIOHook.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace jecq {
+
+/** In-memory inverted lists that store the PQ and ITQ codes of a list in
+ * separate planes, so that scanning the ITQ codes does not pull PQ bytes
+ * into cache.
+ *
+ * The entries of a list are grouped in blocks of n_per_block: a block holds
+ * the PQ codes of its entries, followed by their ITQ codes. get_codes returns
+ * the blocks of a list, the last one padded to full size. All other methods
+ * take and return codes in the usual layout of code_size bytes, the PQ code
+ * followed by the ITQ code.
+ */
+struct SplitInvertedLists : faiss::InvertedLists {
+    size_t pq_code_size;
+    size_t itq_code_size;
+    /// entries per block
+    size_t n_per_block;
+
+    std::vector<std::vector<uint8_t>> codes;
+    std::vector<std::vector<faiss::idx_t>> ids;
+
+    SplitInvertedLists(
+            size_t nlist,
+            size_t pq_code_size,
+            size_t itq_code_size,
+            size_t n_per_block = 256);
+
+    /// bytes of a block
+    size_t block_size() const {
+        return n_per_block * code_size;
+    }
+
+    /// Copies a code into entry offset of the blocks of a list
+    void pack(const uint8_t* code, size_t offset, uint8_t* blocks) const;
+
+    /// Copies entry offset of the blocks of a list into a code
+    void unpack(const uint8_t* blocks, size_t offset, uint8_t* code) const;
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t* get_codes(size_t list_no) const override;
+    const faiss::idx_t* get_ids(size_t list_no) const override;
+
+    /// Unpacks the code into a buffer freed by release_codes
+    const uint8_t* get_single_code(size_t list_no, size_t offset)
+            const override;
+    void release_codes(size_t list_no, const uint8_t* codes) const override;
+
+    size_t add_entries(
+            size_t list_no,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void update_entries(
+            size_t list_no,
+            size_t offset,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void resize(size_t list_no, size_t new_size) override;
+};
+
+/// Writes and reads SplitInvertedLists, tagged "ilsp"
+struct SplitInvertedListsIOHook : faiss::InvertedListsIOHook {
+    SplitInvertedListsIOHook();
+
+    void write(const faiss::InvertedLists* ils, faiss::IOWriter* f)
+            const override;
+
+    faiss::InvertedLists* read(faiss::IOReader* f, int io_flags)
+            const override;
+};
+
+} // namespace jecq
@@ -0,0 +1,173 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "variable_size_inverted_lists.h"
+#include "index_io.h"
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/io_macros.h>
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <typeinfo>
+
+namespace jecq {
+
+VariableSizeInvertedLists::VariableSizeInvertedLists(
+        size_t code_size,
+        const std::vector<size_t>& list_code_sizes)
+        : InvertedLists(list_code_sizes.size(), code_size),
+          list_code_sizes(list_code_sizes),
+          codes(list_code_sizes.size()),
+          ids(list_code_sizes.size()) {
+    for (size_t list_code_size : list_code_sizes) {
+        FAISS_THROW_IF_NOT(list_code_size <= code_size);
+    }
+}
+
+size_t VariableSizeInvertedLists::list_size(size_t list_no) const {
+    assert(list_no < nlist);
+    return ids[list_no].size();
+}
+
+const uint8_t* VariableSizeInvertedLists::get_codes(size_t list_no) const {
+    assert(list_no < nlist);
+    return codes[list_no].data();
+}
+
+const faiss::idx_t* VariableSizeInvertedLists::get_ids(size_t list_no) const {
+    assert(list_no < nlist);
+    return ids[list_no].data();
+}
+
+const uint8_t* VariableSizeInvertedLists::get_single_code(
+        size_t list_no,
+        size_t offset) const {
+    assert(offset < list_size(list_no));
+    const size_t list_code_size = list_code_sizes[list_no];
+
+    uint8_t* code = new uint8_t[code_size];
+    memcpy(code,
+           codes[list_no].data() + offset * list_code_size,
+           list_code_size);
+    memset(code + list_code_size, 0, code_size - list_code_size);
+    return code;
+}
+
+void VariableSizeInvertedLists::release_codes(
+        size_t list_no,
+        const uint8_t* codes) const {
+    // only the buffers of get_single_code are owned by the caller
+    if (codes != this->codes[list_no].data()) {
+        delete[] codes;
+    }
+}
+
+size_t VariableSizeInvertedLists::add_entries(
+        size_t list_no,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    if (n_entry == 0) {
+        return 0;
+    }
+
+    assert(list_no < nlist);
+    const size_t o = ids[list_no].size();
+    resize(list_no, o + n_entry);
+    update_entries(list_no, o, n_entry, ids_in, code);
+    return o;
+}
+
+void VariableSizeInvertedLists::update_entries(
+        size_t list_no,
+        size_t offset,
+        size_t n_entry,
+        const faiss::idx_t* ids_in,
+        const uint8_t* code) {
+    assert(list_no < nlist);
+    assert(offset + n_entry <= ids[list_no].size());
+    const size_t list_code_size = list_code_sizes[list_no];
+
+    memcpy(ids[list_no].data() + offset, ids_in, sizeof(ids_in[0]) * n_entry);
+
+    for (size_t i = 0; i < n_entry; ++i) {
+        memcpy(codes[list_no].data() + (offset + i) * list_code_size,
+               code + i * code_size,
+               list_code_size);
+    }
+}
+
+void VariableSizeInvertedLists::resize(size_t list_no, size_t new_size) {
+    ids[list_no].resize(new_size);
+    codes[list_no].resize(new_size * list_code_sizes[list_no]);
+}
+
+VariableSizeInvertedListsIOHook::VariableSizeInvertedListsIOHook()
+        : InvertedListsIOHook(
+                  "ilvs",
+                  typeid(VariableSizeInvertedLists).name()) {}
+
+void VariableSizeInvertedListsIOHook::write(
+        const faiss::InvertedLists* ils,
+        faiss::IOWriter* f) const {
+    const auto* il = dynamic_cast<const VariableSizeInvertedLists*>(ils);
+    FAISS_THROW_IF_NOT(il);
+
+    const uint32_t h = faiss::fourcc(key);
+    WRITE1(h);
+    write_io_version(f);
+    WRITE1(il->code_size);
+    WRITEVECTOR(il->list_code_sizes);
+
+    for (size_t list_no = 0; list_no < il->nlist; ++list_no) {
+        WRITEVECTOR(il->ids[list_no]);
+        WRITEVECTOR(il->codes[list_no]);
+    }
+}
+
+faiss::InvertedLists* VariableSizeInvertedListsIOHook::read(
+        faiss::IOReader* f,
+        int /*io_flags*/) const {
+    read_io_version(f);
+
+    size_t code_size;
+    std::vector<size_t> list_code_sizes;
+    READ1(code_size);
+    READVECTOR(list_code_sizes);
+
+    auto il = std::make_unique<VariableSizeInvertedLists>(
+            code_size, list_code_sizes);
+
+    for (size_t list_no = 0; list_no < il->nlist; ++list_no) {
+        READVECTOR(il->ids[list_no]);
+        READVECTOR(il->codes[list_no]);
+        FAISS_THROW_IF_NOT_MSG(
+                il->codes[list_no].size() ==
+                        il->ids[list_no].size() * list_code_sizes[list_no],
+                "inconsistent VariableSizeInvertedLists list");
+    }
+
+    return il.release();
+}
+
+} // namespace jecq
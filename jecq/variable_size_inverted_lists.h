@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2025 Janea Systems
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <faiss/MetricType.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/invlists/InvertedListsIOHook.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace jecq {
+
+/** In-memory inverted lists in which each list stores only a prefix of the
+ * codes it receives.
+ *
+ * Codes are passed in and out in full, code_size bytes each. List l keeps
+ * the first list_code_sizes[l] bytes of every code, the rest of which must be
+ * zero: get_codes returns codes with a stride of list_code_sizes[l], and
+ * get_single_code pads the code back with zeros. InvertedLists::merge_from
+ * and the whole-list subsets of InvertedLists::copy_subset_to read get_codes
+ * as codes of code_size bytes: use IndexIVFJecq::merge_from and
+ * IndexIVFJecq::copy_subset_to instead.
+ */
+struct VariableSizeInvertedLists : faiss::InvertedLists {
+    /// bytes stored per code of each list, at most code_size
+    std::vector<size_t> list_code_sizes;
+
+    std::vector<std::vector<uint8_t>> codes;
+    std::vector<std::vector<faiss::idx_t>> ids;
+
+    VariableSizeInvertedLists(
+            size_t code_size,
+            const std::vector<size_t>& list_code_sizes);
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t* get_codes(size_t list_no) const override;
+    const faiss::idx_t* get_ids(size_t list_no) const override;
+
+    /// Pads the code into a buffer freed by release_codes
+    const uint8_t* get_single_code(size_t list_no, size_t offset)
+            const override;
+    void release_codes(size_t list_no, const uint8_t* codes) const override;
+
+    size_t add_entries(
+            size_t list_no,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void update_entries(
+            size_t list_no,
+            size_t offset,
+            size_t n_entry,
+            const faiss::idx_t* ids,
+            const uint8_t* code) override;
+
+    void resize(size_t list_no, size_t new_size) override;
+};
+
+/// Writes and reads VariableSizeInvertedLists, tagged "ilvs"
+struct VariableSizeInvertedListsIOHook : faiss::InvertedListsIOHook {
+    VariableSizeInvertedListsIOHook();
+
+    void write(const faiss::InvertedLists* ils, faiss::IOWriter* f)
+            const override;
+
+    faiss::InvertedLists* read(faiss::IOReader* f, int io_flags)
+            const override;
+};
+
+} // namespace jecq
@@ -56,12 +56,13 @@ std::vector<uint8_t> encode(
 std::pair<std::vector<float>, std::vector<faiss::idx_t>> search(
         const faiss::Index& index,
         const std::vector<float>& sq,
-        faiss::idx_t k) {
+        faiss::idx_t k,
+        const faiss::SearchParameters* params) {
     const auto nq = sq.size() / index.d;
     std::vector<float> distances(nq * k);
     std::vector<faiss::idx_t> labels(nq * k);
 
-    index.search(nq, sq.data(), k, distances.data(), labels.data());
+    index.search(nq, sq.data(), k, distances.data(), labels.data(), params);
 
     return std::pair(distances, labels);
 }
@@ -38,5 +38,14 @@ std::vector<uint8_t> encode(faiss::Index*, const std::vector<float>&);
 std::pair<std::vector<float>, std::vector<faiss::idx_t>> search(
         const faiss::Index&,
         const std::vector<float>&,
-        faiss::idx_t k);
+        faiss::idx_t k,
+        const faiss::SearchParameters* params = nullptr);
+
+/// Sets the features of the two tiers instead of selecting them in train
+template <class Index>
+void use_fixed_features(Index* index) {
+    index->reclassify_features_when_training = false;
+    index->pq_features = {0, 1, 2};
+    index->itq_features = {3, 5};
+}
 } // namespace jecq_test
\ No newline at end of file
@@ -0,0 +1,264 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "utils.h"
+
+#include <jecq/distance_kernels.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace jecq_test {
+
+namespace {
+/// Runs test once per instruction set supported by the CPU
+template <class Test>
+void for_each_simd_level(Test test) {
+    const auto initial_level = jecq::get_simd_level();
+
+    for (const auto level :
+         {jecq::SimdLevel::Generic,
+          jecq::SimdLevel::AVX2,
+          jecq::SimdLevel::AVX512}) {
+        jecq::set_simd_level(level);
+
+        if (jecq::get_simd_level() == level) {
+            SCOPED_TRACE("simd level " + std::to_string(int(level)));
+            test();
+        }
+    }
+
+    jecq::set_simd_level(initial_level);
+}
+} // namespace
+
+TEST(TestDistanceKernels, TestBatchedADCMatchesSingleCode) {
+    for_each_simd_level([] {
+        const size_t n = 37;
+
+        for (size_t M = 1; M <= 13; ++M) {
+            for (const size_t code_stride : {M, M + 3}) {
+                const auto table = random_vector_float(M * 256);
+
+                std::vector<uint8_t> codes(n * code_stride);
+                for (auto& c : codes) {
+                    c = static_cast<uint8_t>(std::rand());
+                }
+
+                std::vector<float> distances(n);
+                jecq::pq_adc_distances(
+                        table.data(),
+                        M,
+                        n,
+                        codes.data(),
+                        code_stride,
+                        distances.data());
+
+                for (size_t i = 0; i < n; ++i) {
+                    const uint8_t* code = codes.data() + i * code_stride;
+                    EXPECT_EQ(
+                            jecq::pq_adc_distance(table.data(), M, code),
+                            distances[i])
+                            << "M=" << M << ", code_stride=" << code_stride
+                            << ", i=" << i;
+                }
+            }
+        }
+    });
+}
+
+TEST(TestDistanceKernels, TestScaledTableMatchesFaissTable) {
+    const size_t d = 6;
+    const float multiplier = 2.5f;
+
+    faiss::ProductQuantizer pq(d, d, 8);
+    const auto train_data = random_vector_float(1000 * d);
+    pq.train(1000, train_data.data());
+
+    const auto x = random_vector_float(d);
+
+    std::vector<float> reference(pq.M * pq.ksub);
+    pq.compute_inner_prod_table(x.data(), reference.data());
+
+    std::vector<float> table(pq.M * pq.ksub);
+    jecq::compute_scaled_inner_prod_table(
+            pq, x.data(), multiplier, table.data());
+
+    for (size_t i = 0; i < table.size(); ++i) {
+        EXPECT_FLOAT_EQ(reference[i] * multiplier, table[i]);
+    }
+}
+
+TEST(TestDistanceKernels, TestPQ4CodesRoundTripThroughBlock) {
+    for (size_t M = 1; M <= 7; ++M) {
+        const size_t code_size = (M + 1) / 2;
+        std::vector<uint8_t> codes(jecq::pq4_block_vectors * code_size);
+        for (size_t i = 0; i < codes.size(); ++i) {
+            codes[i] = static_cast<uint8_t>(std::rand());
+            // the padding nibble of an odd M is never stored
+            if (M % 2 == 1 && i % code_size == code_size - 1) {
+                codes[i] &= 0x0f;
+            }
+        }
+
+        std::vector<uint8_t> block(jecq::pq4_block_size(M));
+        for (size_t i = 0; i < jecq::pq4_block_vectors; ++i) {
+            jecq::pq4_set_code(
+                    M, codes.data() + i * code_size, i, block.data());
+        }
+
+        std::vector<uint8_t> code(code_size);
+        for (size_t i = 0; i < jecq::pq4_block_vectors; ++i) {
+            jecq::pq4_get_code(M, block.data(), i, code.data());
+            EXPECT_EQ(
+                    std::vector<uint8_t>(
+                            codes.begin() + i * code_size,
+                            codes.begin() + (i + 1) * code_size),
+                    code)
+                    << "M=" << M << ", i=" << i;
+        }
+    }
+}
+
+TEST(TestDistanceKernels, TestPQ4BlockMatchesFloatTable) {
+    for_each_simd_level([] {
+        for (const size_t M : {1, 2, 5, 16, 301}) {
+            const auto table = random_vector_float(M * 16);
+            const size_t code_size = (M + 1) / 2;
+
+            std::vector<uint8_t> codes(jecq::pq4_block_vectors * code_size);
+            for (auto& c : codes) {
+                c = static_cast<uint8_t>(std::rand());
+            }
+
+            std::vector<uint8_t> block(jecq::pq4_block_size(M));
+            for (size_t i = 0; i < jecq::pq4_block_vectors; ++i) {
+                jecq::pq4_set_code(
+                        M, codes.data() + i * code_size, i, block.data());
+            }
+
+            std::vector<uint8_t> qtable(jecq::pq4_padded_M(M) * 16);
+            float scale, bias;
+            jecq::pq4_quantize_table(
+                    table.data(), M, qtable.data(), &scale, &bias);
+
+            uint16_t accu[jecq::pq4_block_vectors];
+            jecq::pq4_accumulate_block(qtable.data(), M, block.data(), accu);
+
+            for (size_t i = 0; i < jecq::pq4_block_vectors; ++i) {
+                uint32_t expected_accu = 0;
+                float distance = 0;
+                for (size_t m = 0; m < M; ++m) {
+                    const uint8_t byte = codes[i * code_size + m / 2];
+                    const size_t c = (byte >> (4 * (m & 1))) & 15;
+                    expected_accu += qtable[m * 16 + c];
+                    distance += table[m * 16 + c];
+                }
+
+                EXPECT_EQ(expected_accu, accu[i]) << "M=" << M << ", i=" << i;
+                // every entry is off by at most half a quantization step
+                EXPECT_NEAR(
+                        distance,
+                        bias + accu[i] * scale,
+                        M * scale / 2 + 1e-4)
+                        << "M=" << M << ", i=" << i;
+            }
+        }
+    });
+}
+
+TEST(TestDistanceKernels, TestHammingDistancesMatchBitCount) {
+    for_each_simd_level([] {
+        const size_t n = 41;
+
+        for (const size_t code_size :
+             {1, 3, 7, 8, 9, 31, 32, 33, 64, 65, 600}) {
+            for (const size_t code_stride : {code_size, code_size + 5}) {
+                std::vector<uint8_t> query(code_size);
+                std::vector<uint8_t> codes(n * code_stride);
+                for (auto& c : query) {
+                    c = static_cast<uint8_t>(std::rand());
+                }
+                for (auto& c : codes) {
+                    c = static_cast<uint8_t>(std::rand());
+                }
+
+                std::vector<int> distances(n);
+                jecq::hamming_distances(
+                        query.data(),
+                        codes.data(),
+                        n,
+                        code_size,
+                        code_stride,
+                        distances.data());
+
+                for (size_t i = 0; i < n; ++i) {
+                    int expected = 0;
+                    for (size_t b = 0; b < code_size; ++b) {
+                        const uint8_t x = query[b] ^ codes[i * code_stride + b];
+                        for (int bit = 0; bit < 8; ++bit) {
+                            expected += (x >> bit) & 1;
+                        }
+                    }
+
+                    EXPECT_EQ(expected, distances[i])
+                            << "code_size=" << code_size
+                            << ", code_stride=" << code_stride << ", i=" << i;
+                }
+            }
+        }
+    });
+}
+
+TEST(TestDistanceKernels, TestGatherFeaturesMatchesIndexing) {
+    for_each_simd_level([] {
+        const size_t n = 7;
+        const size_t d = 23;
+        const auto x = random_vector_float(n * d);
+
+        for (const std::vector<int64_t>& features :
+             {std::vector<int64_t>{},
+              std::vector<int64_t>{5},
+              std::vector<int64_t>{0, 2, 3, 7, 8, 9, 11, 12, 20, 22},
+              std::vector<int64_t>{22, 1, 4, 3}}) {
+            std::vector<float> output(n * features.size());
+            jecq::gather_features(
+                    n,
+                    d,
+                    x.data(),
+                    features.data(),
+                    features.size(),
+                    output.data());
+
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t f = 0; f < features.size(); ++f) {
+                    EXPECT_EQ(
+                            x[i * d + features[f]],
+                            output[i * features.size() + f]);
+                }
+            }
+        }
+    });
+}
+
+} // namespace jecq_test
@@ -0,0 +1,162 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "datasets.h"
+#include "index_helpers.h"
+#include "utils.h"
+
+#include <jecq/index_builder.h>
+#include <jecq/index_ivf_jecq.h>
+#include <jecq/index_jecq.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace jecq_test {
+
+namespace {
+void write_fvecs(
+        const std::string& filename,
+        const std::vector<float>& x,
+        int32_t d) {
+    FILE* f = fopen(filename.c_str(), "wb");
+    ASSERT_NE(nullptr, f);
+    for (size_t i = 0; i < x.size(); i += d) {
+        fwrite(&d, sizeof(d), 1, f);
+        fwrite(x.data() + i, sizeof(float), d, f);
+    }
+    fclose(f);
+}
+
+void write_npy(
+        const std::string& filename,
+        const std::vector<float>& x,
+        size_t d) {
+    std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" +
+            std::to_string(x.size() / d) + ", " + std::to_string(d) + "), }";
+    header.append(63 - (10 + header.size()) % 64, ' ');
+    header += '\n';
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    ASSERT_NE(nullptr, f);
+    fwrite("\x93NUMPY\x01\x00", 1, 8, f);
+    const uint16_t header_len = header.size();
+    fwrite(&header_len, sizeof(header_len), 1, f);
+    fwrite(header.data(), 1, header.size(), f);
+    fwrite(x.data(), sizeof(float), x.size(), f);
+    fclose(f);
+}
+} // namespace
+
+TEST(TestIndexBuilder, TestFilesMatchInMemoryBuild) {
+    const auto xdb = get_standard_dataset(3000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const std::string fvecs = testing::TempDir() + "jecq_builder.fvecs";
+    const std::string npy = testing::TempDir() + "jecq_builder.npy";
+    write_fvecs(fvecs, xdb, DEFAULT_DIMENSIONS);
+    write_npy(npy, xdb, DEFAULT_DIMENSIONS);
+
+    jecq::IndexJecq reference(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    train(&reference, xdb);
+    add(&reference, xdb);
+    const auto [distances1, labels1] = search(reference, xq, 10);
+
+    // the sample holds every vector in order, as in the in-memory build
+    jecq::BuildParams params;
+    params.chunk_size = 257;
+    params.max_train_points = 3000;
+
+    for (const auto& filename : {fvecs, npy}) {
+        const auto source = jecq::open_vector_file(filename.c_str());
+        EXPECT_EQ(DEFAULT_DIMENSIONS, source->d);
+
+        jecq::IndexJecq index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+        jecq::build_index(&index, *source, params);
+        EXPECT_EQ(reference.ntotal, index.ntotal);
+
+        const auto [distances2, labels2] = search(index, xq, 10);
+        EXPECT_EQ(labels1, labels2);
+        EXPECT_EQ(distances1, distances2);
+    }
+
+    std::remove(fvecs.c_str());
+    std::remove(npy.c_str());
+}
+
+TEST(TestIndexBuilder, TestCallbackSourceWithSample) {
+    const auto xdb = get_standard_dataset(5000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const size_t nb = xdb.size() / DEFAULT_DIMENSIONS;
+
+    size_t n_read = 0;
+    size_t n_rewinds = 0;
+    jecq::CallbackVectorSource source(
+            DEFAULT_DIMENSIONS,
+            [&](size_t n, float* x) {
+                n = std::min(n, nb - n_read);
+                memcpy(x,
+                       xdb.data() + n_read * DEFAULT_DIMENSIONS,
+                       n * DEFAULT_DIMENSIONS * sizeof(float));
+                n_read += n;
+                return n;
+            },
+            [&] {
+                n_read = 0;
+                ++n_rewinds;
+            });
+
+    jecq::IndexIVFJecq index(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    index.nprobe = 4;
+    jecq::BuildParams params;
+    params.chunk_size = 1000;
+    params.max_train_points = 2000;
+    jecq::build_index(&index, source, params);
+
+    EXPECT_EQ(2, n_rewinds);
+    EXPECT_TRUE(index.is_trained);
+    EXPECT_EQ(nb, index.ntotal);
+
+    // a trained index is only filled, in a single pass, like add would
+    jecq::IndexIVFJecq trained(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    jecq::IndexIVFJecq reference(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    for (auto* idx : {&trained, &reference}) {
+        idx->nprobe = 4;
+        train(idx, xdb);
+    }
+    add(&reference, xdb);
+
+    n_rewinds = 0;
+    jecq::build_index(&trained, source, params);
+    EXPECT_EQ(1, n_rewinds);
+    EXPECT_EQ(nb, trained.ntotal);
+
+    const auto [distances1, labels1] = search(reference, xq, 10);
+    const auto [distances2, labels2] = search(trained, xq, 10);
+    EXPECT_EQ(labels1, labels2);
+    EXPECT_EQ(distances1, distances2);
+}
+
+} // namespace jecq_test
@@ -26,6 +26,7 @@
 #include <jecq/index_ivf_jecq.h>
 #include <jecq/index_jecq.h>
 
+#include <faiss/impl/IDSelector.h>
 #include <gtest/gtest.h>
 
 #include <algorithm>
@@ -262,9 +263,7 @@ TEST_P(TestIndexCommonTestFixture, TestSearchComplex) {
     auto& index = *index_ptr;
     auto& faiss_index = index.as_faiss_index();
 
-    index.reclassify_features_when_training = false;
-    index.pq_features = {0, 1, 2};
-    index.itq_features = {3, 5};
+    use_fixed_features(&index);
 
     const auto xdb = get_standard_dataset();
     train(&faiss_index, xdb);
@@ -272,4 +271,143 @@ TEST_P(TestIndexCommonTestFixture, TestSearchComplex) {
     verify_with_standard_query(xdb, faiss_index);
 }
 
+TEST_P(TestIndexCommonTestFixture, TestRangeSearchMatchesSearch) {
+    std::unique_ptr<jecq::IndexJecqBase> index_ptr = create_index_jecq(
+            GetParam(), DEFAULT_DIMENSIONS, 10, 0.05, 0.005, true);
+
+    auto& index = *index_ptr;
+    auto& faiss_index = index.as_faiss_index();
+
+    use_fixed_features(&index);
+
+    const faiss::idx_t n = 2000;
+    train(&faiss_index, get_standard_dataset());
+    add(&faiss_index, random_vector_float(n * faiss_index.d));
+
+    const auto nq = 4;
+    const auto xq = random_vector_float(nq * faiss_index.d);
+    const auto [distances, labels] = search(faiss_index, xq, n);
+
+    // keeps about the 100 best results of the first query
+    const float radius = distances[100];
+
+    faiss::RangeSearchResult result(nq);
+    faiss_index.range_search(nq, xq.data(), radius, &result);
+
+    for (int i = 0; i < nq; ++i) {
+        std::vector<std::pair<faiss::idx_t, float>> expected;
+        for (faiss::idx_t j = i * n; j < (i + 1) * n; ++j) {
+            if (distances[j] > radius) {
+                expected.emplace_back(labels[j], distances[j]);
+            }
+        }
+
+        std::vector<std::pair<faiss::idx_t, float>> actual;
+        for (size_t r = result.lims[i]; r < result.lims[i + 1]; ++r) {
+            actual.emplace_back(result.labels[r], result.distances[r]);
+        }
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        EXPECT_EQ(expected, actual) << "query " << i;
+    }
+}
+
+std::unique_ptr<faiss::SearchParameters> create_search_params(
+        IndexType index_type,
+        faiss::IDSelector* sel,
+        float pq_multiplier) {
+    if (index_type == IndexType::IndexJecq) {
+        auto params = std::make_unique<jecq::SearchParametersJecq>();
+        params->sel = sel;
+        params->pq_multiplier = pq_multiplier;
+        return params;
+    }
+
+    auto params = std::make_unique<jecq::SearchParametersIVFJecq>();
+    params->sel = sel;
+    params->pq_multiplier = pq_multiplier;
+    return params;
+}
+
+TEST_P(TestIndexCommonTestFixture, TestSearchWithSelector) {
+    std::unique_ptr<jecq::IndexJecqBase> index_ptr = create_index_jecq(
+            GetParam(), DEFAULT_DIMENSIONS, 10, 0.05, 0.005, true);
+
+    auto& index = *index_ptr;
+    auto& faiss_index = index.as_faiss_index();
+
+    use_fixed_features(&index);
+
+    const faiss::idx_t n = 2000;
+    train(&faiss_index, get_standard_dataset());
+    add(&faiss_index, random_vector_float(n * faiss_index.d));
+
+    const faiss::idx_t nq = 4;
+    const faiss::idx_t k = 10;
+    const auto xq = random_vector_float(nq * faiss_index.d);
+    const auto [distances_full, labels_full] = search(faiss_index, xq, n);
+
+    std::vector<faiss::idx_t> every_third;
+    for (faiss::idx_t j = 0; j < n; j += 3) {
+        every_third.push_back(j);
+    }
+
+    // a dense and a sparse selection
+    faiss::IDSelectorRange range(500, 1500);
+    faiss::IDSelectorBatch batch(every_third.size(), every_third.data());
+
+    for (faiss::IDSelector* sel :
+         std::vector<faiss::IDSelector*>{&range, &batch}) {
+        const auto params = create_search_params(GetParam(), sel, 0);
+        const auto [distances, labels] =
+                search(faiss_index, xq, k, params.get());
+
+        for (faiss::idx_t i = 0; i < nq; ++i) {
+            std::vector<float> expected;
+            for (faiss::idx_t j = i * n; j < (i + 1) * n; ++j) {
+                if (sel->is_member(labels_full[j]) &&
+                    expected.size() < size_t(k)) {
+                    expected.push_back(distances_full[j]);
+                }
+            }
+
+            const std::vector<float> actual(
+                    distances.begin() + i * k, distances.begin() + (i + 1) * k);
+            EXPECT_EQ(expected, actual) << "query " << i;
+
+            for (faiss::idx_t j = i * k; j < (i + 1) * k; ++j) {
+                EXPECT_TRUE(sel->is_member(labels[j]));
+            }
+        }
+    }
+}
+
+TEST_P(TestIndexCommonTestFixture, TestSearchWithPQMultiplierOverride) {
+    const auto xdb = get_standard_dataset();
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const faiss::idx_t k = 5;
+
+    std::vector<std::unique_ptr<jecq::IndexJecqBase>> indexes;
+    for (const float pq_multiplier : {10.0f, 3.0f}) {
+        indexes.push_back(create_index_jecq(
+                GetParam(), DEFAULT_DIMENSIONS, pq_multiplier, 0.05, 0.005));
+
+        auto& index = *indexes.back();
+        use_fixed_features(&index);
+
+        train(&index.as_faiss_index(), xdb);
+        add(&index.as_faiss_index(), xdb);
+    }
+
+    const auto params = create_search_params(GetParam(), nullptr, 3.0f);
+    const auto [distances, labels] =
+            search(indexes[0]->as_faiss_index(), xq, k, params.get());
+    const auto [distances_ref, labels_ref] =
+            search(indexes[1]->as_faiss_index(), xq, k);
+
+    EXPECT_EQ(labels_ref, labels);
+    EXPECT_EQ(distances_ref, distances);
+}
+
 } // namespace jecq_test
\ No newline at end of file
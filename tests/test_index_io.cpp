@@ -0,0 +1,338 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "datasets.h"
+#include "index_helpers.h"
+#include "utils.h"
+
+#include <jecq/compressed_ids_inverted_lists.h>
+#include <jecq/index_io.h>
+#include <jecq/index_itq_flat.h>
+#include <jecq/index_ivf_jecq.h>
+#include <jecq/index_ivf_jecq_fast_scan.h>
+#include <jecq/index_jecq.h>
+#include <jecq/index_jecq_fast_scan.h>
+#include <jecq/split_inverted_lists.h>
+#include <jecq/variable_size_inverted_lists.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/zerocopy_io.h>
+#include <faiss/index_io.h>
+#include <faiss/invlists/OnDiskInvertedLists.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace jecq_test {
+
+namespace {
+std::unique_ptr<faiss::Index> write_and_read(const faiss::Index& index) {
+    faiss::VectorIOWriter writer;
+    jecq::write_index(&index, &writer);
+
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::Index> read(jecq::read_index(&reader));
+    EXPECT_EQ(reader.data.size(), reader.rp);
+    return read;
+}
+
+void expect_same_search(
+        const faiss::Index& index1,
+        const faiss::Index& index2,
+        const std::vector<float>& xq) {
+    EXPECT_EQ(index1.d, index2.d);
+    EXPECT_EQ(index1.ntotal, index2.ntotal);
+    EXPECT_EQ(index1.is_trained, index2.is_trained);
+
+    const auto [distances1, labels1] = search(index1, xq, 10);
+    const auto [distances2, labels2] = search(index2, xq, 10);
+    EXPECT_EQ(labels1, labels2);
+    EXPECT_EQ(distances1, distances2);
+}
+} // namespace
+
+TEST(TestIndexIO, TestIndexITQFlat) {
+    const auto xdb = get_standard_dataset(1000, 8);
+    const auto xq = get_standard_query(xdb, 8);
+
+    jecq::IndexITQFlat index(8);
+    train(&index, xdb);
+    add(&index, xdb);
+
+    const auto read = write_and_read(index);
+    ASSERT_NE(nullptr, dynamic_cast<jecq::IndexITQFlat*>(read.get()));
+    expect_same_search(index, *read, xq);
+}
+
+TEST(TestIndexIO, TestIndexJecq) {
+    const auto xdb = get_standard_dataset(1000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+
+    jecq::IndexJecq index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&index);
+    train(&index, xdb);
+    jecq::IndexJecq interleaved = index;
+    interleaved.set_interleaved_codes(true);
+    interleaved.search_mode = jecq::JecqSearchMode::ITQPrefilter;
+
+    for (auto* idx : {&index, &interleaved}) {
+        add(idx, xdb);
+
+        const auto read = write_and_read(*idx);
+        auto* index_jecq = dynamic_cast<jecq::IndexJecq*>(read.get());
+        ASSERT_NE(nullptr, index_jecq);
+        EXPECT_EQ(idx->is_interleaved_codes(),
+                  index_jecq->is_interleaved_codes());
+        EXPECT_EQ(idx->search_mode, index_jecq->search_mode);
+        EXPECT_EQ(idx->pq_features, index_jecq->pq_features);
+        EXPECT_EQ(idx->itq_features, index_jecq->itq_features);
+        expect_same_search(*idx, *read, xq);
+    }
+}
+
+TEST(TestIndexIO, TestIndexJecqFastScan) {
+    const auto xdb = get_standard_dataset(1000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+
+    jecq::IndexJecqFastScan index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&index);
+    train(&index, xdb);
+    add(&index, xdb);
+
+    const auto read = write_and_read(index);
+    ASSERT_NE(nullptr, dynamic_cast<jecq::IndexJecqFastScan*>(read.get()));
+    expect_same_search(index, *read, xq);
+}
+
+TEST(TestIndexIO, TestIndexIVFJecqInvertedLists) {
+    const auto xdb = get_standard_dataset(5000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+
+    for (int layout = 0; layout < 4; ++layout) {
+        jecq::IndexIVFJecq index(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+        index.nprobe = 2;
+        index.split_codes = layout == 1;
+        index.per_list_features = layout == 2;
+        index.per_list_min_points = 100;
+        index.compress_ids = layout == 3;
+        if (!index.per_list_features) {
+            use_fixed_features(&index);
+        }
+        index.by_residual = layout < 2;
+        train(&index, xdb);
+        add(&index, xdb);
+        index.make_direct_map(true);
+
+        const auto read = write_and_read(index);
+        auto* ivf = dynamic_cast<jecq::IndexIVFJecq*>(read.get());
+        ASSERT_NE(nullptr, ivf);
+        EXPECT_EQ(index.nprobe, ivf->nprobe);
+        EXPECT_EQ(index.by_residual, ivf->by_residual);
+        EXPECT_EQ(index.direct_map.type, ivf->direct_map.type);
+        EXPECT_EQ(typeid(*index.invlists), typeid(*ivf->invlists));
+        expect_same_search(index, *read, xq);
+
+        // the read index accepts new vectors like the original
+        const auto xadd = get_standard_dataset(100);
+        add(&index, xadd);
+        add(ivf, xadd);
+        expect_same_search(index, *read, xq);
+    }
+}
+
+TEST(TestIndexIO, TestIndexIVFJecqFastScanHNSWQuantizer) {
+    const auto xdb = get_standard_dataset(5000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+
+    jecq::IndexIVFJecqFastScan index(
+            new faiss::IndexHNSWFlat(
+                    DEFAULT_DIMENSIONS,
+                    16,
+                    faiss::MetricType::METRIC_INNER_PRODUCT),
+            DEFAULT_DIMENSIONS,
+            16,
+            10,
+            0.05,
+            0.005);
+    index.own_fields = true;
+    index.nprobe = 4;
+    use_fixed_features(&index);
+    train(&index, xdb);
+    add(&index, xdb);
+
+    const auto read = write_and_read(index);
+    auto* ivf = dynamic_cast<jecq::IndexIVFJecqFastScan*>(read.get());
+    ASSERT_NE(nullptr, ivf);
+    EXPECT_NE(nullptr, dynamic_cast<faiss::IndexHNSWFlat*>(ivf->quantizer));
+    expect_same_search(index, *read, xq);
+}
+
+TEST(TestIndexIO, TestMmapCodes) {
+    const auto xdb = get_standard_dataset(1000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const std::string filename = testing::TempDir() + "jecq_mmap.index";
+
+    jecq::IndexJecq separate(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&separate);
+    jecq::IndexJecq interleaved(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&interleaved);
+    interleaved.set_interleaved_codes(true);
+    jecq::IndexJecqFastScan fast_scan(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&fast_scan);
+    jecq::IndexITQFlat itq_flat(DEFAULT_DIMENSIONS);
+
+    for (faiss::Index* index : std::vector<faiss::Index*>{
+                 &separate, &interleaved, &fast_scan, &itq_flat}) {
+        train(index, xdb);
+        add(index, xdb);
+        jecq::write_index(index, filename.c_str());
+
+        std::unique_ptr<faiss::Index> mapped(jecq::read_index(
+                filename.c_str(), faiss::IO_FLAG_MMAP_IFC));
+        expect_same_search(*index, *mapped, xq);
+
+        faiss::VectorIOWriter writer;
+        jecq::write_index(index, &writer);
+        faiss::ZeroCopyIOReader reader(writer.data.data(), writer.data.size());
+        std::unique_ptr<faiss::Index> viewed(jecq::read_index(&reader));
+        expect_same_search(*index, *viewed, xq);
+
+        for (auto* read : {mapped.get(), viewed.get()}) {
+            auto* index_jecq = dynamic_cast<jecq::IndexJecq*>(read);
+            auto* index_fs = dynamic_cast<jecq::IndexJecqFastScan*>(read);
+            auto* index_flat = dynamic_cast<jecq::IndexITQFlat*>(read);
+            if (index_jecq) {
+                // the PQ and ITQ tiers of the separate layout as well
+                EXPECT_FALSE(index_jecq->owns_codes());
+            } else if (index_fs) {
+                EXPECT_FALSE(index_fs->pq_codes.is_owned);
+                EXPECT_FALSE(index_fs->itq_codes.is_owned);
+            } else {
+                ASSERT_NE(nullptr, index_flat);
+                EXPECT_FALSE(index_flat->codes.is_owned);
+            }
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST(TestIndexIO, TestUnknownVersionThrows) {
+    jecq::IndexITQFlat index(8);
+    faiss::VectorIOWriter writer;
+    jecq::write_index(&index, &writer);
+
+    // the version follows the fourcc
+    writer.data[4] = jecq::jecq_io_version + 1;
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    EXPECT_THROW(jecq::read_index(&reader), faiss::FaissException);
+}
+
+TEST(TestIndexIO, TestCodeSizeMismatchThrows) {
+    const auto xdb = get_standard_dataset(500);
+
+    jecq::IndexJecq separate(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&separate);
+    jecq::IndexJecq interleaved(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&interleaved);
+    interleaved.set_interleaved_codes(true);
+    jecq::IndexJecqFastScan fast_scan(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    use_fixed_features(&fast_scan);
+
+    for (faiss::Index* index : std::vector<faiss::Index*>{
+                 &separate, &interleaved, &fast_scan}) {
+        train(index, xdb);
+        add(index, xdb);
+
+        faiss::VectorIOWriter writer;
+        jecq::write_index(index, &writer);
+
+        // ntotal follows the fourcc, the version and d
+        faiss::idx_t ntotal;
+        const size_t offset = 2 * sizeof(uint32_t) + sizeof(index->d);
+        memcpy(&ntotal, writer.data.data() + offset, sizeof(ntotal));
+        ASSERT_EQ(index->ntotal, ntotal);
+        ntotal += 100;
+        memcpy(writer.data.data() + offset, &ntotal, sizeof(ntotal));
+
+        faiss::VectorIOReader reader;
+        reader.data = writer.data;
+        EXPECT_THROW(jecq::read_index(&reader), faiss::FaissException);
+    }
+}
+
+TEST(TestIndexIO, TestDelegatesToFaiss) {
+    const auto xdb = get_standard_dataset(500);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+
+    faiss::IndexFlatIP index(DEFAULT_DIMENSIONS);
+    add(&index, xdb);
+
+    const auto read = write_and_read(index);
+    ASSERT_NE(nullptr, dynamic_cast<faiss::IndexFlatIP*>(read.get()));
+    expect_same_search(index, *read, xq);
+}
+
+TEST(TestIndexIO, TestDelegatesToFaissMmap) {
+    const auto xdb = get_standard_dataset(1000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const std::string filename = testing::TempDir() + "jecq_faiss_mmap.index";
+
+    faiss::IndexFlatL2 quantizer(DEFAULT_DIMENSIONS);
+    faiss::IndexIVFFlat index(&quantizer, DEFAULT_DIMENSIONS, 16);
+    index.nprobe = 4;
+    train(&index, xdb);
+    add(&index, xdb);
+    faiss::write_index(&index, filename.c_str());
+
+    std::unique_ptr<faiss::Index> by_name(
+            jecq::read_index(filename.c_str(), faiss::IO_FLAG_MMAP));
+    FILE* f = fopen(filename.c_str(), "rb");
+    ASSERT_NE(nullptr, f);
+    std::unique_ptr<faiss::Index> by_file(
+            jecq::read_index(f, faiss::IO_FLAG_MMAP));
+    fclose(f);
+
+    for (auto* read : {by_name.get(), by_file.get()}) {
+        auto* ivf = dynamic_cast<faiss::IndexIVFFlat*>(read);
+        ASSERT_NE(nullptr, ivf);
+        EXPECT_NE(
+                nullptr,
+                dynamic_cast<faiss::OnDiskInvertedLists*>(ivf->invlists));
+        ivf->nprobe = index.nprobe;
+        expect_same_search(index, *read, xq);
+    }
+
+    std::remove(filename.c_str());
+}
+
+} // namespace jecq_test
@@ -17,3 +17,41 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
+
+#include "index_helpers.h"
+#include "utils.h"
+
+#include <jecq/index_itq_flat.h>
+
+#include <gtest/gtest.h>
+
+namespace jecq_test {
+
+TEST(TestIndexITQFlat, TestBatchSearchMatchesSingleQuerySearch) {
+    const int d = 8;
+
+    jecq::IndexITQFlat index(d);
+
+    // Large enough to be scanned in several cache blocks
+    const auto xdb = random_vector_float(300000 * d);
+    train(&index, {xdb.begin(), xdb.begin() + 5000 * d});
+    add(&index, xdb);
+
+    const faiss::idx_t nq = 30;
+    const faiss::idx_t k = 5;
+    const auto xq = random_vector_float(nq * d);
+
+    const auto [distances, labels] = search(index, xq, k);
+
+    for (faiss::idx_t i = 0; i < nq; ++i) {
+        const auto [distances_i, labels_i] =
+                search(index, get_row(xq, d, i), k);
+
+        for (faiss::idx_t j = 0; j < k; ++j) {
+            EXPECT_EQ(distances[i * k + j], distances_i[j])
+                    << "query " << i << ", rank " << j;
+        }
+    }
+}
+
+} // namespace jecq_test
@@ -24,12 +24,53 @@
 #include "utils.h"
 
 #include <jecq/index_ivf_jecq.h>
+#include <jecq/compressed_ids_inverted_lists.h>
+#include <jecq/index_io.h>
 #include <jecq/index_jecq.h>
+#include <jecq/split_inverted_lists.h>
+#include <jecq/variable_size_inverted_lists.h>
 
+#include <faiss/IVFlib.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/impl/io.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/invlists/OnDiskInvertedLists.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
 #include <gtest/gtest.h>
+#include <omp.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
 
 namespace jecq_test {
 
+namespace {
+/// Copy of a trained index, as shipped to the machines that fill the shards
+std::unique_ptr<jecq::IndexIVFJecq> clone(const jecq::IndexIVFJecq& index) {
+    faiss::VectorIOWriter writer;
+    jecq::write_index(&index, &writer);
+
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::Index> read(jecq::read_index(&reader));
+    auto* ivf = dynamic_cast<jecq::IndexIVFJecq*>(read.get());
+    EXPECT_NE(nullptr, ivf);
+    read.release();
+    return std::unique_ptr<jecq::IndexIVFJecq>(ivf);
+}
+} // namespace
+
 TEST(TestIVFJecq, TestCompareWithIndexJecq) {
     const int d = DEFAULT_DIMENSIONS;
     const int db_size = DEFAULT_DB_SIZE;
@@ -44,9 +85,7 @@ TEST(TestIVFJecq, TestCompareWithIndexJecq) {
     const auto xdb = get_standard_dataset(db_size, d);
 
     for (auto* index : indices) {
-        index->reclassify_features_when_training = false;
-        index->pq_features = {0, 1, 2};
-        index->itq_features = {3, 5};
+        use_fixed_features(index);
 
         auto& faiss_index = index->as_faiss_index();
         faiss_index.verbose = true;
@@ -79,4 +118,782 @@ TEST(TestIVFJecq, TestCompareWithIndexJecq) {
                 << "Label = " << i;
     }
 }
-} // namespace jecq_test
\ No newline at end of file
+
+TEST(TestIVFJecq, TestScanCodesMatchesDistanceToCode) {
+    jecq::IndexIVFJecq index(DEFAULT_DIMENSIONS, 1, 10, 0.05, 0.005);
+    use_fixed_features(&index);
+
+    const faiss::idx_t n = 1000;
+    train(&index, get_standard_dataset());
+    add(&index, random_vector_float(n * index.d));
+    ASSERT_EQ(size_t(n), index.invlists->list_size(0));
+
+    std::unique_ptr<faiss::InvertedListScanner> scanner(
+            index.get_InvertedListScanner(false));
+    const auto xq = random_vector_float(index.d);
+    scanner->set_query(xq.data());
+    scanner->set_list(0, 0);
+
+    faiss::InvertedLists::ScopedCodes codes(index.invlists, 0);
+    faiss::InvertedLists::ScopedIds ids(index.invlists, 0);
+
+    std::vector<float> distances(n);
+    std::vector<faiss::idx_t> labels(n);
+    faiss::minheap_heapify(n, distances.data(), labels.data());
+    scanner->scan_codes(
+            n, codes.get(), ids.get(), distances.data(), labels.data(), n);
+
+    faiss::RangeSearchResult range_result(1);
+    faiss::RangeSearchPartialResult pres(&range_result);
+    scanner->scan_codes_range(
+            n,
+            codes.get(),
+            ids.get(),
+            -std::numeric_limits<float>::max(),
+            pres.new_result(0));
+    pres.finalize();
+    ASSERT_EQ(size_t(n), range_result.lims[1]);
+
+    // list 0 holds the vectors in id order
+    for (faiss::idx_t j = 0; j < n; ++j) {
+        ASSERT_EQ(j, range_result.labels[j]);
+        EXPECT_EQ(
+                scanner->distance_to_code(codes.get() + j * index.code_size),
+                range_result.distances[j]);
+
+        const auto label = labels[j];
+        ASSERT_GE(label, 0);
+        EXPECT_EQ(
+                scanner->distance_to_code(
+                        codes.get() + label * index.code_size),
+                distances[j]);
+    }
+}
+
+TEST(TestIVFJecq, TestByResidual) {
+    const faiss::idx_t d = DEFAULT_DIMENSIONS;
+    const faiss::idx_t nlist = 16;
+    const faiss::idx_t n = 2000;
+
+    const auto xb = random_vector_float(n * d);
+    const auto xq = random_vector_float(d);
+
+    std::vector<double> errors;
+
+    for (const bool by_residual : {false, true}) {
+        jecq::IndexIVFJecq index(d, nlist, 10, 0.05, 0.005);
+        index.by_residual = by_residual;
+        index.nprobe = nlist;
+        index.reclassify_features_when_training = false;
+        for (faiss::idx_t f = 0; f < d; ++f) {
+            index.pq_features.push_back(f);
+        }
+
+        train(&index, xb);
+        add(&index, xb);
+        index.make_direct_map();
+
+        // the centroid term added per list completes the residual score
+        const auto [distances, labels] = search(index, xq, n);
+        std::vector<float> recons(d);
+
+        for (faiss::idx_t j = 0; j < n; ++j) {
+            index.reconstruct(labels[j], recons.data());
+            const float expected = 10 *
+                    faiss::fvec_inner_product(xq.data(), recons.data(), d);
+            EXPECT_NEAR(expected, distances[j], 1e-4 * std::abs(expected));
+        }
+
+        double error = 0;
+        for (faiss::idx_t i = 0; i < n; ++i) {
+            index.reconstruct(i, recons.data());
+            error += faiss::fvec_L2sqr(xb.data() + i * d, recons.data(), d);
+        }
+        errors.push_back(error);
+    }
+
+    EXPECT_LT(errors[1], errors[0]);
+}
+
+TEST(TestIVFJecq, TestEncodeVectorsInBlocksMatchesSingleVectors) {
+    jecq::IndexIVFJecq index(DEFAULT_DIMENSIONS, 10, 10, 0.05, 0.005);
+    index.by_residual = true;
+    use_fixed_features(&index);
+    train(&index, get_standard_dataset());
+
+    // more than one block of vectors
+    const faiss::idx_t n = 10000;
+    const auto x = random_vector_float(n * index.d);
+    std::vector<faiss::idx_t> list_nos(n);
+    index.quantizer->assign(n, x.data(), list_nos.data());
+
+    const size_t record_size = index.sa_code_size();
+    std::vector<uint8_t> codes(n * record_size);
+    index.encode_vectors(n, x.data(), list_nos.data(), codes.data(), true);
+
+    std::vector<uint8_t> code(record_size);
+    for (faiss::idx_t i = 0; i < n; ++i) {
+        const uint8_t* record = codes.data() + i * record_size;
+
+        index.encode_vectors(
+                1, x.data() + i * index.d, &list_nos[i], code.data(), true);
+        ASSERT_EQ(code, std::vector<uint8_t>(record, record + record_size))
+                << "vector " << i;
+        EXPECT_EQ(list_nos[i], index.decode_listno(record));
+    }
+}
+
+TEST(TestIVFJecq, TestStandaloneCodec) {
+    const faiss::idx_t d = DEFAULT_DIMENSIONS;
+    const auto xdb = get_standard_dataset(4000);
+    const faiss::idx_t nb = xdb.size() / d;
+
+    for (int layout = 0; layout < 3; ++layout) {
+        jecq::IndexIVFJecq index(d, 4, 10, 0.05, 0.005);
+        index.by_residual = layout == 0;
+        index.split_codes = layout == 1;
+        index.per_list_features = layout == 2;
+        index.per_list_min_points = 100;
+        if (!index.per_list_features) {
+            use_fixed_features(&index);
+        }
+        train(&index, xdb);
+        add(&index, xdb);
+        index.make_direct_map();
+
+        // the vectors of the index are encoded in the same list
+        const auto codes = encode(&index, xdb);
+        std::vector<float> decoded(nb * d);
+        index.sa_decode(nb, codes.data(), decoded.data());
+
+        // batches of another size may round the ITQ rotation differently
+        std::vector<float> recons(nb * d);
+        index.reconstruct_n(0, nb, recons.data());
+        for (size_t j = 0; j < recons.size(); ++j) {
+            EXPECT_NEAR(
+                    decoded[j], recons[j], 1e-4 * (1 + std::abs(recons[j])));
+        }
+
+        std::vector<float> recons_i(d);
+        for (const faiss::idx_t i : {0, 17, 1234}) {
+            index.reconstruct(i, recons_i.data());
+            for (faiss::idx_t j = 0; j < d; ++j) {
+                EXPECT_NEAR(
+                        recons[i * d + j],
+                        recons_i[j],
+                        1e-4 * (1 + std::abs(recons_i[j])));
+            }
+        }
+
+        if (index.per_list_features) {
+            continue;
+        }
+
+        // features are decoded at their own position, discarded ones to 0
+        double pq_error = 0, pq_norm = 0;
+        for (faiss::idx_t i = 0; i < nb; ++i) {
+            for (const int f : {0, 1, 2}) {
+                const double diff = xdb[i * d + f] - recons[i * d + f];
+                pq_error += diff * diff;
+                pq_norm += xdb[i * d + f] * xdb[i * d + f];
+            }
+            EXPECT_EQ(0, recons[i * d + 4]);
+        }
+        EXPECT_LT(pq_error, 0.01 * pq_norm);
+    }
+}
+
+TEST(TestIVFJecq, TestMergeFrom) {
+    const faiss::idx_t d = DEFAULT_DIMENSIONS;
+    const auto xdb = get_standard_dataset(4000);
+    const auto xq = get_standard_query(xdb, d);
+    const faiss::idx_t nb = xdb.size() / d;
+    const faiss::idx_t nb1 = 1500;
+    const std::vector<float> xdb1(xdb.begin(), xdb.begin() + nb1 * d);
+    const std::vector<float> xdb2(xdb.begin() + nb1 * d, xdb.end());
+
+    for (int layout = 0; layout < 4; ++layout) {
+        jecq::IndexIVFJecq trained(d, 4, 10, 0.05, 0.005);
+        trained.by_residual = layout == 0;
+        trained.split_codes = layout == 1;
+        trained.per_list_features = layout == 2;
+        trained.compress_ids = layout == 3;
+        trained.per_list_min_points = 100;
+        if (!trained.per_list_features) {
+            use_fixed_features(&trained);
+        }
+        train(&trained, xdb);
+
+        const auto whole = clone(trained);
+        const auto shard1 = clone(trained);
+        const auto shard2 = clone(trained);
+        if (layout == 1) {
+            // codes are moved between list layouts
+            shard2->replace_invlists(
+                    new faiss::ArrayInvertedLists(
+                            trained.nlist, trained.code_size),
+                    true);
+        }
+
+        add(whole.get(), xdb);
+        add(shard1.get(), xdb1);
+        add(shard2.get(), xdb2);
+        shard1->merge_from(*shard2, nb1);
+
+        EXPECT_EQ(nb, shard1->ntotal);
+        EXPECT_EQ(0, shard2->ntotal);
+        EXPECT_EQ(0, shard2->invlists->compute_ntotal());
+
+        // the entries of each list are in the order of a single add
+        whole->nprobe = shard1->nprobe = 2;
+        const auto [distances1, labels1] = search(*whole, xq, 20);
+        const auto [distances2, labels2] = search(*shard1, xq, 20);
+        EXPECT_EQ(labels1, labels2);
+        EXPECT_EQ(distances1, distances2);
+    }
+
+    // independently trained indexes do not share their quantizers
+    jecq::IndexIVFJecq index1(d, 4, 10, 0.05, 0.005);
+    jecq::IndexIVFJecq index2(d, 4, 10, 0.05, 0.005);
+    use_fixed_features(&index1);
+    use_fixed_features(&index2);
+    index2.itq_features = {3, 4};
+    train(&index1, xdb);
+    train(&index2, xdb);
+    EXPECT_ANY_THROW(index1.check_compatible_for_merge(index2));
+    EXPECT_ANY_THROW(index1.merge_from(index2, 0));
+}
+
+TEST(TestIVFJecq, TestCopySubsetTo) {
+    const faiss::idx_t d = DEFAULT_DIMENSIONS;
+    const auto xdb = get_standard_dataset(4000);
+    const auto xq = get_standard_query(xdb, d);
+
+    using subset_type_t = faiss::InvertedLists::subset_type_t;
+    const std::vector<std::tuple<subset_type_t, faiss::idx_t, faiss::idx_t>>
+            subsets = {
+                    {subset_type_t::SUBSET_TYPE_ID_RANGE, 1000, 3000},
+                    {subset_type_t::SUBSET_TYPE_ID_MOD, 3, 1},
+                    {subset_type_t::SUBSET_TYPE_ELEMENT_RANGE, 500, 2500},
+                    {subset_type_t::SUBSET_TYPE_INVLIST_FRACTION, 2, 1},
+                    {subset_type_t::SUBSET_TYPE_INVLIST, 1, 3}};
+
+    // split lists, then variable-size lists
+    for (const bool per_list_features : {false, true}) {
+        jecq::IndexIVFJecq trained(d, 4, 10, 0.05, 0.005);
+        trained.split_codes = !per_list_features;
+        trained.per_list_features = per_list_features;
+        trained.per_list_min_points = 100;
+        if (!per_list_features) {
+            use_fixed_features(&trained);
+        }
+        train(&trained, xdb);
+
+        // faiss copies the record layout of ArrayInvertedLists correctly
+        const auto source = clone(trained);
+        const auto records = clone(trained);
+        records->replace_invlists(
+                new faiss::ArrayInvertedLists(
+                        trained.nlist, trained.code_size),
+                true);
+        add(source.get(), xdb);
+        add(records.get(), xdb);
+
+        for (const auto& [subset_type, a1, a2] : subsets) {
+            const auto copy = clone(trained);
+            const auto expected = clone(trained);
+            source->copy_subset_to(*copy, subset_type, a1, a2);
+            records->faiss::IndexIVF::copy_subset_to(
+                    *expected, subset_type, a1, a2);
+
+            EXPECT_GT(copy->ntotal, 0);
+            EXPECT_EQ(expected->ntotal, copy->ntotal);
+            EXPECT_EQ(copy->ntotal, copy->invlists->compute_ntotal());
+
+            copy->nprobe = expected->nprobe = 4;
+            const auto [distances1, labels1] = search(*expected, xq, 20);
+            const auto [distances2, labels2] = search(*copy, xq, 20);
+            EXPECT_EQ(labels1, labels2);
+            EXPECT_EQ(distances1, distances2);
+        }
+
+        // faiss::merge_into goes through merge_from
+        const auto merged = clone(trained);
+        add(merged.get(), xdb);
+        faiss::ivflib::merge_into(merged.get(), source.get(), true);
+        EXPECT_EQ(2 * faiss::idx_t(xdb.size() / d), merged->ntotal);
+        EXPECT_EQ(0, source->ntotal);
+        EXPECT_EQ(merged->ntotal, merged->invlists->compute_ntotal());
+    }
+}
+
+TEST(TestIVFJecq, TestRetrainFilledIndexThrows) {
+    const auto xdb = get_standard_dataset(1000);
+
+    jecq::IndexIVFJecq index(DEFAULT_DIMENSIONS, 10, 10, 0.05, 0.005);
+    train(&index, xdb);
+    add(&index, xdb);
+    EXPECT_THROW(train(&index, xdb), faiss::FaissException);
+    EXPECT_EQ(1000, index.ntotal);
+
+    index.reset();
+    train(&index, xdb);
+    add(&index, xdb);
+    EXPECT_EQ(1000, index.ntotal);
+    EXPECT_EQ(1000, index.invlists->compute_ntotal());
+}
+
+TEST(TestIVFJecq, TestOnDiskInvertedLists) {
+    const auto xdb = get_standard_dataset();
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const std::string filename = testing::TempDir() + "jecq_ondisk.ivfdata";
+
+    jecq::IndexIVFJecq in_memory(DEFAULT_DIMENSIONS, 10, 10, 0.05, 0.005);
+    jecq::IndexIVFJecq on_disk(DEFAULT_DIMENSIONS, 10, 10, 0.05, 0.005);
+
+    for (auto* index : {&in_memory, &on_disk}) {
+        use_fixed_features(index);
+        index->nprobe = 4;
+        train(index, xdb);
+    }
+
+    auto* lists = new faiss::OnDiskInvertedLists(
+            on_disk.nlist, on_disk.code_size, filename.c_str());
+    on_disk.replace_invlists(lists, true);
+
+    // retraining keeps the lists set up by the caller
+    train(&on_disk, xdb);
+    EXPECT_EQ(lists, on_disk.invlists);
+
+    add(&in_memory, xdb);
+    add(&on_disk, xdb);
+    EXPECT_EQ(in_memory.ntotal, on_disk.ntotal);
+
+    const faiss::idx_t k = 10;
+    const auto [distances1, labels1] = search(in_memory, xq, k);
+    const auto [distances2, labels2] = search(on_disk, xq, k);
+    EXPECT_EQ(labels1, labels2);
+    EXPECT_EQ(distances1, distances2);
+
+    in_memory.make_direct_map();
+    on_disk.make_direct_map();
+    std::vector<float> recons1(in_memory.d), recons2(on_disk.d);
+    in_memory.reconstruct(labels1[0], recons1.data());
+    on_disk.reconstruct(labels1[0], recons2.data());
+    EXPECT_EQ(recons1, recons2);
+
+    // lists of another code size are rejected rather than replaced
+    jecq::IndexIVFJecq mismatched(DEFAULT_DIMENSIONS, 10, 10, 0.05, 0.005);
+    mismatched.reclassify_features_when_training = false;
+    mismatched.pq_features = {0, 1};
+    mismatched.itq_features = {3, 5};
+    mismatched.replace_invlists(
+            new faiss::OnDiskInvertedLists(
+                    mismatched.nlist,
+                    on_disk.code_size,
+                    (filename + ".mismatched").c_str()),
+            true);
+    EXPECT_THROW(train(&mismatched, xdb), faiss::FaissException);
+
+    std::remove(filename.c_str());
+    std::remove((filename + ".mismatched").c_str());
+}
+
+TEST(TestIVFJecq, TestSplitInvertedLists) {
+    const size_t pq_code_size = 3;
+    const size_t itq_code_size = 2;
+    jecq::SplitInvertedLists lists(2, pq_code_size, itq_code_size, 4);
+    ASSERT_EQ(pq_code_size + itq_code_size, lists.code_size);
+
+    const size_t n = 10;
+    std::vector<uint8_t> codes(n * lists.code_size);
+    std::vector<faiss::idx_t> ids(n);
+    for (size_t i = 0; i < codes.size(); ++i) {
+        codes[i] = uint8_t(i);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        ids[i] = 100 + i;
+    }
+
+    // two calls, so that the second one starts in a partial block
+    lists.add_entries(1, 3, ids.data(), codes.data());
+    lists.add_entries(
+            1, n - 3, ids.data() + 3, codes.data() + 3 * lists.code_size);
+    ASSERT_EQ(n, lists.list_size(1));
+    EXPECT_EQ(0, lists.list_size(0));
+
+    const uint8_t* blocks = lists.get_codes(1);
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t* code = codes.data() + i * lists.code_size;
+        const uint8_t* block = blocks + (i / 4) * lists.block_size();
+        EXPECT_EQ(
+                0,
+                memcmp(block + (i % 4) * pq_code_size, code, pq_code_size));
+        EXPECT_EQ(
+                0,
+                memcmp(block + 4 * pq_code_size + (i % 4) * itq_code_size,
+                       code + pq_code_size,
+                       itq_code_size));
+
+        faiss::InvertedLists::ScopedCodes single(&lists, 1, i);
+        EXPECT_EQ(0, memcmp(single.get(), code, lists.code_size));
+        EXPECT_EQ(ids[i], lists.get_single_id(1, i));
+    }
+
+    const std::vector<uint8_t> new_code = {9, 8, 7, 6, 5};
+    lists.update_entry(1, 5, 42, new_code.data());
+    faiss::InvertedLists::ScopedCodes updated(&lists, 1, 5);
+    EXPECT_EQ(0, memcmp(updated.get(), new_code.data(), lists.code_size));
+    EXPECT_EQ(42, lists.get_single_id(1, 5));
+}
+
+TEST(TestIVFJecq, TestSplitCodesMatchesRecords) {
+    // lists of several blocks, the last one partial
+    const auto xdb = get_standard_dataset(5000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+
+    jecq::IndexIVFJecq records(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    jecq::IndexIVFJecq split(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    split.split_codes = true;
+
+    for (auto* index : {&records, &split}) {
+        use_fixed_features(index);
+        index->nprobe = 2;
+        train(index, xdb);
+        add(index, xdb);
+    }
+
+    ASSERT_NE(nullptr, dynamic_cast<jecq::SplitInvertedLists*>(split.invlists));
+
+    const faiss::idx_t k = 20;
+    const auto [distances1, labels1] = search(records, xq, k);
+    const auto [distances2, labels2] = search(split, xq, k);
+    EXPECT_EQ(labels1, labels2);
+    EXPECT_EQ(distances1, distances2);
+
+    faiss::IDSelectorRange sel(1000, 3000);
+    jecq::SearchParametersIVFJecq params;
+    params.nprobe = 2;
+    params.sel = &sel;
+    const auto [sel_distances1, sel_labels1] =
+            search(records, xq, k, &params);
+    const auto [sel_distances2, sel_labels2] = search(split, xq, k, &params);
+    EXPECT_EQ(sel_labels1, sel_labels2);
+    EXPECT_EQ(sel_distances1, sel_distances2);
+
+    records.make_direct_map();
+    split.make_direct_map();
+    std::vector<float> recons1(records.d), recons2(split.d);
+    for (faiss::idx_t i : {faiss::idx_t(0), faiss::idx_t(4999)}) {
+        records.reconstruct(i, recons1.data());
+        split.reconstruct(i, recons2.data());
+        EXPECT_EQ(recons1, recons2);
+    }
+}
+
+TEST(TestIVFJecq, TestCompressedIdsInvertedLists) {
+    const size_t code_size = 2;
+    jecq::CompressedIdsInvertedLists lists(2, code_size, 4);
+
+    // increasing, equal, negative and far apart ids
+    const std::vector<faiss::idx_t> ids = {
+            3,
+            10,
+            17,
+            24,
+            5,
+            5,
+            5,
+            5,
+            -7,
+            std::numeric_limits<faiss::idx_t>::max(),
+            0,
+            1};
+    const size_t n = ids.size();
+    std::vector<uint8_t> codes(n * code_size);
+    for (size_t i = 0; i < codes.size(); ++i) {
+        codes[i] = uint8_t(i);
+    }
+
+    // two calls, so that the second one starts in a partial block
+    lists.add_entries(1, 3, ids.data(), codes.data());
+    lists.add_entries(1, n - 3, ids.data() + 3, codes.data() + 3 * code_size);
+    ASSERT_EQ(n, lists.list_size(1));
+    EXPECT_EQ(0, lists.list_size(0));
+    ASSERT_EQ(3, lists.id_blocks[1].size());
+    EXPECT_EQ(5, lists.id_blocks[1][0].nbits);
+    EXPECT_EQ(0, lists.id_blocks[1][1].nbits);
+    EXPECT_EQ(64, lists.id_blocks[1][2].nbits);
+    EXPECT_EQ(0, memcmp(lists.get_codes(1), codes.data(), codes.size()));
+
+    auto expect_ids = [&lists](const std::vector<faiss::idx_t>& expected) {
+        ASSERT_EQ(expected.size(), lists.list_size(1));
+        faiss::InvertedLists::ScopedIds all(&lists, 1);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            EXPECT_EQ(expected[i], lists.get_single_id(1, i)) << i;
+            EXPECT_EQ(expected[i], all[i]) << i;
+        }
+    };
+    expect_ids(ids);
+
+    // updates across a packed block and into the tail
+    std::vector<faiss::idx_t> expected = ids;
+    const std::vector<faiss::idx_t> new_ids = {1000, 2000, 3000};
+    const std::vector<uint8_t> new_codes = {9, 9, 8, 8, 7, 7};
+    lists.update_entries(1, 7, 3, new_ids.data(), new_codes.data());
+    std::copy(new_ids.begin(), new_ids.end(), expected.begin() + 7);
+    expect_ids(expected);
+    EXPECT_EQ(
+            0,
+            memcmp(lists.get_codes(1) + 7 * code_size,
+                   new_codes.data(),
+                   new_codes.size()));
+
+    // shrinking reopens a packed block, growing packs it again
+    lists.resize(1, 6);
+    expected.resize(6);
+    expect_ids(expected);
+    lists.add_entries(1, 3, ids.data(), codes.data());
+    expected.insert(expected.end(), ids.begin(), ids.begin() + 3);
+    expect_ids(expected);
+    EXPECT_EQ(2, lists.id_blocks[1].size());
+}
+
+TEST(TestIVFJecq, TestCompressIdsMatchesArray) {
+    const auto xdb = get_standard_dataset(5000);
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const faiss::idx_t nb = xdb.size() / DEFAULT_DIMENSIONS;
+
+    jecq::IndexIVFJecq array(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    jecq::IndexIVFJecq compressed(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    compressed.compress_ids = true;
+
+    for (auto* index : {&array, &compressed}) {
+        use_fixed_features(index);
+        index->nprobe = 2;
+        train(index, xdb);
+        add(index, xdb);
+    }
+
+    auto* lists = dynamic_cast<jecq::CompressedIdsInvertedLists*>(
+            compressed.invlists);
+    ASSERT_NE(nullptr, lists);
+    EXPECT_LT(lists->ids_memory() * 2, nb * sizeof(faiss::idx_t));
+
+    const faiss::idx_t k = 20;
+    const auto [distances1, labels1] = search(array, xq, k);
+    const auto [distances2, labels2] = search(compressed, xq, k);
+    EXPECT_EQ(labels1, labels2);
+    EXPECT_EQ(distances1, distances2);
+
+    faiss::IDSelectorRange sel(1000, 3000);
+    jecq::SearchParametersIVFJecq params;
+    params.nprobe = 2;
+    params.sel = &sel;
+    const auto [sel_distances1, sel_labels1] = search(array, xq, k, &params);
+    const auto [sel_distances2, sel_labels2] =
+            search(compressed, xq, k, &params);
+    EXPECT_EQ(sel_labels1, sel_labels2);
+    EXPECT_EQ(sel_distances1, sel_distances2);
+
+    EXPECT_EQ(2000, array.remove_ids(sel));
+    EXPECT_EQ(2000, compressed.remove_ids(sel));
+    EXPECT_EQ(array.ntotal, compressed.ntotal);
+    for (size_t list_no = 0; list_no < array.nlist; ++list_no) {
+        ASSERT_EQ(
+                array.invlists->list_size(list_no),
+                lists->list_size(list_no));
+        faiss::InvertedLists::ScopedIds ids1(array.invlists, list_no);
+        faiss::InvertedLists::ScopedIds ids2(lists, list_no);
+        for (size_t i = 0; i < lists->list_size(list_no); ++i) {
+            EXPECT_EQ(ids1[i], ids2[i]);
+        }
+    }
+}
+
+TEST(TestIVFJecq, TestAdaptiveNprobe) {
+    const auto xdb = get_standard_dataset();
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const faiss::idx_t nq = xq.size() / DEFAULT_DIMENSIONS;
+    const faiss::idx_t k = 5;
+
+    jecq::IndexIVFJecq index(DEFAULT_DIMENSIONS, 10, 10, 0.05, 0.005);
+    use_fixed_features(&index);
+    index.nprobe = 8;
+    train(&index, xdb);
+    add(&index, xdb);
+
+    faiss::indexIVF_stats.reset();
+    const auto [distances, labels] = search(index, xq, k);
+    const size_t fixed_nlist = faiss::indexIVF_stats.nlist;
+
+    // without a learned margin, every list is visited
+    index.adaptive_nprobe = true;
+    faiss::indexIVF_stats.reset();
+    const auto [inf_distances, inf_labels] = search(index, xq, k);
+    EXPECT_EQ(labels, inf_labels);
+    EXPECT_EQ(distances, inf_distances);
+    EXPECT_EQ(fixed_nlist, faiss::indexIVF_stats.nlist);
+
+    // the margin learned on the queries themselves keeps their results
+    index.train_probe_margin(nq, xq.data());
+    EXPECT_LT(index.probe_margin, std::numeric_limits<float>::infinity());
+    const auto [learned_distances, learned_labels] = search(index, xq, k);
+    EXPECT_EQ(labels, learned_labels);
+    EXPECT_EQ(distances, learned_distances);
+
+    // a margin that no list can beat stops after the heap is full
+    index.probe_margin = -std::numeric_limits<float>::max();
+    faiss::indexIVF_stats.reset();
+    search(index, xq, k);
+    EXPECT_GE(faiss::indexIVF_stats.nlist, size_t(nq));
+    EXPECT_LT(faiss::indexIVF_stats.nlist, fixed_nlist);
+}
+
+TEST(TestIVFJecq, TestPerListFeatures) {
+    // Clusters around 10 * e_c. Within a cluster, two features have a high
+    // variance, two a mid variance and two are below th_mid.
+    const int d = DEFAULT_DIMENSIONS;
+    const faiss::idx_t nlist = 4;
+    const faiss::idx_t n_per_cluster = 2000;
+    const float scales[DEFAULT_DIMENSIONS] = {1, 1, 0.5f, 0.5f, 0.2f, 0.1f};
+
+    auto x = random_vector_float(nlist * n_per_cluster * d);
+    for (size_t i = 0; i < x.size(); ++i) {
+        const size_t cluster = i / (n_per_cluster * d);
+        const size_t j = i % d;
+        x[i] = scales[j] * x[i] / RAND_MAX + (j == cluster ? 10 : 0);
+    }
+
+    jecq::IndexIVFJecq index(d, nlist, 10, 0.05, 0.005);
+    index.per_list_features = true;
+    train(&index, x);
+    add(&index, x);
+
+    const auto* lists = dynamic_cast<const jecq::VariableSizeInvertedLists*>(
+            index.invlists);
+    ASSERT_NE(nullptr, lists);
+
+    size_t total_bytes = 0;
+    for (size_t list_no = 0; list_no < index.nlist; ++list_no) {
+        EXPECT_LE(lists->list_code_sizes[list_no], index.code_size);
+        total_bytes += lists->list_size(list_no) *
+                lists->list_code_sizes[list_no];
+    }
+    EXPECT_LT(total_bytes, index.ntotal * index.code_size);
+
+    // the scan of the stored codes matches the padded codes
+    std::unique_ptr<faiss::InvertedListScanner> scanner(
+            index.get_InvertedListScanner(false));
+    const std::vector<float> xq = {10, 0.5f, 0.2f, 0.3f, 0.1f, 0};
+    scanner->set_query(xq.data());
+
+    for (size_t list_no = 0; list_no < index.nlist; ++list_no) {
+        const size_t n = lists->list_size(list_no);
+        scanner->set_list(list_no, 0);
+        faiss::InvertedLists::ScopedCodes codes(lists, list_no);
+        faiss::InvertedLists::ScopedIds ids(lists, list_no);
+
+        faiss::RangeSearchResult range_result(1);
+        faiss::RangeSearchPartialResult pres(&range_result);
+        scanner->scan_codes_range(
+                n,
+                codes.get(),
+                ids.get(),
+                -std::numeric_limits<float>::max(),
+                pres.new_result(0));
+        pres.finalize();
+        ASSERT_EQ(n, range_result.lims[1]);
+
+        for (size_t j = 0; j < n; ++j) {
+            faiss::InvertedLists::ScopedCodes code(lists, list_no, j);
+            EXPECT_EQ(ids[j], range_result.labels[j]);
+            EXPECT_EQ(
+                    scanner->distance_to_code(code.get()),
+                    range_result.distances[j]);
+        }
+    }
+}
+
+TEST(TestIVFJecq, TestParallelOverLists) {
+    const int d = DEFAULT_DIMENSIONS;
+    auto xb = random_vector_float(5000 * d);
+    for (auto& v : xb) {
+        v /= RAND_MAX;
+    }
+    const std::vector<float> xq(xb.begin(), xb.begin() + 10 * d);
+    const faiss::idx_t nq = xq.size() / d;
+    const faiss::idx_t k = 10;
+
+    jecq::IndexIVFJecq index(d, 16, 10, 0.05, 0.005);
+    use_fixed_features(&index);
+    index.nprobe = 16;
+    train(&index, xb);
+    add(&index, xb);
+
+    const int nt = omp_get_max_threads();
+
+    for (bool adaptive : {false, true}) {
+        index.adaptive_nprobe = adaptive;
+
+        for (faiss::idx_t i = 0; i < nq; ++i) {
+            const std::vector<float> query(
+                    xq.begin() + i * d, xq.begin() + (i + 1) * d);
+
+            // a single thread scans the lists of the query in order
+            omp_set_num_threads(1);
+            const auto [distances1, labels1] = search(index, query, k);
+
+            omp_set_num_threads(4);
+            faiss::indexIVF_stats.reset();
+            const auto [distances2, labels2] = search(index, query, k);
+
+            EXPECT_EQ(labels1, labels2) << "query " << i;
+            EXPECT_EQ(distances1, distances2) << "query " << i;
+            EXPECT_EQ(index.nprobe, faiss::indexIVF_stats.nlist);
+        }
+    }
+
+    omp_set_num_threads(nt);
+}
+
+TEST(TestIVFJecq, TestHNSWCoarseQuantizer) {
+    const auto xdb = get_standard_dataset();
+    const auto xq = get_standard_query(xdb, DEFAULT_DIMENSIONS);
+    const faiss::idx_t k = 5;
+    const faiss::idx_t nlist = 10;
+
+    jecq::IndexIVFJecq flat_index(
+            DEFAULT_DIMENSIONS, nlist, 10, 0.05, 0.005);
+
+    auto quantizer = new faiss::IndexHNSWFlat(
+            DEFAULT_DIMENSIONS, 32, faiss::METRIC_INNER_PRODUCT);
+    jecq::IndexIVFJecq hnsw_index(
+            quantizer, DEFAULT_DIMENSIONS, nlist, 10, 0.05, 0.005);
+    hnsw_index.own_fields = true;
+
+    for (auto index : {&flat_index, &hnsw_index}) {
+        use_fixed_features(index);
+        index->nprobe = nlist;
+        train(index, xdb);
+        add(index, xdb);
+    }
+
+    // the temporary clustering index does not outlive train
+    EXPECT_EQ(nullptr, hnsw_index.clustering_index);
+    EXPECT_EQ(nlist, quantizer->ntotal);
+    EXPECT_EQ(flat_index.ntotal, hnsw_index.ntotal);
+
+    // both quantizers get the same centroids, and every list is probed
+    const auto [flat_distances, flat_labels] = search(flat_index, xq, k);
+    const auto [hnsw_distances, hnsw_labels] = search(hnsw_index, xq, k);
+    EXPECT_EQ(flat_distances, hnsw_distances);
+
+    faiss::IndexFlatL2 l2_quantizer(DEFAULT_DIMENSIONS);
+    EXPECT_THROW(
+            jecq::IndexIVFJecq(
+                    &l2_quantizer, DEFAULT_DIMENSIONS, nlist, 10, 0.05, 0.005),
+            faiss::FaissException);
+}
+
+} // namespace jecq_test
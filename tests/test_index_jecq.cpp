@@ -19,10 +19,349 @@
 // SOFTWARE.
 
 #include "datasets.h"
+#include "index_helpers.h"
 #include "utils.h"
 
 #include <jecq/index_jecq.h>
 
 #include <gtest/gtest.h>
 
-namespace jecq_test {} // namespace jecq_test
\ No newline at end of file
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace jecq_test {
+
+TEST(TestIndexJecq, TestTopKMatchesFullRanking) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = DEFAULT_DB_SIZE;
+
+    jecq::IndexJecq index(d, 10, 0.05, 0.005);
+    use_fixed_features(&index);
+
+    const auto xdb = get_standard_dataset(db_size, d);
+    train(&index, xdb);
+    add(&index, xdb);
+
+    const auto xq = get_standard_query(xdb, d);
+    const faiss::idx_t nq = xq.size() / d;
+    const faiss::idx_t k = 7;
+
+    const auto [distances_full, labels_full] = search(index, xq, db_size);
+    const auto [distances, labels] = search(index, xq, k);
+
+    for (faiss::idx_t i = 0; i < nq; ++i) {
+        for (faiss::idx_t j = 0; j < k; ++j) {
+            EXPECT_EQ(distances_full[i * db_size + j], distances[i * k + j])
+                    << "query " << i << ", rank " << j;
+            EXPECT_NE(-1, labels[i * k + j]);
+        }
+    }
+}
+
+TEST(TestIndexJecq, TestSingleQuerySearchMatchesBatchSearch) {
+    const int d = DEFAULT_DIMENSIONS;
+
+    jecq::IndexJecq index(d, 10, 0.05, 0.005);
+    index.reclassify_features_when_training = false;
+    index.pq_features = {0, 1, 2};
+    index.itq_features = {3, 4, 5};
+
+    // Large enough for single queries to be split across database slices
+    const auto xdb = random_vector_float(100000 * d);
+    train(&index, {xdb.begin(), xdb.begin() + 10000 * d});
+    add(&index, xdb);
+
+    const faiss::idx_t nq = 20;
+    const faiss::idx_t k = 10;
+    const auto xq = random_vector_float(nq * d);
+
+    const auto [distances, labels] = search(index, xq, k);
+
+    for (faiss::idx_t i = 0; i < nq; ++i) {
+        const auto [distances_i, labels_i] =
+                search(index, get_row(xq, d, i), k);
+
+        for (faiss::idx_t j = 0; j < k; ++j) {
+            EXPECT_EQ(distances[i * k + j], distances_i[j])
+                    << "query " << i << ", rank " << j;
+        }
+    }
+}
+
+TEST(TestIndexJecq, TestITQPrefilterScoresMatchExhaustive) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 2000;
+
+    jecq::IndexJecq index(d, 10, 0.05, 0.005);
+    index.reclassify_features_when_training = false;
+    index.pq_features = {0, 1, 2};
+    index.itq_features = {3, 4, 5};
+
+    const auto xdb = random_vector_float(db_size * d);
+    train(&index, xdb);
+    add(&index, xdb);
+
+    const faiss::idx_t nq = 5;
+    const faiss::idx_t k = 10;
+    const auto xq = random_vector_float(nq * d);
+
+    const auto [distances_full, labels_full] = search(index, xq, db_size);
+
+    jecq::SearchParametersJecq params;
+    params.search_mode = jecq::JecqSearchMode::ITQPrefilter;
+    params.prefilter_k_factor = 20;
+
+    std::vector<float> distances(nq * k);
+    std::vector<faiss::idx_t> labels(nq * k);
+    index.search(nq, xq.data(), k, distances.data(), labels.data(), &params);
+
+    for (faiss::idx_t i = 0; i < nq; ++i) {
+        std::vector<float> distance_by_label(db_size);
+        for (faiss::idx_t j = 0; j < db_size; ++j) {
+            distance_by_label[labels_full[i * db_size + j]] =
+                    distances_full[i * db_size + j];
+        }
+
+        for (faiss::idx_t j = 0; j < k; ++j) {
+            const auto label = labels[i * k + j];
+            ASSERT_GE(label, 0);
+            EXPECT_EQ(distance_by_label[label], distances[i * k + j]);
+            EXPECT_LE(distances[i * k + j], distances_full[i * db_size + j]);
+        }
+    }
+}
+
+TEST(TestIndexJecq, TestSearchParamsKeepIndexSettingsWhenUnset) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 2000;
+
+    jecq::IndexJecq index(d, 10, 0.05, 0.005);
+    index.reclassify_features_when_training = false;
+    index.pq_features = {0, 1, 2};
+    index.itq_features = {3, 4, 5};
+
+    const auto xdb = random_vector_float(db_size * d);
+    train(&index, xdb);
+    add(&index, xdb);
+    const auto xq = random_vector_float(5 * d);
+    const faiss::idx_t k = 10;
+
+    index.search_mode = jecq::JecqSearchMode::Exhaustive;
+    const auto [distances_exhaustive, labels_exhaustive] =
+            search(index, xq, k);
+
+    index.search_mode = jecq::JecqSearchMode::ITQPrefilter;
+    index.prefilter_k_factor = 1;
+    const auto [distances_prefilter, labels_prefilter] = search(index, xq, k);
+
+    // params that only set sel keep the prefilter of the index
+    faiss::IDSelectorAll all;
+    jecq::SearchParametersJecq params;
+    params.sel = &all;
+    const auto [distances1, labels1] = search(index, xq, k, &params);
+    EXPECT_EQ(labels_prefilter, labels1);
+    EXPECT_EQ(distances_prefilter, distances1);
+
+    params.search_mode = jecq::JecqSearchMode::Exhaustive;
+    const auto [distances2, labels2] = search(index, xq, k, &params);
+    EXPECT_EQ(labels_exhaustive, labels2);
+    EXPECT_EQ(distances_exhaustive, distances2);
+}
+
+TEST(TestIndexJecq, TestInterleavedCodesMatchSeparateCodes) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 2000;
+
+    jecq::IndexJecq separate(d, 10, 0.05, 0.005);
+    separate.reclassify_features_when_training = false;
+    separate.pq_features = {0, 1, 2};
+    separate.itq_features = {3, 4, 5};
+
+    const auto xdb = random_vector_float(db_size * d);
+    train(&separate, xdb);
+
+    jecq::IndexJecq interleaved = separate;
+    interleaved.set_interleaved_codes(true);
+
+    add(&separate, xdb);
+    add(&interleaved, xdb);
+
+    EXPECT_EQ(db_size * interleaved.code_size, interleaved.codes.size());
+    EXPECT_ANY_THROW(interleaved.set_interleaved_codes(false));
+
+    const faiss::idx_t nq = 5;
+    const faiss::idx_t k = 10;
+    const auto xq = random_vector_float(nq * d);
+
+    const auto [distances, labels] = search(separate, xq, k);
+    const auto [distances_interleaved, labels_interleaved] =
+            search(interleaved, xq, k);
+
+    EXPECT_EQ(distances, distances_interleaved);
+    EXPECT_EQ(labels, labels_interleaved);
+
+    // The prefilter reads the ITQ codes with a stride in this layout
+    jecq::SearchParametersJecq params;
+    params.search_mode = jecq::JecqSearchMode::ITQPrefilter;
+
+    std::vector<float> distances_prefilter(nq * k);
+    std::vector<faiss::idx_t> labels_prefilter(nq * k);
+    interleaved.search(
+            nq,
+            xq.data(),
+            k,
+            distances_prefilter.data(),
+            labels_prefilter.data(),
+            &params);
+
+    for (faiss::idx_t i = 0; i < nq * k; ++i) {
+        ASSERT_GE(labels_prefilter[i], 0);
+        EXPECT_LE(distances_prefilter[i], distances[i]);
+    }
+}
+
+TEST(TestIndexJecq, TestStandaloneCodec) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 2000;
+
+    jecq::IndexJecq separate(d, 10, 0.05, 0.005);
+    use_fixed_features(&separate);
+
+    const auto xdb = random_vector_float(db_size * d);
+    train(&separate, xdb);
+
+    jecq::IndexJecq interleaved = separate;
+    interleaved.set_interleaved_codes(true);
+    add(&separate, xdb);
+    add(&interleaved, xdb);
+
+    // sa_encode produces the records of the interleaved layout
+    EXPECT_EQ(interleaved.code_size, separate.sa_code_size());
+    const auto codes = encode(&separate, xdb);
+    EXPECT_TRUE(std::equal(
+            codes.begin(),
+            codes.end(),
+            interleaved.codes.begin(),
+            interleaved.codes.end()));
+
+    std::vector<float> decoded(db_size * d);
+    separate.sa_decode(db_size, codes.data(), decoded.data());
+
+    for (const auto* index : {&separate, &interleaved}) {
+        std::vector<float> recons(db_size * d);
+        index->reconstruct_n(0, db_size, recons.data());
+        EXPECT_EQ(decoded, recons);
+
+        // a batch of another size may round the ITQ rotation differently
+        std::vector<float> recons_17(d);
+        index->reconstruct(17, recons_17.data());
+        for (int j = 0; j < d; ++j) {
+            EXPECT_NEAR(
+                    decoded[17 * d + j],
+                    recons_17[j],
+                    1e-4 * (1 + std::abs(recons_17[j])));
+        }
+    }
+
+    // features are decoded at their own position, discarded ones to 0
+    double pq_error = 0, pq_norm = 0;
+    for (int i = 0; i < db_size; ++i) {
+        for (const int f : {0, 1, 2}) {
+            const double x = xdb[i * d + f] - RAND_MAX / 2.0;
+            const double diff = xdb[i * d + f] - decoded[i * d + f];
+            pq_error += diff * diff;
+            pq_norm += x * x;
+        }
+        EXPECT_EQ(0, decoded[i * d + 4]);
+    }
+    EXPECT_LT(pq_error, 0.01 * pq_norm);
+}
+
+TEST(TestIndexJecq, TestMergeFrom) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 2000;
+    const int db_size1 = 800;
+
+    jecq::IndexJecq trained(d, 10, 0.05, 0.005);
+    use_fixed_features(&trained);
+
+    const auto xdb = random_vector_float(db_size * d);
+    const std::vector<float> xdb1(xdb.begin(), xdb.begin() + db_size1 * d);
+    const std::vector<float> xdb2(xdb.begin() + db_size1 * d, xdb.end());
+    train(&trained, xdb);
+
+    jecq::IndexJecq whole = trained;
+    add(&whole, xdb);
+    const auto xq = random_vector_float(5 * d);
+    const auto [distances, labels] = search(whole, xq, 10);
+
+    // shards of either layout merge into either layout
+    for (const bool interleaved1 : {false, true}) {
+        for (const bool interleaved2 : {false, true}) {
+            jecq::IndexJecq shard1 = trained;
+            jecq::IndexJecq shard2 = trained;
+            shard1.set_interleaved_codes(interleaved1);
+            shard2.set_interleaved_codes(interleaved2);
+            add(&shard1, xdb1);
+            add(&shard2, xdb2);
+
+            shard1.merge_from(shard2);
+            EXPECT_EQ(db_size, shard1.ntotal);
+            EXPECT_EQ(0, shard2.ntotal);
+
+            const auto [distances1, labels1] = search(shard1, xq, 10);
+            EXPECT_EQ(labels, labels1);
+            EXPECT_EQ(distances, distances1);
+        }
+    }
+
+    EXPECT_ANY_THROW(whole.merge_from(trained, 10));
+
+    jecq::IndexJecq other_features = trained;
+    other_features.itq_features = {3, 4};
+    train(&other_features, xdb);
+    EXPECT_ANY_THROW(whole.check_compatible_for_merge(other_features));
+
+    // same features, quantizers trained on other data
+    jecq::IndexJecq other_data = trained;
+    train(&other_data, random_vector_float(db_size * d));
+    EXPECT_ANY_THROW(whole.merge_from(other_data));
+}
+
+TEST(TestIndexJecq, TestSearchWithForeignParamsFails) {
+    jecq::IndexJecq index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+
+    const auto xdb = get_standard_dataset();
+    train(&index, xdb);
+    add(&index, xdb);
+
+    const auto xq = get_standard_query(xdb, index.d);
+    const faiss::idx_t k = 3;
+    std::vector<float> distances(k * 2);
+    std::vector<faiss::idx_t> labels(k * 2);
+
+    faiss::SearchParameters params;
+    EXPECT_ANY_THROW(index.search(
+            2, xq.data(), k, distances.data(), labels.data(), &params));
+}
+
+TEST(TestIndexJecq, TestResetClearsIndex) {
+    jecq::IndexJecq index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+
+    const auto xdb = get_standard_dataset();
+    train(&index, xdb);
+    add(&index, xdb);
+    index.reset();
+
+    EXPECT_EQ(0, index.ntotal);
+
+    const faiss::idx_t k = 3;
+    const auto [distances, labels] =
+            search(index, get_standard_query(xdb, index.d), k);
+
+    EXPECT_EQ(std::vector<faiss::idx_t>(labels.size(), -1), labels);
+}
+
+} // namespace jecq_test
\ No newline at end of file
@@ -0,0 +1,262 @@
+// Copyright (c) 2025 Janea Systems
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "datasets.h"
+#include "index_helpers.h"
+#include "utils.h"
+
+#include <jecq/distance_kernels.h>
+#include <jecq/index_io.h>
+#include <jecq/index_ivf_jecq_fast_scan.h>
+#include <jecq/index_jecq.h>
+#include <jecq/index_jecq_fast_scan.h>
+#include <jecq/pq4_block_inverted_lists.h>
+
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/FaissException.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/impl/io.h>
+#include <faiss/invlists/InvertedLists.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace jecq_test {
+
+TEST(TestIndexJecqFastScan, TestChunkedAddMatchesSingleAdd) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 1000;
+
+    jecq::IndexJecqFastScan index1(d, 10, 0.05, 0.005);
+    use_fixed_features(&index1);
+
+    const auto xdb = random_vector_float(db_size * d);
+    train(&index1, xdb);
+
+    jecq::IndexJecqFastScan index2 = index1;
+
+    add(&index1, xdb);
+
+    // Chunks that do not end on a block boundary
+    for (int i0 = 0; i0 < db_size; i0 += 77) {
+        const int i1 = std::min(i0 + 77, db_size);
+        index2.add(i1 - i0, xdb.data() + i0 * d);
+    }
+
+    const size_t nblocks = (db_size + 31) / 32;
+    EXPECT_EQ(nblocks * jecq::pq4_block_size(3), index1.pq_codes.size());
+    EXPECT_EQ(index1.pq_codes.size(), index2.pq_codes.size());
+
+    const auto xq = random_vector_float(10 * d);
+    const faiss::idx_t k = 10;
+
+    const auto [distances1, labels1] = search(index1, xq, k);
+    const auto [distances2, labels2] = search(index2, xq, k);
+
+    EXPECT_EQ(distances1, distances2);
+    EXPECT_EQ(labels1, labels2);
+}
+
+TEST(TestIndexJecqFastScan, TestCompareWithIndexIVFJecqFastScan) {
+    const int d = DEFAULT_DIMENSIONS;
+    const int db_size = 500;
+
+    jecq::IndexJecqFastScan index1(d, 1, 0.05, 0.005);
+    jecq::IndexIVFJecqFastScan index2(d, 1, 1, 0.05, 0.005);
+    use_fixed_features(&index1);
+    use_fixed_features(&index2);
+
+    const auto xdb = random_vector_float(db_size * d);
+    train(&index1, xdb);
+    train(&index2, xdb);
+    add(&index1, xdb);
+    add(&index2, xdb);
+
+    const auto xq = get_standard_query(xdb, d);
+
+    const auto [distances1, labels1] = search(index1, xq, db_size);
+    const auto [distances2, labels2] = search(index2, xq, db_size);
+
+    std::vector<float> by_label1(distances1.size());
+    std::vector<float> by_label2(distances2.size());
+    const size_t nq = xq.size() / d;
+
+    for (size_t i = 0; i < labels1.size(); ++i) {
+        const auto offset = (i / db_size) * db_size;
+        ASSERT_GE(labels1[i], 0);
+        ASSERT_GE(labels2[i], 0);
+        by_label1[offset + labels1[i]] = distances1[i];
+        by_label2[offset + labels2[i]] = distances2[i];
+    }
+
+    EXPECT_EQ(nq * db_size, by_label1.size());
+    EXPECT_EQ(by_label1, by_label2);
+}
+
+TEST(TestIndexJecqFastScan, TestIVFBlockListsMatchRecords) {
+    const int d = DEFAULT_DIMENSIONS;
+    // lists of several blocks, the last one partial
+    const auto xdb = random_vector_float(3000 * d);
+    const auto xq = get_standard_query(xdb, d);
+
+    jecq::IndexIVFJecqFastScan blocks(d, 4, 10, 0.05, 0.005);
+    jecq::IndexIVFJecqFastScan records(d, 4, 10, 0.05, 0.005);
+    for (auto* index : {&blocks, &records}) {
+        use_fixed_features(index);
+        index->nprobe = 2;
+        train(index, xdb);
+    }
+    ASSERT_NE(
+            nullptr,
+            dynamic_cast<jecq::PQ4BlockInvertedLists*>(blocks.invlists));
+    records.replace_invlists(
+            new faiss::ArrayInvertedLists(records.nlist, records.code_size),
+            true);
+    add(&blocks, xdb);
+    add(&records, xdb);
+
+    // codes go in and out of the blocks in the record layout
+    for (size_t list_no = 0; list_no < blocks.nlist; ++list_no) {
+        const size_t list_size = records.invlists->list_size(list_no);
+        ASSERT_EQ(list_size, blocks.invlists->list_size(list_no));
+        for (size_t j = 0; j < list_size; ++j) {
+            faiss::InvertedLists::ScopedCodes code1(
+                    records.invlists, list_no, j);
+            faiss::InvertedLists::ScopedCodes code2(
+                    blocks.invlists, list_no, j);
+            ASSERT_EQ(0, memcmp(code1.get(), code2.get(), blocks.code_size));
+        }
+    }
+
+    const faiss::idx_t k = 20;
+    const auto [distances1, labels1] = search(records, xq, k);
+    const auto [distances2, labels2] = search(blocks, xq, k);
+    EXPECT_EQ(labels1, labels2);
+    EXPECT_EQ(distances1, distances2);
+
+    // a range selects some blocks partly and skips the others
+    faiss::IDSelectorRange sel(1000, 1040);
+    faiss::SearchParametersIVF params;
+    params.nprobe = 2;
+    params.sel = &sel;
+    const auto [sel_distances1, sel_labels1] =
+            search(records, xq, k, &params);
+    const auto [sel_distances2, sel_labels2] = search(blocks, xq, k, &params);
+    EXPECT_EQ(sel_labels1, sel_labels2);
+    EXPECT_EQ(sel_distances1, sel_distances2);
+    for (const faiss::idx_t label : sel_labels2) {
+        EXPECT_TRUE(label == -1 || sel.is_member(label));
+    }
+
+    const size_t nq = xq.size() / d;
+    const float radius = distances1[k - 1];
+    faiss::RangeSearchResult result1(nq), result2(nq);
+    records.range_search(nq, xq.data(), radius, &result1);
+    blocks.range_search(nq, xq.data(), radius, &result2);
+    ASSERT_EQ(result1.lims[nq], result2.lims[nq]);
+    for (size_t i = 0; i < result1.lims[nq]; ++i) {
+        EXPECT_EQ(result1.labels[i], result2.labels[i]);
+        EXPECT_EQ(result1.distances[i], result2.distances[i]);
+    }
+
+    // whole lists leave and enter the blocks in the record layout
+    faiss::VectorIOWriter writer;
+    jecq::write_index(&blocks, &writer);
+    auto read_empty = [&writer] {
+        faiss::VectorIOReader reader;
+        reader.data = writer.data;
+        std::unique_ptr<faiss::Index> read(jecq::read_index(&reader));
+        read->reset();
+        return read;
+    };
+    const auto copy = read_empty();
+    const auto merged = read_empty();
+    auto* copy_ivf = dynamic_cast<jecq::IndexIVFJecqFastScan*>(copy.get());
+    auto* merged_ivf =
+            dynamic_cast<jecq::IndexIVFJecqFastScan*>(merged.get());
+    ASSERT_NE(nullptr, copy_ivf);
+    ASSERT_NE(nullptr, merged_ivf);
+    copy_ivf->replace_invlists(
+            new faiss::ArrayInvertedLists(records.nlist, records.code_size),
+            true);
+
+    blocks.copy_subset_to(
+            *copy_ivf,
+            faiss::InvertedLists::SUBSET_TYPE_INVLIST,
+            0,
+            blocks.nlist);
+    merged_ivf->merge_from(*copy_ivf, 0);
+    EXPECT_EQ(blocks.ntotal, merged_ivf->ntotal);
+    merged_ivf->nprobe = 2;
+    const auto [distances3, labels3] = search(*merged_ivf, xq, k);
+    EXPECT_EQ(labels1, labels3);
+    EXPECT_EQ(distances1, distances3);
+}
+
+TEST(TestIndexJecqFastScan, TestIVFUnsupportedLayoutsThrow) {
+    const auto xdb = get_standard_dataset(1000);
+
+    // rejected before any training work
+    jecq::IndexIVFJecqFastScan split(DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    split.split_codes = true;
+    EXPECT_THROW(train(&split, xdb), faiss::FaissException);
+    EXPECT_FALSE(split.is_trained);
+
+    jecq::IndexIVFJecqFastScan per_list(
+            DEFAULT_DIMENSIONS, 4, 10, 0.05, 0.005);
+    per_list.per_list_features = true;
+    EXPECT_THROW(train(&per_list, xdb), faiss::FaissException);
+    EXPECT_FALSE(per_list.is_trained);
+}
+
+TEST(TestIndexJecqFastScan, TestSearchWithUnsupportedParamsFails) {
+    jecq::IndexJecqFastScan index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    const auto xdb = get_standard_dataset();
+    train(&index, xdb);
+    add(&index, xdb);
+    const auto xq = get_standard_query(xdb, index.d);
+
+    faiss::SearchParametersIVF foreign;
+    EXPECT_THROW(search(index, xq, 3, &foreign), faiss::FaissException);
+
+    jecq::SearchParametersJecq prefilter;
+    prefilter.search_mode = jecq::JecqSearchMode::ITQPrefilter;
+    EXPECT_THROW(search(index, xq, 3, &prefilter), faiss::FaissException);
+
+    jecq::SearchParametersJecq multiplier;
+    multiplier.pq_multiplier = 3;
+    EXPECT_NO_THROW(search(index, xq, 3, &multiplier));
+}
+
+TEST(TestIndexJecqFastScan, TestSearchWhenEmpty) {
+    jecq::IndexJecqFastScan index(DEFAULT_DIMENSIONS, 10, 0.05, 0.005);
+    train(&index, get_standard_dataset());
+
+    const faiss::idx_t k = 3;
+    const auto [distances, labels] =
+            search(index, random_vector_float(2 * index.d), k);
+
+    EXPECT_EQ(std::vector<faiss::idx_t>(2 * k, -1), labels);
+}
+
+} // namespace jecq_test